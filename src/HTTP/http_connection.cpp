@@ -1,3 +1,4 @@
+#include "cancel_context.h"
 #include "http_connection.h"
 #include "log.h"
 #include "http_parser.h"
@@ -71,7 +72,22 @@ namespace Framework {
             return DoRequest(req, uri, timeout_ms);
         }
 
+        // 当前协程的取消上下文已经结束时不再发起请求；请求失败时如果是上下文结束导致的，也按取消报告
+        static HttpResult::ptr CancelledResult() {
+            int error = CancelContext::CurrentError();
+            if (!error) {
+                return nullptr;
+            }
+            return std::make_shared<HttpResult>((int)HttpResult::Error::CANCELLED
+                , nullptr, "request cancelled: " + std::string(strerror(error)));
+        }
+
         HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req, Uri::ptr uri, uint64_t timeout_ms) {
+            if (auto cancelled = CancelledResult()) {
+                return cancelled;
+            }
+            // 超时不超过当前协程剩余的时间，连接、收发的hook也各自受它约束
+            timeout_ms = CancelContext::Clamp(timeout_ms);
             // URI -> address
             Address::ptr addr = uri->createAddressFromUri();
             if (!addr) {
@@ -86,6 +102,9 @@ namespace Framework {
             }
             // connection
             if (!sock->connect(addr)) {
+                if (auto cancelled = CancelledResult()) {
+                    return cancelled;
+                }
                 return std::make_shared<HttpResult>((int)HttpResult::Error::CONNECT_FAILED
                     , nullptr, "connect fail: " + addr->toString());
             }
@@ -105,6 +124,9 @@ namespace Framework {
             // recv
             auto rsp = conn->recvResponse();
             if (!rsp) {
+                if (auto cancelled = CancelledResult()) {
+                    return cancelled;
+                }
                 return std::make_shared<HttpResult>((int)HttpResult::Error::RECV_TIMEOUT
                     , nullptr, "recv response timeout: " + addr->toString()
                     + " timeout_ms:" + std::to_string(timeout_ms));
@@ -323,6 +345,10 @@ namespace Framework {
         }
 
         HttpResult::ptr HttpConnectionPool::DoRequest(HttpRequest::ptr req, uint64_t timeout_ms) {
+            if (auto cancelled = CancelledResult()) {
+                return cancelled;
+            }
+            timeout_ms = CancelContext::Clamp(timeout_ms);
             auto conn = getConnection();
             if (!conn) {
                 return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_CONNECT_FAILED
@@ -350,6 +376,9 @@ namespace Framework {
             // recv
             auto rsp = conn->recvResponse();
             if (!rsp) {
+                if (auto cancelled = CancelledResult()) {
+                    return cancelled;
+                }
                 return std::make_shared<HttpResult>((int)HttpResult::Error::RECV_TIMEOUT
                     , nullptr, "recv response timeout: " + sock->getRemoteAddress()->toString()
                     + " timeout_ms:" + std::to_string(timeout_ms));
@@ -21,6 +21,7 @@ namespace Framework {
                 RECV_TIMEOUT = 6,
                 POOL_CONNECT_FAILED = 7,
                 POOL_INVALID_CONNECTION = 8,
+                CANCELLED = 9, // 当前协程的取消上下文已经取消或到期（见cancel_context.h）
             };
 
             HttpResult(int _result, HttpResponse::ptr _response, const std::string& _error)
@@ -1,3 +1,5 @@
+#include "cancel_context.h"
+#include "config.h"
 #include "http_server.h"
 #include "log.h"
 
@@ -5,16 +7,24 @@ namespace Framework {
     namespace HTTP {
         static Logger::ptr g_logger = LOG_NAME("system");
 
+        static ConfigVar<uint64_t>::ptr g_http_server_request_timeout =
+            Config::Lookup("http_server.request_timeout", (uint64_t)0,
+                "http server per-request handling budget in ms (servlet IO, sleeps, upstream calls), 0 disables; "
+                "routes can set a tighter one with Servlet::setTimeout");
+
         HttpServer::HttpServer(bool keepAlive
             , Framework::IOManager* handleClientWorker
             , Framework::IOManager* acceptWorker)
             : TcpServer(handleClientWorker, acceptWorker)
-            , m_isKeepAlive(keepAlive) {
+            , m_isKeepAlive(keepAlive)
+            , m_requestTimeout(g_http_server_request_timeout->getValue()) {
             m_dispatch.reset(new ServletDispatch());
         }
 
         void HttpServer::handleClient(Socket::ptr client) {
             HttpSession::ptr session(new HttpSession(client));
+            // 路由可能调整了协程的优先级（见Servlet::getPriority），每个请求处理完恢复成连接原来的优先级
+            Fiber::Priority priority = Fiber::GetCurrentPriority();
             do {
                 auto req = session->recvRequest();
                 if (!req) {
@@ -25,15 +35,32 @@ namespace Framework {
                     break;
                 }
 
+                // 开启了过载判断（scheduler.codel_target_ms）时，排队太久的请求直接回503并断开，不再占用处理时间
+                // 排队这么久的请求大多已经超过客户端的超时，处理了也没人读；快速拒绝让队列短下来，后面的请求能按时完成
+                if (getHandleClientWorker()->shouldShed()) {
+                    HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), true));
+                    rsp->setStatus(HttpStatus::SERVICE_UNAVAILABLE);
+                    session->sendResponse(rsp);
+                    break;
+                }
+
                 HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), req->isClose() || !m_isKeepAlive));
 
-                m_dispatch->handle(req, rsp, session);
+                // 处理时限只覆盖servlet，回复不受它影响：超时的请求仍然把servlet给出的（错误）响应发回去
+                if (m_requestTimeout) {
+                    CancelScope scope(CancelContext::Create(m_requestTimeout));
+                    m_dispatch->handle(req, rsp, session);
+                }
+                else {
+                    m_dispatch->handle(req, rsp, session);
+                }
                 /*handle里不直接response，这里是切面程序思想。可能在handle的before和after都有其他事情需要处理。*/
 
                 /*test*/
                 //rsp->setBody("hello world");
 
                 session->sendResponse(rsp);
+                Fiber::GetThis()->setPriority(priority);
 
                 if(!m_isKeepAlive || req->isClose()) {
                     break;
@@ -19,6 +19,7 @@ namespace Framework {
             virtual void handleClient(Socket::ptr client) override;
         private:
             bool m_isKeepAlive;
+            uint64_t m_requestTimeout; // http_server.request_timeout
             ServletDispatch::ptr m_dispatch;
         };
 	}
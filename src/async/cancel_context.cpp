@@ -0,0 +1,115 @@
+#include <algorithm>
+
+#include "cancel_context.h"
+#include "fiber.h"
+#include "utils.h"
+
+namespace Framework {
+    CancelContext::CancelContext(uint64_t deadline)
+        : m_deadline(deadline) {
+    }
+
+    CancelContext::ptr CancelContext::Create(uint64_t timeout_ms, CancelContext::ptr parent) {
+        uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+        if (parent) {
+            deadline = std::min(deadline, parent->getDeadline());
+        }
+        CancelContext::ptr ctx(new CancelContext(deadline));
+        if (parent) {
+            // 父上下文只持有裸指针：子上下文析构时先撤销登记，delWaker保证撤销之后唤醒函数不在执行
+            CancelContext* child = ctx.get();
+            ctx->m_parentWaker = parent->addWaker([child](int error) {
+                child->cancel(error);
+            });
+            if (!ctx->m_parentWaker) {
+                ctx->cancel(parent->getError());
+            }
+            ctx->m_parent = parent;
+        }
+        return ctx;
+    }
+
+    CancelContext::~CancelContext() {
+        if (m_parentWaker) {
+            m_parent->delWaker(m_parentWaker);
+        }
+    }
+
+    uint64_t CancelContext::getRemaining() const {
+        if (m_error) {
+            return 0;
+        }
+        if (m_deadline == ~0ull) {
+            return ~0ull;
+        }
+        uint64_t now = GetCurrentMS();
+        return m_deadline > now ? m_deadline - now : 0;
+    }
+
+    int CancelContext::getError() const {
+        int error = m_error;
+        if (error) {
+            return error;
+        }
+        if (m_deadline != ~0ull && GetCurrentMS() >= m_deadline) {
+            return ETIMEDOUT;
+        }
+        return 0;
+    }
+
+    void CancelContext::cancel(int error) {
+        Mutex::Lock lock(m_mutex);
+        if (m_error) {
+            return;
+        }
+        m_error = error;
+        for (auto& i : m_wakers) {
+            i.second(error);
+        }
+        m_wakers.clear();
+    }
+
+    uint64_t CancelContext::addWaker(Waker cb) {
+        Mutex::Lock lock(m_mutex);
+        if (m_error) {
+            return 0;
+        }
+        uint64_t id = m_nextId++;
+        m_wakers.emplace_back(id, std::move(cb));
+        return id;
+    }
+
+    void CancelContext::delWaker(uint64_t id) {
+        Mutex::Lock lock(m_mutex);
+        for (auto it = m_wakers.begin(); it != m_wakers.end(); ++it) {
+            if (it->first == id) {
+                m_wakers.erase(it);
+                break;
+            }
+        }
+    }
+
+    CancelContext::ptr CancelContext::GetCurrent() {
+        return Fiber::GetCurrentCancelContext();
+    }
+
+    uint64_t CancelContext::Clamp(uint64_t timeout_ms) {
+        CancelContext::ptr ctx = Fiber::GetCurrentCancelContext();
+        return ctx ? std::min(timeout_ms, ctx->getRemaining()) : timeout_ms;
+    }
+
+    int CancelContext::CurrentError() {
+        CancelContext::ptr ctx = Fiber::GetCurrentCancelContext();
+        return ctx ? ctx->getError() : 0;
+    }
+
+    CancelScope::CancelScope(CancelContext::ptr ctx) {
+        Fiber::ptr fiber = Fiber::GetThis();
+        m_prev = fiber->getCancelContext();
+        fiber->setCancelContext(std::move(ctx));
+    }
+
+    CancelScope::~CancelScope() {
+        Fiber::GetThis()->setCancelContext(std::move(m_prev));
+    }
+}
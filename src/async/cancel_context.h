@@ -0,0 +1,74 @@
+#pragma once
+// 协程级的截止时间/取消上下文：一个请求的总预算挂在处理它的协程上，hook的IO、sleep、限时的协程同步原语、通道、HttpConnection都不会等过剩余时间，
+// 取消时立刻唤醒正阻塞在其中的协程
+
+#include <errno.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "multithread.h"
+#include "noncopyable.h"
+
+namespace Framework {
+    /*
+    上下文挂在协程上（Fiber::GetCurrentCancelContext），新建的协程继承创建者的上下文；调度器执行的回调不继承，需要的话自己捕获后用CancelScope装上
+    截止时间不靠定时器主动触发：阻塞操作的超时取原超时和剩余时间的较小值，到期后按超时失败（ETIMEDOUT）
+    cancel()把上下文标记为取消，并调用阻塞中的操作登记的唤醒函数，让它立刻以取消的错误码（默认ECANCELED）失败
+    子上下文的截止时间不晚于父上下文，父上下文取消时子上下文一起取消
+    */
+    class CancelContext : private Noncopyable {
+    public:
+        typedef std::shared_ptr<CancelContext> ptr;
+        // 参数为取消的错误码
+        typedef std::function<void(int)> Waker;
+
+        // timeout_ms为~0ull表示不设截止时间
+        static CancelContext::ptr Create(uint64_t timeout_ms = ~0ull, CancelContext::ptr parent = nullptr);
+        ~CancelContext();
+
+        // 截止时间（GetCurrentMS的毫秒数），没有返回~0ull
+        uint64_t getDeadline() const { return m_deadline; }
+        // 剩余毫秒数，没有截止时间返回~0ull，已经结束返回0
+        uint64_t getRemaining() const;
+        // 结束原因：被取消返回cancel的错误码，到期返回ETIMEDOUT，还没结束返回0
+        int getError() const;
+        bool isDone() const { return getError() != 0; }
+        // 可以在任意线程调用，只有第一次生效
+        void cancel(int error = ECANCELED);
+
+        // 阻塞之前登记唤醒函数，返回登记号；已经取消时不登记，返回0
+        // 唤醒函数在调用cancel的线程里、持有上下文的锁时执行，不能再操作这个上下文
+        uint64_t addWaker(Waker cb);
+        // 阻塞结束后撤销登记，返回之后唤醒函数一定不在执行
+        void delWaker(uint64_t id);
+
+        // 当前协程的上下文，没有返回nullptr
+        static CancelContext::ptr GetCurrent();
+        // timeout_ms与当前上下文剩余时间的较小值，~0ull表示不限时
+        static uint64_t Clamp(uint64_t timeout_ms);
+        // 当前上下文的结束原因，没有上下文或还没结束返回0
+        static int CurrentError();
+    private:
+        CancelContext(uint64_t deadline);
+    private:
+        Mutex m_mutex;
+        uint64_t m_deadline;
+        std::atomic<int> m_error = { 0 };
+        uint64_t m_nextId = 1;
+        std::vector<std::pair<uint64_t, Waker> > m_wakers;
+        CancelContext::ptr m_parent;
+        uint64_t m_parentWaker = 0; // 在父上下文里登记的、用来级联取消的唤醒函数
+    };
+
+    // 在作用域内把当前协程的上下文换成ctx，离开时恢复原来的
+    class CancelScope : private Noncopyable {
+    public:
+        CancelScope(CancelContext::ptr ctx);
+        ~CancelScope();
+    private:
+        CancelContext::ptr m_prev;
+    };
+}
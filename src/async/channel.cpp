@@ -0,0 +1,116 @@
+#include "channel.h"
+#include "iomanager.h"
+
+namespace Framework {
+    ChannelWaiter::ptr ChannelWaiter::Create() {
+        Scheduler* scheduler = Scheduler::GetThis();
+        ASSERT_W(scheduler, "channel wait outside of a scheduler");
+        ChannelWaiter::ptr waiter(new ChannelWaiter);
+        waiter->scheduler = scheduler;
+        waiter->fiber = Fiber::GetThis();
+        return waiter;
+    }
+
+    // 超时定时器和取消上下文共用：还在等的话标记为超时并唤醒
+    static void ExpireWaiter(const std::weak_ptr<ChannelWaiter>& weak) {
+        ChannelWaiter::ptr w = weak.lock();
+        int expected = ChannelWaiter::WAITING;
+        if (w && w->state.compare_exchange_strong(expected, ChannelWaiter::TIMEOUT)) {
+            FiberWaitQueue::Wakeup{ w->scheduler, std::move(w->fiber) }();
+        }
+    }
+
+    int ChannelWaiter::park(uint64_t timeout_ms) {
+        // 定时器可能在协程返回之后才执行，只持有weak_ptr
+        std::weak_ptr<ChannelWaiter> weak(shared_from_this());
+        Timer::ptr timer;
+        if (timeout_ms != ~0ull) {
+            IOManager* iom = IOManager::GetThis();
+            ASSERT_W(iom, "channel timed wait outside of an IOManager");
+            timer = iom->addTimer(timeout_ms, std::bind(ExpireWaiter, weak));
+        }
+        CancelContext::ptr cancel = Fiber::GetCurrentCancelContext();
+        uint64_t waker = 0;
+        if (cancel) {
+            waker = cancel->addWaker([weak](int) { ExpireWaiter(weak); });
+            if (!waker) {
+                ExpireWaiter(weak);
+            }
+        }
+        // 登记之后、让出之前就被唤醒也没关系：调度器不会运行还处于EXEC状态的协程
+        Fiber::YieldToHold();
+
+        if (waker) {
+            cancel->delWaker(waker);
+        }
+        if (timer) {
+            timer->cancel();
+        }
+        return state == WOKEN ? index : -1;
+    }
+
+    int ChannelWaiter::cancel() {
+        int expected = WAITING;
+        if (state.compare_exchange_strong(expected, CANCELLED)) {
+            return -1;
+        }
+        // 只可能是被唤醒了（没挂起就没有定时器）
+        Fiber::YieldToHold();
+        return index;
+    }
+
+    void ChannelWaitList::push(Node* node) {
+        node->queued = true;
+        node->prev = m_tail;
+        node->next = nullptr;
+        if (m_tail) {
+            m_tail->next = node;
+        }
+        else {
+            m_head = node;
+        }
+        m_tail = node;
+    }
+
+    void ChannelWaitList::remove(Node* node) {
+        if (node->prev) {
+            node->prev->next = node->next;
+        }
+        else {
+            m_head = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        else {
+            m_tail = node->prev;
+        }
+        node->prev = node->next = nullptr;
+        node->queued = false;
+    }
+
+    FiberWaitQueue::Wakeup ChannelWaitList::wakeOne() {
+        while (m_head) {
+            Node* node = m_head;
+            remove(node);
+            ChannelWaiter* waiter = node->waiter;
+            int expected = ChannelWaiter::WAITING;
+            if (waiter->state.compare_exchange_strong(expected, ChannelWaiter::WOKEN)) {
+                // 等待者的协程要等Wakeup调度后才会恢复，此前waiter一直有效
+                waiter->index = node->index;
+                return FiberWaitQueue::Wakeup{ waiter->scheduler, std::move(waiter->fiber) };
+            }
+        }
+        return FiberWaitQueue::Wakeup();
+    }
+
+    void ChannelWaitList::wakeAll(std::vector<FiberWaitQueue::Wakeup>& wakeups) {
+        while (true) {
+            FiberWaitQueue::Wakeup wakeup = wakeOne();
+            if (!wakeup.fiber) {
+                break;
+            }
+            wakeups.push_back(std::move(wakeup));
+        }
+    }
+}
@@ -0,0 +1,341 @@
+#pragma once
+// 有界的多生产者多消费者通道：满了挂起发送方协程，空了挂起接收方协程，支持批量收发和在多个通道上select
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "cancel_context.h"
+#include "fiber_sync.h"
+#include "macro.h"
+#include "multithread.h"
+#include "noncopyable.h"
+#include "utils.h"
+
+namespace Framework {
+    struct ChannelWaiter;
+
+    // 一个通道上的等待链（发送方或接收方），由通道的锁保护
+    class ChannelWaitList : private Noncopyable {
+    public:
+        struct Node {
+            ChannelWaiter* waiter = nullptr; // 等待者的协程在摘掉所有节点之前一直持有它
+            int index = 0;
+            bool queued = false;
+            Node* prev = nullptr;
+            Node* next = nullptr;
+        };
+
+        void push(Node* node);
+        void remove(Node* node);
+        // 唤醒第一个还在等的（已经被别的通道唤醒、超时或撤销的跳过），返回的Wakeup在解锁后调用
+        FiberWaitQueue::Wakeup wakeOne();
+        void wakeAll(std::vector<FiberWaitQueue::Wakeup>& wakeups);
+    private:
+        Node* m_head = nullptr;
+        Node* m_tail = nullptr;
+    };
+
+    // 在通道上挂起的协程；select时同一个协程在多个通道上各登记一个节点，共用一个ChannelWaiter
+    struct ChannelWaiter : public std::enable_shared_from_this<ChannelWaiter> {
+        typedef std::shared_ptr<ChannelWaiter> ptr;
+        enum State {
+            WAITING,
+            WOKEN,
+            TIMEOUT,
+            CANCELLED
+        };
+
+        // 唤醒方、超时定时器和放弃等待的协程自己CAS，只有赢的一方能改变它
+        std::atomic<int> state = { WAITING };
+        int index = -1; // 唤醒它的节点下标
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        // send/recv用的节点：挂起期间别的线程会通过它改链表指针，不能放在协程栈上（共享栈模式下栈的内容会被搬走、被别的协程覆盖）
+        ChannelWaitList::Node node;
+
+        // 当前协程的等待者，必须在调度器里的协程上调用
+        static ChannelWaiter::ptr Create();
+        // 挂起直到被唤醒或超时（timeout_ms为~0ull表示不限时），返回唤醒它的节点下标，超时返回-1
+        // 当前协程的取消上下文被取消时按超时返回
+        int park(uint64_t timeout_ms);
+        // 登记之后不打算挂起了：撤销等待；已经被唤醒的话它的恢复任务已经进了调度器，让出一次把它消耗掉
+        // 返回唤醒它的节点下标，没被唤醒返回-1
+        int cancel();
+    };
+
+    /*
+    T需要能默认构造和移动赋值，缓冲区在构造时一次分配好
+    每放入一个元素唤醒一个接收方，每取走一个元素唤醒一个发送方，醒来的一方重新争抢，没抢到就再次挂起
+    关闭后send立刻失败，recv把剩余的取完后失败，挂起的协程全部唤醒
+    收发和select都受当前协程的取消上下文约束（不限时的也是）：不会等过截止时间，取消时立刻按超时返回
+    */
+    template<class T>
+    class Channel : private Noncopyable {
+    public:
+        typedef std::shared_ptr<Channel> ptr;
+        typedef FiberWaitQueue::Wakeup Wakeup;
+
+        Channel(size_t capacity)
+            : m_buffer(capacity), m_capacity(capacity) {
+            ASSERT(capacity > 0);
+        }
+
+        // 发送一个，满了挂起；通道关闭或超时返回false
+        bool send(T item, uint64_t timeout_ms = ~0ull) {
+            return send(&item, 1, timeout_ms) == 1;
+        }
+
+        // 批量发送items[0, n)（元素被移走），放不下时挂起等空间，返回发出的个数，小于n说明通道关闭或超时
+        size_t send(T* items, size_t n, uint64_t timeout_ms = ~0ull) {
+            uint64_t deadline = Deadline(timeout_ms);
+            size_t sent = 0;
+            while (true) {
+                std::vector<Wakeup> wakeups;
+                ChannelWaiter::ptr waiter;
+                {
+                    Spinlock::Lock lock(m_mutex);
+                    if (!m_closed) {
+                        sent += pushLocked(items + sent, n - sent, wakeups);
+                        if (sent < n && Remaining(deadline)) {
+                            waiter = ChannelWaiter::Create();
+                            waiter->node.waiter = waiter.get();
+                            m_senders.push(&waiter->node);
+                        }
+                    }
+                }
+                Wake(wakeups);
+                if (!waiter) {
+                    return sent;
+                }
+                waiter->park(Remaining(deadline));
+                Spinlock::Lock lock(m_mutex);
+                if (waiter->node.queued) {
+                    m_senders.remove(&waiter->node);
+                }
+            }
+        }
+
+        bool trySend(T item) {
+            std::vector<Wakeup> wakeups;
+            size_t sent = 0;
+            {
+                Spinlock::Lock lock(m_mutex);
+                if (!m_closed) {
+                    sent = pushLocked(&item, 1, wakeups);
+                }
+            }
+            Wake(wakeups);
+            return sent == 1;
+        }
+
+        // 接收一个，空了挂起；通道关闭且取空或超时返回false
+        bool recv(T& item, uint64_t timeout_ms = ~0ull) {
+            return recv(&item, 1, timeout_ms) == 1;
+        }
+
+        // 批量接收：至少等到一个，最多取max个，返回取到的个数，0说明通道关闭且取空或超时
+        size_t recv(T* items, size_t max, uint64_t timeout_ms = ~0ull) {
+            uint64_t deadline = Deadline(timeout_ms);
+            while (true) {
+                std::vector<Wakeup> wakeups;
+                ChannelWaiter::ptr waiter;
+                size_t got = 0;
+                {
+                    Spinlock::Lock lock(m_mutex);
+                    got = popLocked(items, max, wakeups);
+                    if (!got && !m_closed && Remaining(deadline)) {
+                        waiter = ChannelWaiter::Create();
+                        waiter->node.waiter = waiter.get();
+                        m_receivers.push(&waiter->node);
+                    }
+                }
+                Wake(wakeups);
+                if (!waiter) {
+                    return got;
+                }
+                waiter->park(Remaining(deadline));
+                Spinlock::Lock lock(m_mutex);
+                if (waiter->node.queued) {
+                    m_receivers.remove(&waiter->node);
+                }
+            }
+        }
+
+        bool tryRecv(T& item) {
+            std::vector<Wakeup> wakeups;
+            size_t got = 0;
+            {
+                Spinlock::Lock lock(m_mutex);
+                got = popLocked(&item, 1, wakeups);
+            }
+            Wake(wakeups);
+            return got == 1;
+        }
+
+        void close() {
+            std::vector<Wakeup> wakeups;
+            {
+                Spinlock::Lock lock(m_mutex);
+                m_closed = true;
+                m_senders.wakeAll(wakeups);
+                m_receivers.wakeAll(wakeups);
+            }
+            Wake(wakeups);
+        }
+
+        bool isClosed() {
+            Spinlock::Lock lock(m_mutex);
+            return m_closed;
+        }
+
+        size_t size() {
+            Spinlock::Lock lock(m_mutex);
+            return m_size;
+        }
+
+        size_t capacity() const { return m_capacity; }
+
+        /*
+        同时等待多个通道，从最先有数据的那个取一个
+        返回取到数据的通道下标，超时返回-1，全部通道都已关闭且取空返回-2
+        被某个通道唤醒后优先检查它；唤醒没用上（数据被别人取走以外的情况）就转交给该通道的下一个接收方
+        */
+        static int Select(const std::vector<Channel*>& channels, T& item, uint64_t timeout_ms = ~0ull) {
+            uint64_t deadline = Deadline(timeout_ms);
+            size_t first = 0;
+            while (true) {
+                ChannelWaiter::ptr waiter = ChannelWaiter::Create();
+                std::vector<ChannelWaitList::Node> nodes(channels.size());
+                int got = -1;
+                bool all_closed = true;
+                for (size_t k = 0; k < channels.size() && got < 0; ++k) {
+                    size_t i = (first + k) % channels.size();
+                    Channel* chan = channels[i];
+                    std::vector<Wakeup> wakeups;
+                    {
+                        Spinlock::Lock lock(chan->m_mutex);
+                        if (chan->popLocked(&item, 1, wakeups)) {
+                            got = (int)i;
+                        }
+                        else if (!chan->m_closed) {
+                            all_closed = false;
+                            nodes[i].waiter = waiter.get();
+                            nodes[i].index = (int)i;
+                            chan->m_receivers.push(&nodes[i]);
+                        }
+                    }
+                    Wake(wakeups);
+                }
+
+                int woken;
+                if (got < 0 && !all_closed && Remaining(deadline)) {
+                    woken = waiter->park(Remaining(deadline));
+                }
+                else {
+                    woken = waiter->cancel();
+                }
+                for (size_t i = 0; i < channels.size(); ++i) {
+                    Spinlock::Lock lock(channels[i]->m_mutex);
+                    if (nodes[i].queued) {
+                        channels[i]->m_receivers.remove(&nodes[i]);
+                    }
+                }
+
+                if (got >= 0) {
+                    if (woken >= 0 && woken != got) {
+                        channels[woken]->passWakeup();
+                    }
+                    return got;
+                }
+                if (woken >= 0) {
+                    first = woken; // 下一轮先看唤醒它的通道
+                    continue;
+                }
+                if (all_closed) {
+                    return -2;
+                }
+                if (!Remaining(deadline)) {
+                    return -1;
+                }
+            }
+        }
+    private:
+        static uint64_t Deadline(uint64_t timeout_ms) {
+            timeout_ms = CancelContext::Clamp(timeout_ms);
+            return timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+        }
+
+        // 距离deadline的毫秒数，不限时返回~0ull，已经过了或当前协程的上下文已经取消返回0
+        static uint64_t Remaining(uint64_t deadline) {
+            if (CancelContext::CurrentError()) {
+                return 0;
+            }
+            if (deadline == ~0ull) {
+                return ~0ull;
+            }
+            uint64_t now = GetCurrentMS();
+            return deadline > now ? deadline - now : 0;
+        }
+
+        static void Wake(std::vector<Wakeup>& wakeups) {
+            for (auto& i : wakeups) {
+                i();
+            }
+        }
+
+        // 以下需持有m_mutex
+        size_t pushLocked(T* items, size_t n, std::vector<Wakeup>& wakeups) {
+            size_t count = std::min(n, m_capacity - m_size);
+            for (size_t i = 0; i < count; ++i) {
+                m_buffer[(m_head + m_size) % m_capacity] = std::move(items[i]);
+                ++m_size;
+            }
+            wakeN(m_receivers, count, wakeups);
+            return count;
+        }
+
+        size_t popLocked(T* items, size_t max, std::vector<Wakeup>& wakeups) {
+            size_t count = std::min(max, m_size);
+            for (size_t i = 0; i < count; ++i) {
+                items[i] = std::move(m_buffer[m_head]);
+                m_head = (m_head + 1) % m_capacity;
+                --m_size;
+            }
+            wakeN(m_senders, count, wakeups);
+            return count;
+        }
+
+        static void wakeN(ChannelWaitList& list, size_t n, std::vector<Wakeup>& wakeups) {
+            for (size_t i = 0; i < n; ++i) {
+                Wakeup wakeup = list.wakeOne();
+                if (!wakeup.fiber) {
+                    break;
+                }
+                wakeups.push_back(std::move(wakeup));
+            }
+        }
+
+        // select被本通道唤醒却从别的通道取到了数据：本通道还有数据的话唤醒下一个接收方，免得数据没人取
+        void passWakeup() {
+            std::vector<Wakeup> wakeups;
+            {
+                Spinlock::Lock lock(m_mutex);
+                if (m_size || m_closed) {
+                    wakeN(m_receivers, 1, wakeups);
+                }
+            }
+            Wake(wakeups);
+        }
+    private:
+        Spinlock m_mutex;
+        std::vector<T> m_buffer; // 环形缓冲区
+        size_t m_capacity;
+        size_t m_head = 0;
+        size_t m_size = 0;
+        bool m_closed = false;
+        ChannelWaitList m_senders;
+        ChannelWaitList m_receivers;
+    };
+}
@@ -0,0 +1,213 @@
+#include "coroutine.h"
+
+#include <errno.h>
+
+#include "fdmanager.h"
+#include "hook.h"
+#include "log.h"
+#include "macro.h"
+
+namespace Framework {
+    static Logger::ptr g_logger = LOG_NAME("system");
+
+    // CoSpawn的外层协程：启动时挂起等调度，结束后自己销毁协程帧（连同参数里的task）
+    struct DetachedCoroutine {
+        struct promise_type {
+            DetachedCoroutine get_return_object() {
+                return DetachedCoroutine{ std::coroutine_handle<promise_type>::from_promise(*this) };
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() {}
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    static DetachedCoroutine RunDetached(Task<void> task) {
+        try {
+            co_await task;
+        }
+        catch (std::exception& ex) {
+            LOG_ERROR(g_logger) << "coroutine exception: " << ex.what();
+        }
+        catch (...) {
+            LOG_ERROR(g_logger) << "coroutine unknown exception";
+        }
+    }
+
+    void CoSpawn(Task<void> task, Scheduler* scheduler, int thread) {
+        if (!scheduler) {
+            scheduler = Scheduler::GetThis();
+        }
+        ASSERT_W(scheduler, "CoSpawn outside of a scheduler");
+        std::coroutine_handle<> h = RunDetached(std::move(task)).handle;
+        scheduler->schedule([h]() {
+            h.resume();
+        }, thread);
+    }
+
+    Task<void> CoNotifyWhenDone(TaskDoneAwaiter done, std::shared_ptr<FiberSemaphore> sem) {
+        co_await done;
+        sem->notify();
+    }
+
+    void CoSleep::await_suspend(std::coroutine_handle<> h) {
+        IOManager* iom = IOManager::GetThis();
+        ASSERT_W(iom, "co_await CoSleep outside of an IOManager");
+        iom->addTimer(ms, [h]() {
+            h.resume();
+        });
+    }
+
+    bool CoWaitEvent::await_suspend(std::coroutine_handle<> h) {
+        IOManager* iom = IOManager::GetThis();
+        ASSERT_W(iom, "co_await CoWaitEvent outside of an IOManager");
+        // addEvent之后事件可能马上在别的线程触发并恢复协程，之后不能再碰this，用到的都先拷到栈上
+        std::shared_ptr<int> info(new int(0));
+        cancelled = info;
+        int f = fd;
+        IOManager::Event e = event;
+        if (timeout_ms != ~0ull) {
+            std::weak_ptr<int> winfo(info);
+            timer = iom->addConditionTimer(timeout_ms, [winfo, f, iom, e]() {
+                auto t = winfo.lock();
+                if (!t || *t) {
+                    return;
+                }
+                *t = ETIMEDOUT;
+                iom->cancelEvent(f, e);
+            }, winfo);
+        }
+        errno = 0;
+        if (iom->addEvent(f, e, [h]() {
+            h.resume();
+        })) {
+            *info = errno ? errno : EINVAL;
+            return false;
+        }
+        // 注册期间fd被别的线程关闭了：close的cancelAll可能早于注册，事件再也不会触发，自己取消掉
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(f);
+        if (!ctx || ctx->isClose()) {
+            *info = EBADF;
+            iom->cancelEvent(f, e);
+        }
+        return true;
+    }
+
+    int CoWaitEvent::await_resume() {
+        if (timer) {
+            timer->cancel();
+        }
+        return *cancelled ? -*cancelled : 0;
+    }
+
+    // fd登记到FdManager（socket会被设成非阻塞），已经关闭返回false
+    static bool PrepareFd(int fd) {
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd, true);
+        return ctx && !ctx->isClose();
+    }
+
+    Task<ssize_t> CoRead(int fd, void* buf, size_t len, uint64_t timeout_ms) {
+        if (!PrepareFd(fd)) {
+            co_return -EBADF;
+        }
+        while (true) {
+            ssize_t n = read_f(fd, buf, len);
+            if (n >= 0) {
+                co_return n;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                co_return -errno;
+            }
+            int rt = co_await CoWaitEvent(fd, IOManager::READ, timeout_ms);
+            if (rt) {
+                co_return rt;
+            }
+        }
+    }
+
+    Task<ssize_t> CoWrite(int fd, const void* buf, size_t len, uint64_t timeout_ms) {
+        if (!PrepareFd(fd)) {
+            co_return -EBADF;
+        }
+        while (true) {
+            ssize_t n = write_f(fd, buf, len);
+            if (n >= 0) {
+                co_return n;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                co_return -errno;
+            }
+            int rt = co_await CoWaitEvent(fd, IOManager::WRITE, timeout_ms);
+            if (rt) {
+                co_return rt;
+            }
+        }
+    }
+
+    Task<ssize_t> CoWriteAll(int fd, const void* buf, size_t len, uint64_t timeout_ms) {
+        size_t offset = 0;
+        while (offset < len) {
+            ssize_t n = co_await CoWrite(fd, (const char*)buf + offset, len - offset, timeout_ms);
+            if (n < 0) {
+                co_return n;
+            }
+            offset += n;
+        }
+        co_return (ssize_t)len;
+    }
+
+    Task<int> CoAccept(int fd, sockaddr* addr, socklen_t* addrlen, uint64_t timeout_ms) {
+        if (!PrepareFd(fd)) {
+            co_return -EBADF;
+        }
+        while (true) {
+            int client = accept4_f(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client >= 0) {
+                FdMgr::GetInstance()->get(client, true);
+                co_return client;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                co_return -errno;
+            }
+            int rt = co_await CoWaitEvent(fd, IOManager::READ, timeout_ms);
+            if (rt) {
+                co_return rt;
+            }
+        }
+    }
+
+    Task<int> CoConnect(int fd, const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms) {
+        if (!PrepareFd(fd)) {
+            co_return -EBADF;
+        }
+        int n = connect_f(fd, addr, addrlen);
+        if (n == 0) {
+            co_return 0;
+        }
+        if (errno != EINPROGRESS) {
+            co_return -errno;
+        }
+        int rt = co_await CoWaitEvent(fd, IOManager::WRITE, timeout_ms);
+        if (rt) {
+            co_return rt;
+        }
+        int error = 0;
+        socklen_t len = sizeof(int);
+        if (getsockopt_f(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+            co_return -errno;
+        }
+        co_return -error;
+    }
+}
@@ -0,0 +1,193 @@
+#pragma once
+/*
+C++20无栈协程（co_await）接口，和有栈的Fiber共用IOManager的epoll循环和定时器
+无栈协程只有一个堆上的协程帧，不占独立的栈：挂起时把恢复它的回调登记成fd事件或定时器，
+事件触发后回调被调度到某个线程，在调度器复用的回调协程上直接resume，1万个并发的co_await只有1万个协程帧
+协程体里也可以调用hook过的阻塞接口，这时挂起的是当前这个回调协程，和普通Fiber一样
+*/
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "timer.h"
+
+namespace Framework {
+    template<class T>
+    class Task;
+
+    // Task的promise公共部分：记录co_await它的协程，结束时直接切回去（对称转移，不经过调度器）
+    struct TaskPromiseBase {
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template<class P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                std::coroutine_handle<> continuation = h.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+
+        // 惰性启动：被co_await（或CoSpawn）时才开始执行
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    // 等Task结束但不取结果，不区分Task的结果类型
+    struct TaskDoneAwaiter {
+        std::coroutine_handle<> handle;
+        TaskPromiseBase* promise = nullptr;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+            promise->continuation = c;
+            return handle;
+        }
+        void await_resume() noexcept {}
+    };
+
+    template<class T>
+    struct TaskPromise : public TaskPromiseBase {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+        template<class U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+        T result() {
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+            return std::move(*value);
+        }
+    };
+
+    template<>
+    struct TaskPromise<void> : public TaskPromiseBase {
+        Task<void> get_return_object();
+        void return_void() {}
+        void result() {
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+        }
+    };
+
+    // 惰性启动、只能移动的协程返回值，co_await它得到结果（协程体抛出的异常在co_await处重新抛出）
+    template<class T = void>
+    class Task {
+    public:
+        typedef TaskPromise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> handle_type;
+
+        Task() = default;
+        explicit Task(handle_type h) : m_handle(h) {}
+        Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (m_handle) {
+                    m_handle.destroy();
+                }
+                m_handle = std::exchange(other.m_handle, {});
+            }
+            return *this;
+        }
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task() {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+            m_handle.promise().continuation = c;
+            return m_handle;
+        }
+        T await_resume() { return m_handle.promise().result(); }
+
+        TaskDoneAwaiter done() const {
+            return TaskDoneAwaiter{ m_handle, m_handle ? &m_handle.promise() : nullptr };
+        }
+        // 已经结束时取结果
+        T result() { return m_handle.promise().result(); }
+        bool isDone() const { return !m_handle || m_handle.done(); }
+    private:
+        handle_type m_handle;
+    };
+
+    template<class T>
+    Task<T> TaskPromise<T>::get_return_object() {
+        return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+    }
+
+    inline Task<void> TaskPromise<void>::get_return_object() {
+        return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+    }
+
+    // 把task交给调度器独立运行（thread不为-1时固定在该线程上启动），不等结果；协程体抛出的异常打日志
+    // scheduler为空时用当前线程的调度器
+    void CoSpawn(Task<void> task, Scheduler* scheduler = nullptr, int thread = -1);
+
+    // BlockOn用：等done结束后通知sem
+    Task<void> CoNotifyWhenDone(TaskDoneAwaiter done, std::shared_ptr<FiberSemaphore> sem);
+
+    // 在Fiber里等待task执行完并取结果，只挂起当前Fiber，用于从有栈代码调用无栈协程
+    // 信号量放在堆上：通知方可能在别的线程上，而挂起的Fiber在共享栈模式下栈会被搬走、被别的协程占用
+    template<class T>
+    T BlockOn(Task<T> task) {
+        std::shared_ptr<FiberSemaphore> sem = std::make_shared<FiberSemaphore>();
+        CoSpawn(CoNotifyWhenDone(task.done(), sem));
+        sem->wait();
+        return task.result();
+    }
+
+    // co_await CoSleep(ms)：用当前IOManager的定时器挂起ms毫秒
+    struct CoSleep {
+        uint64_t ms;
+
+        explicit CoSleep(uint64_t m) : ms(m) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        void await_resume() noexcept {}
+    };
+
+    // co_await CoWaitEvent(fd, event)：挂起直到fd上的事件就绪，返回0；超时返回-ETIMEDOUT，fd被关闭返回-EBADF
+    // timeout_ms为~0ull表示不超时。和hook一样，同一个fd的同一种事件同时只能有一个等待者
+    struct CoWaitEvent {
+        int fd;
+        IOManager::Event event;
+        uint64_t timeout_ms;
+        std::shared_ptr<int> cancelled; // 超时/关闭时记下原因，定时器只持有weak_ptr
+        Timer::ptr timer;
+
+        CoWaitEvent(int f, IOManager::Event e, uint64_t timeout = ~0ull)
+            : fd(f), event(e), timeout_ms(timeout) {}
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        int await_resume();
+    };
+
+    /*
+    socket操作，必须在IOManager的线程上co_await；fd会被登记到FdManager并设为非阻塞
+    不经过hook直接调用系统调用，EAGAIN时挂起等epoll事件再重试，timeout_ms是每次等待的超时
+    返回值同系统调用，失败返回-errno（恢复后可能在别的线程上，不用errno传递错误）
+    */
+    Task<ssize_t> CoRead(int fd, void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+    Task<ssize_t> CoWrite(int fd, const void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+    // 写完len字节才返回，返回len或-errno
+    Task<ssize_t> CoWriteAll(int fd, const void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+    // 返回新连接的fd（已设为非阻塞并登记到FdManager）
+    Task<int> CoAccept(int fd, sockaddr* addr = nullptr, socklen_t* addrlen = nullptr, uint64_t timeout_ms = ~0ull);
+    Task<int> CoConnect(int fd, const sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms = ~0ull);
+}
@@ -0,0 +1,116 @@
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "cpu_affinity.h"
+#include "log.h"
+
+namespace Framework {
+    static Logger::ptr g_logger = LOG_NAME("system");
+
+    static std::string ReadLine(const std::string& path) {
+        std::ifstream ifs(path);
+        std::string line;
+        std::getline(ifs, line);
+        return line;
+    }
+
+    std::vector<int> ParseCpuList(const std::string& str) {
+        std::vector<int> cpus;
+        std::stringstream ss(str);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty()) {
+                continue;
+            }
+            int first = 0;
+            int last = 0;
+            char dash = 0;
+            std::stringstream is(item);
+            is >> first;
+            if (!is) {
+                return {};
+            }
+            last = first;
+            if (is >> dash) {
+                if (dash != '-' || !(is >> last)) {
+                    return {};
+                }
+            }
+            if (first < 0 || last < first) {
+                return {};
+            }
+            for (int i = first; i <= last; ++i) {
+                cpus.push_back(i);
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<int> GetOnlineCpus() {
+        std::vector<int> cpus = ParseCpuList(ReadLine("/sys/devices/system/cpu/online"));
+        if (cpus.empty()) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            for (long i = 0; i < n; ++i) {
+                cpus.push_back((int)i);
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<NumaNode> GetNumaTopology() {
+        std::vector<NumaNode> nodes;
+        for (int id : ParseCpuList(ReadLine("/sys/devices/system/node/online"))) {
+            NumaNode node;
+            node.id = id;
+            node.cpus = ParseCpuList(ReadLine("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"));
+            if (!node.cpus.empty()) { // 只有内存没有CPU的节点放不了线程
+                nodes.push_back(node);
+            }
+        }
+        if (nodes.empty()) {
+            NumaNode node;
+            node.cpus = GetOnlineCpus();
+            nodes.push_back(node);
+        }
+        return nodes;
+    }
+
+    bool PinThisThread(const std::vector<int>& cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (CPU_COUNT(&set) == 0) {
+            return false;
+        }
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            LOG_WARN(g_logger) << "sched_setaffinity fail, errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool PreferThisThreadMemory(int node) {
+        if (node < 0) {
+            return false;
+        }
+        const size_t bits = sizeof(unsigned long) * 8;
+        std::vector<unsigned long> mask(node / bits + 1, 0);
+        mask[node / bits] |= 1ul << (node % bits);
+        // maxnode按内核的约定要比掩码位数多1
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1)) {
+            LOG_WARN(g_logger) << "set_mempolicy fail, node=" << node << " errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+}
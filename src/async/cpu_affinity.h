@@ -0,0 +1,24 @@
+#pragma once
+// CPU亲和性和NUMA拓扑，只依赖sysfs和系统调用，不需要链接libnuma
+
+#include <string>
+#include <vector>
+
+namespace Framework {
+    struct NumaNode {
+        int id = 0;
+        std::vector<int> cpus; // 节点上在线的CPU
+    };
+
+    // 解析"0-3,8,10-11"形式的CPU/节点列表（和/sys、taskset的格式一致），格式错误返回空
+    std::vector<int> ParseCpuList(const std::string& str);
+    // 在线的CPU
+    std::vector<int> GetOnlineCpus();
+    // 在线的NUMA节点；读不到NUMA信息时（没有/sys/devices/system/node）当成一个包含所有在线CPU的0号节点
+    std::vector<NumaNode> GetNumaTopology();
+
+    // 把当前线程绑到cpus上，成功返回true
+    bool PinThisThread(const std::vector<int>& cpus);
+    // 当前线程之后缺页分配的内存优先放在node上（MPOL_PREFERRED），node上内存不够时仍可以用别的节点
+    bool PreferThisThreadMemory(int node);
+}
@@ -75,40 +75,33 @@ namespace Framework {
 
 namespace Framework {
     FdManager::FdManager() {
-        m_datas.resize(64);
     }
 
     FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-        if (fd == -1) {
+        if (fd < 0) {
             return nullptr;
         }
-        RWMutex::ReadLock lock(m_mutex);
-        if ((int)m_datas.size() <= fd) {
-            if (!auto_create) {
-                return nullptr;
-            }
+        std::atomic<FdCtx::ptr>* slot = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+        if (!slot) {
+            return nullptr;
         }
-        else {
-            if (m_datas[fd] || !auto_create) {
-                return m_datas[fd];
-            }
+        FdCtx::ptr ctx = slot->load();
+        if (ctx || !auto_create) {
+            return ctx;
         }
-        lock.unlock();
 
-        RWMutex::WriteLock lock2(m_mutex);
-        FdCtx::ptr ctx(new FdCtx(fd));
-        if (fd >= (int)m_datas.size()) {
-            m_datas.resize(fd * 1.5);
+        FdCtx::ptr fresh(new FdCtx(fd));
+        if (slot->compare_exchange_strong(ctx, fresh)) {
+            return fresh;
         }
-        m_datas[fd] = ctx;
-        return ctx;
+        return ctx; // 别的线程先创建了，ctx已被更新为它创建的那个
     }
 
     void FdManager::del(int fd) {
-        RWMutex::WriteLock lock(m_mutex);
-        if ((int)m_datas.size() <= fd) {
+        std::atomic<FdCtx::ptr>* slot = fd < 0 ? nullptr : m_datas.get(fd);
+        if (!slot) {
             return;
         }
-        m_datas[fd].reset();
+        slot->store(nullptr);
     }
 }
\ No newline at end of file
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 #include "iomanager.h"
 #include "multithread.h"
+#include "segmented_array.h"
 #include "singleton.h"
 
 namespace Framework {
@@ -33,7 +35,8 @@ namespace Framework {
         bool m_isSocket : 1;
         bool m_sysNonblock : 1; // 系统设置为异步（非阻塞）
         bool m_userNonblock : 1; // 系统设置为异步（非阻塞）
-        bool m_isClosed : 1;
+        // close和挂起IO的协程可能在不同线程，关闭标志要能被对方及时看到
+        std::atomic<bool> m_isClosed;
         int m_fd;
         uint64_t m_recvTimeout;
         uint64_t m_sendTimeout;
@@ -48,8 +51,10 @@ namespace Framework {
         void del(int fd);
 
     private:
-        RWMutex m_mutex;
-        std::vector<FdCtx::ptr> m_datas;
+        // 下标=文件描述符，分段惰性分配、不会移动，hook每次调用都要查，所以找到槽位不加锁
+        // 注意槽位本身不是无锁的：libstdc++的std::atomic<shared_ptr>用控制块指针的最低位做自旋锁，
+        // load/store/CAS都要短暂持有它；锁只在同一个fd的槽位上竞争，不同fd之间互不影响
+        SegmentedArray<std::atomic<FdCtx::ptr> > m_datas;
     };
 
     typedef Singleton<FdManager> FdMgr; // 把FdManager弄成单例模式
@@ -1,9 +1,13 @@
+#include <string.h>
+
 #include <atomic>
+#include <vector>
 
 #include "config.h"
 #include "fiber.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 
 namespace Framework {
     static Framework::Logger::ptr g_logger = LOG_NAME("system");
@@ -14,18 +18,41 @@ namespace Framework {
     static thread_local Fiber::ptr t_threadFiber = nullptr; // main协程
     static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size"); // 配置一个协程栈空间大小
 
-	// 通用栈内存分配器
-    class MallocStackAllocator {
-    public:
-        static void* Alloc(size_t size) {
-            return malloc(size);
+    static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+        Config::Lookup<uint32_t>("fiber.pool_size", 0, "per-thread cap of terminated fibers kept for reuse, 0 disables");
+
+    typedef PooledStackAllocator myStackAllocator;
+
+    // 每次创建/释放协程都要看上限，缓存一份，避免读配置加锁
+    static std::atomic<uint32_t> s_fiber_pool_size{ 0 };
+    struct _FiberPoolIniter {
+        _FiberPoolIniter() {
+            s_fiber_pool_size = g_fiber_pool_size->getValue();
+            g_fiber_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+                s_fiber_pool_size = new_value;
+            });
         }
+    };
+    static _FiberPoolIniter s_fiber_pool_initer;
+
+    static std::atomic<uint64_t> s_pool_reused{ 0 };
+    static std::atomic<uint64_t> s_pool_recycled{ 0 };
+    static std::atomic<uint64_t> s_pool_discarded{ 0 };
 
-        static void Dealloc(void* vp, size_t size) {
-            return free(vp);
+    // 本线程回收的已结束协程，线程退出时释放
+    struct FiberPool {
+        std::vector<Fiber*> fibers;
+        bool alive = true; // 线程退出、池析构之后还可能有协程被释放，这时直接delete
+
+        ~FiberPool() {
+            alive = false;
+            for (auto i : fibers) {
+                delete i;
+            }
+            fibers.clear();
         }
     };
-    typedef MallocStackAllocator myStackAllocator;
+    static thread_local FiberPool t_fiber_pool;
 
     // 协程初始化，获得线程上下文信息
     // 主协程没有stack
@@ -33,39 +60,47 @@ namespace Framework {
         m_state = EXEC;
         SetThis(this);
 
+#ifndef FIBER_ASM_CONTEXT
         if (getcontext(&m_ctx)) {
             ASSERT_W(false, "getcontext");
         }
+#endif
 
         ++s_fiber_count;
     }
 
-    Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+    Fiber::Fiber(InlineFunction cb, size_t stacksize, bool use_caller)
         : m_id(++s_fiber_id)  // 初始化协程的唯一ID，使用静态成员变量s_fiber_id自增来生成唯一标识
-        , m_cb(cb) {  // 保存传入的任务函数
+        , m_priority(GetCurrentPriority())
+        , m_cancel(GetCurrentCancelContext())
+        , m_cb(std::move(cb)) {  // 保存传入的任务函数
         ++s_fiber_count;  // 协程计数器自增，记录当前创建的协程数量
 
-        m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();  // 设置栈大小，如果有传入则使用传入值，否则使用全局默认栈大小
+        // 调度器主协程(use_caller)和指定了栈大小的协程总是使用独立栈
+        m_sharedMode = !stacksize && !use_caller && SharedStack::IsEnabled();
+        if (!m_sharedMode) {
+            m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();  // 设置栈大小，如果有传入则使用传入值，否则使用全局默认栈大小
 
-        m_stack = myStackAllocator::Alloc(m_stacksize);  // 从栈分配器中分配指定大小的栈内存
-        if (getcontext(&m_ctx)) {  // 获取当前上下文
-            ASSERT_W(false, "getcontext");  // 如果获取上下文失败，断言失败并输出错误信息
+            m_stack = myStackAllocator::Alloc(m_stacksize);  // 从栈分配器中分配指定大小的栈内存
         }
-        m_ctx.uc_link = nullptr;  // 设置上下文的链接为nullptr，表示当前上下文执行完毕后没有后续上下文
-        m_ctx.uc_stack.ss_sp = m_stack;  // 设置上下文的栈指针为分配的栈内存起始地址
-        m_ctx.uc_stack.ss_size = m_stacksize;  // 设置上下文的栈大小
 
         if (use_caller){
-            makecontext(&m_ctx, &Fiber::MainFunc, 0);  // 初始化上下文，设置执行函数为Fiber::MainFunc，参数个数为0
+            initContext(&Fiber::MainFunc);  // 初始化上下文，设置执行函数为Fiber::MainFunc
         }
         else {
-            makecontext(&m_ctx, &Fiber::MainFuncCaller, 0);
+            initContext(&Fiber::MainFuncCaller);
         }
     }
 
     Fiber::~Fiber() {
         --s_fiber_count;
-        if (m_stack) {
+        if (m_sharedMode) {
+            // 结束时已经让出了共享栈（见SwapContext），只需释放保存区
+            ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
+            ASSERT(!m_shared || m_shared->occupant != this);
+            free(m_saveBuffer);
+        }
+        else if (m_stack) {
             ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
 
             myStackAllocator::Dealloc(m_stack, m_stacksize);
@@ -82,51 +117,146 @@ namespace Framework {
     }
 
     // 协程关闭时内存暂时不释放，将资源直接转交给新的协程
-    void Fiber::reset(std::function<void()> cb) {
-        ASSERT(m_stack); // 断言不能是主协程
+    void Fiber::reset(InlineFunction cb) {
+        ASSERT(m_stack || m_sharedMode); // 断言不能是主协程
         ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
-        m_cb = cb;
-        if (getcontext(&m_ctx)) {
-            ASSERT_W(false, "getcontext");
-        }
-        m_ctx.uc_link = nullptr;
-        m_ctx.uc_stack.ss_sp = m_stack;
-        m_ctx.uc_stack.ss_size = m_stacksize;
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        m_cb = std::move(cb);
+        m_priority = GetCurrentPriority();
+        m_cancel = GetCurrentCancelContext();
+        initContext(&Fiber::MainFunc);
         m_state = INIT;
     }
 
+    void Fiber::initContext(void (*entry)()) {
+        if (m_sharedMode) {
+            m_entry = entry;
+            m_needInit = true;
+            return;
+        }
+        initStackContext(entry);
+    }
+
+#ifdef FIBER_ASM_CONTEXT
+    void Fiber::initStackContext(void (*entry)()) {
+        m_sp = MakeFiberContext(m_stack, m_stacksize, entry);
+    }
+
+    void Fiber::SwapContext(Fiber* from, Fiber* to) {
+        if (from->m_sharedMode || to->m_sharedMode) {
+            SwapSharedStack(from, to);
+        }
+        fiber_swap_context(&from->m_sp, to->m_sp);
+    }
+
+    char* Fiber::getStackPointer() const {
+        return (char*)m_sp;
+    }
+#else
+    void Fiber::initStackContext(void (*entry)()) {
+        if (getcontext(&m_ctx)) {  // 获取当前上下文
+            ASSERT_W(false, "getcontext");  // 如果获取上下文失败，断言失败并输出错误信息
+        }
+        m_ctx.uc_link = nullptr;  // 设置上下文的链接为nullptr，表示当前上下文执行完毕后没有后续上下文
+        m_ctx.uc_stack.ss_sp = m_stack;  // 设置上下文的栈指针为分配的栈内存起始地址
+        m_ctx.uc_stack.ss_size = m_stacksize;  // 设置上下文的栈大小
+        makecontext(&m_ctx, entry, 0);  // 初始化上下文，参数个数为0
+    }
+
+    void Fiber::SwapContext(Fiber* from, Fiber* to) {
+        if (from->m_sharedMode || to->m_sharedMode) {
+            SwapSharedStack(from, to);
+        }
+        if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+            ASSERT_W(false, "swapcontext");
+        }
+    }
+
+    char* Fiber::getStackPointer() const {
+        // swapcontext把寄存器存在ucontext_t里，栈上只剩调用帧，从保存的sp开始拷贝即可
+#if defined(__x86_64__)
+        return (char*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+        return (char*)m_ctx.uc_mcontext.sp;
+#else
+        return (char*)m_stack; // 未知架构，整个栈都保存
+#endif
+    }
+#endif
+
+    void Fiber::SwapSharedStack(Fiber* from, Fiber* to) {
+        // 结束的协程不再需要栈上的数据，直接让出共享栈，析构时也就不必再碰共享栈
+        if (from->m_sharedMode && from->m_shared && from->m_shared->occupant == from
+            && (from->m_state == TERM || from->m_state == EXCEPT)) {
+            from->m_shared->occupant = nullptr;
+        }
+        if (to->m_sharedMode) {
+            // 拷贝必须在另一个栈上进行，协程总是与调度协程/线程主协程互相切换，这里from一定是独立栈
+            ASSERT(!from->m_sharedMode);
+            to->loadSharedStack();
+        }
+    }
+
+    void Fiber::saveSharedStack() {
+        char* bottom = (char*)m_stack + m_stacksize;
+        char* sp = getStackPointer();
+        size_t size = bottom - sp;
+        if (m_saveCap < size || m_saveCap > size * 2) { // 保存区始终和实际用到的栈差不多大
+            free(m_saveBuffer);
+            m_saveBuffer = (char*)malloc(size);
+            m_saveCap = size;
+        }
+        memcpy(m_saveBuffer, sp, size);
+        m_saveSize = size;
+    }
+
+    void Fiber::loadSharedStack() {
+        if (!m_shared) {
+            // 第一次运行才绑定，这样在别的线程上创建的协程也能被任意调度线程领走
+            m_shared = SharedStack::Next();
+            m_homeThread = GetThreadId();
+            m_stack = m_shared->buffer;
+            m_stacksize = m_shared->size;
+        }
+        ASSERT(m_homeThread == (int)GetThreadId());
+
+        Fiber* occupant = m_shared->occupant;
+        if (occupant != this) {
+            if (occupant) {
+                occupant->saveSharedStack();
+            }
+            m_shared->occupant = this;
+            if (!m_needInit) {
+                memcpy((char*)m_stack + m_stacksize - m_saveSize, m_saveBuffer, m_saveSize);
+            }
+        }
+        if (m_needInit) {
+            m_needInit = false;
+            initStackContext(m_entry);
+        }
+    }
+
     // 切换执行本协程，将当前执行的协程放到后台
     void Fiber::swapIn() {
         SetThis(this);
         ASSERT(m_state != EXEC);
         m_state = EXEC;
-        if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-            ASSERT_W(false, "swapcontext");
-        }
+        SwapContext(Scheduler::GetMainFiber(), this);
     }
 
 	void Fiber::swapOut() {
 		SetThis(Scheduler::GetMainFiber());
-		if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-			ASSERT_W(false, "swapcontext");
-		}
+		SwapContext(this, Scheduler::GetMainFiber());
 	}
 
     void Fiber::call() {
         SetThis(this);
         m_state = EXEC;
-        if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-			ASSERT_W(false, "swapcontext");
-		}
+        SwapContext(t_threadFiber.get(), this);
     }
 
 	void Fiber::uncall() {
 		SetThis(t_threadFiber.get());
-		if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-			ASSERT_W(false, "swapcontext");
-		}
-
+		SwapContext(this, t_threadFiber.get());
 	}
 
     //设置当前协程
@@ -153,6 +283,14 @@ namespace Framework {
         return 0;
     }
 
+    Fiber::Priority Fiber::GetCurrentPriority() {
+        return t_fiber ? t_fiber->m_priority : NORMAL;
+    }
+
+    std::shared_ptr<CancelContext> Fiber::GetCurrentCancelContext() {
+        return t_fiber ? t_fiber->m_cancel : nullptr;
+    }
+
     // 设置当前协程为ready，随后切换到主协程
     void Fiber::YieldToReady() {
         Fiber::ptr cur = GetThis();
@@ -171,6 +309,48 @@ namespace Framework {
         return s_fiber_count;
     }
 
+    Fiber::ptr Fiber::Create(InlineFunction cb, size_t stacksize) {
+        if (stacksize || !s_fiber_pool_size.load(std::memory_order_relaxed)) {
+            return Fiber::ptr(new Fiber(std::move(cb), stacksize));
+        }
+        FiberPool& pool = t_fiber_pool;
+        if (pool.alive && !pool.fibers.empty()) {
+            Fiber* fiber = pool.fibers.back();
+            pool.fibers.pop_back();
+            fiber->reset(std::move(cb));
+            s_pool_reused.fetch_add(1, std::memory_order_relaxed);
+            return Fiber::ptr(fiber, &Fiber::Recycle);
+        }
+        return Fiber::ptr(new Fiber(std::move(cb)), &Fiber::Recycle);
+    }
+
+    void Fiber::Recycle(Fiber* fiber) {
+        FiberPool& pool = t_fiber_pool;
+        // 共享栈协程绑定了线程和共享栈，不复用
+        if (pool.alive && !fiber->m_sharedMode
+            && (fiber->m_state == TERM || fiber->m_state == INIT || fiber->m_state == EXCEPT)
+            && pool.fibers.size() < s_fiber_pool_size.load(std::memory_order_relaxed)) {
+            fiber->m_cb = nullptr; // 异常结束的协程还留着回调，尽早释放它捕获的对象
+            pool.fibers.push_back(fiber);
+            s_pool_recycled.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        s_pool_discarded.fetch_add(1, std::memory_order_relaxed);
+        delete fiber;
+    }
+
+    Fiber::PoolStats Fiber::GetPoolStats() {
+        PoolStats stats;
+        stats.reused = s_pool_reused;
+        stats.recycled = s_pool_recycled;
+        stats.discarded = s_pool_discarded;
+        return stats;
+    }
+
+    size_t Fiber::GetPooledCount() {
+        return t_fiber_pool.alive ? t_fiber_pool.fibers.size() : 0;
+    }
+
     void Fiber::MainFunc() {
         Fiber::ptr cur = GetThis();
         ASSERT(cur);
@@ -188,6 +368,7 @@ namespace Framework {
             LOG_ERROR(g_logger) << "Fiber Except";
         }
 
+        cur->m_cancel.reset(); // 结束的协程可能在池里或调度器手上留很久，不再拖着请求的上下文
         // cur->swapOut(); // 手动返回主协程，但是此时Fiber::ptr cur = GetThis();申请的智能指针并未被释放引用计数在此处一定>=1
         auto raw_ptr = cur.get(); // 需要使用裸指针
         cur.reset();
@@ -211,6 +392,7 @@ namespace Framework {
             LOG_ERROR(g_logger) << "Fiber Except";
         }
 
+        cur->m_cancel.reset();
         auto raw_ptr = cur.get();
         cur.reset();
         raw_ptr->uncall();
@@ -6,10 +6,14 @@
 #include <functional>
 #include <memory>
 
+#include "fiber_context.h"
+#include "inline_function.h"
 #include "log.h"
 #include "multithread.h"
 
 namespace Framework {
+    struct SharedStack;
+    class CancelContext;
     class Fiber : public std::enable_shared_from_this<Fiber> {
     public:
         typedef std::shared_ptr<Fiber> ptr;
@@ -23,12 +27,42 @@ namespace Framework {
             EXCEPT
         };
 
-        Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+        /*
+        调度优先级，数值越小越优先，调度器按优先级分别排队（低优先级等得太久时会插队一次，见scheduler.priority_aging）
+        新建的协程继承创建者（当前协程）的优先级；调度回调时不指定优先级则继承调用schedule的协程的优先级
+        */
+        enum Priority {
+            INHERIT = -1, // 只用作schedule的参数
+            CRITICAL = 0, // 健康检查、管理接口、延迟敏感的RPC
+            NORMAL,
+            BACKGROUND,   // 批量的后台任务
+            PRIORITY_COUNT
+        };
+
+        // 协程回收池的统计（所有线程之和）
+        struct PoolStats {
+            uint64_t reused = 0;    // Create从池里取到了协程
+            uint64_t recycled = 0;  // 结束的协程放回了池里
+            uint64_t discarded = 0; // 池满或协程还没结束，直接释放
+        };
+
+        Fiber(InlineFunction cb, size_t stacksize = 0, bool use_caller = false);
         ~Fiber();
 
-        //重置协程函数，并重置状态
+        /*
+        创建协程，fiber.pool_size>0时优先从本线程的回收池里取一个已结束的协程reset后复用（省掉Fiber对象和栈的申请、id和计数的原子操作）
+        返回的智能指针最后一个引用释放时，协程若已结束就放回当时所在线程的池里，池满才真正释放
+        复用的协程保留原来的id，和Scheduler里复用的回调协程一样从MainFunc进入，由调度器swapIn/swapOut
+        指定了stacksize的协程不进池
+        */
+        static Fiber::ptr Create(InlineFunction cb, size_t stacksize = 0);
+        static PoolStats GetPoolStats();
+        // 本线程池里现有的协程数
+        static size_t GetPooledCount();
+
+        //重置协程函数，并重置状态（优先级重新继承当前协程）
         //INIT, TERM
-        void reset(std::function<void()> cb);
+        void reset(InlineFunction cb);
         //切换到当前协程执行
         void swapIn();
         //切换到后台执行
@@ -51,6 +85,32 @@ namespace Framework {
         void setState(const State state) {
             m_state = state;
         }
+        Priority getPriority() const {
+            return m_priority;
+        }
+        // 只改变之后入队时的优先级，想马上生效需要再让出一次
+        void setPriority(Priority priority) {
+            m_priority = priority;
+        }
+        // 当前协程的优先级，线程上没有协程时为NORMAL
+        static Priority GetCurrentPriority();
+        // 截止时间/取消上下文（见cancel_context.h），和优先级一样由新建的协程继承
+        const std::shared_ptr<CancelContext>& getCancelContext() const {
+            return m_cancel;
+        }
+        void setCancelContext(std::shared_ptr<CancelContext> ctx) {
+            m_cancel = std::move(ctx);
+        }
+        // 当前协程的上下文，线程上没有协程或没设置时为nullptr
+        static std::shared_ptr<CancelContext> GetCurrentCancelContext();
+        // 共享栈协程第一次运行后就固定在该线程上，其余协程返回-1
+        int getHomeThread() const {
+            return m_homeThread;
+        }
+        // 是否运行在共享栈上：切出后栈上的数据会被搬走，栈上的地址不能交给内核异步使用
+        bool isSharedStack() const {
+            return m_sharedMode;
+        }
 
         static uint64_t GetFiberId();
         //协程切换到后台，并且设置为Ready状态
@@ -64,14 +124,44 @@ namespace Framework {
         static void MainFuncCaller();
     private:
         Fiber(); // 思考：为什么无参构造要写成私有？
+        // 在m_stack上建立初始上下文，第一次切入时执行entry；共享栈协程推迟到真正切入时再建立
+        void initContext(void (*entry)());
+        void initStackContext(void (*entry)());
+        // 保存当前上下文到from，切换到to
+        static void SwapContext(Fiber* from, Fiber* to);
+        static void SwapSharedStack(Fiber* from, Fiber* to);
+        // Create返回的智能指针的删除器
+        static void Recycle(Fiber* fiber);
+
+        // 切出时保存的栈顶
+        char* getStackPointer() const;
+        // 共享栈：把自己用到的那段栈拷到堆上
+        void saveSharedStack();
+        // 共享栈：把占用者的栈拷出去，再把自己的栈拷回来
+        void loadSharedStack();
     private:
         uint64_t m_id = 0;
         uint32_t m_stacksize = 0;
         State m_state = INIT;
+        Priority m_priority = NORMAL;
+        std::shared_ptr<CancelContext> m_cancel;
 
+#ifdef FIBER_ASM_CONTEXT
+        void* m_sp = nullptr; // 切出时保存的栈顶，寄存器都压在这个栈上
+#else
         ucontext_t m_ctx;
+#endif
         void* m_stack = nullptr;
 
-        std::function<void()> m_cb;
+        InlineFunction m_cb;
+
+        bool m_sharedMode = false;           // 是否使用共享栈
+        bool m_needInit = false;             // 上下文还没在共享栈上建立
+        void (*m_entry)() = nullptr;
+        SharedStack* m_shared = nullptr;     // 第一次运行时绑定到当前线程的某个共享栈
+        int m_homeThread = -1;
+        char* m_saveBuffer = nullptr;        // 切出后被挤下共享栈时，栈内容保存在这里
+        size_t m_saveSize = 0;
+        size_t m_saveCap = 0;
     };
 }
\ No newline at end of file
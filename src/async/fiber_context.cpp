@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "fiber_context.h"
+
+#ifdef FIBER_HAS_ASM_CONTEXT
+
+#if defined(__x86_64__)
+/*
+栈帧（低地址 -> 高地址）：
+    [mxcsr | x87 cw] r12 r13 r14 r15 rbx rbp [返回地址]
+*/
+asm(R"(
+    .text
+    .globl fiber_swap_context
+    .type fiber_swap_context, @function
+    .align 16
+fiber_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size fiber_swap_context, .-fiber_swap_context
+
+    .globl fiber_context_entry
+    .type fiber_context_entry, @function
+    .align 16
+fiber_context_entry:
+    xorq %rbp, %rbp
+    callq *%r12
+    ud2
+    .size fiber_context_entry, .-fiber_context_entry
+)");
+
+static const size_t kFrameSize = 8 * 8; // fpu控制字 + 6个寄存器 + 返回地址
+
+#elif defined(__aarch64__)
+/*
+栈帧（低地址 -> 高地址）：
+    d8-d15 x19-x28 x29 x30(lr)
+*/
+asm(R"(
+    .text
+    .globl fiber_swap_context
+    .type fiber_swap_context, %function
+    .align 4
+fiber_swap_context:
+    sub sp, sp, #160
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size fiber_swap_context, .-fiber_swap_context
+
+    .globl fiber_context_entry
+    .type fiber_context_entry, %function
+    .align 4
+fiber_context_entry:
+    mov x29, #0
+    blr x19
+    brk #0
+    .size fiber_context_entry, .-fiber_context_entry
+)");
+
+static const size_t kFrameSize = 160;
+
+#endif
+
+extern "C" void fiber_context_entry();
+
+namespace Framework {
+    void* MakeFiberContext(void* stack, size_t size, void (*entry)()) {
+        // 栈顶16字节对齐，保证entry被调用时满足ABI的栈对齐要求
+        uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+        uint64_t* sp = (uint64_t*)(top - kFrameSize);
+        memset(sp, 0, kFrameSize);
+#if defined(__x86_64__)
+        uint32_t fpu[2] = { 0x1F80, 0x037F }; // mxcsr、x87控制字的默认值
+        memcpy(&sp[0], fpu, sizeof(fpu));
+        sp[1] = (uint64_t)entry;                 // r12
+        sp[7] = (uint64_t)&fiber_context_entry;  // 返回地址，ret后rsp == top
+#elif defined(__aarch64__)
+        sp[8] = (uint64_t)entry;                 // x19
+        sp[19] = (uint64_t)&fiber_context_entry; // x30
+#endif
+        return sp;
+    }
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+// 手写的协程上下文切换，只保存callee-saved寄存器，不像swapcontext那样每次切换都调用rt_sigprocmask
+// 支持x86_64和aarch64，编译时打开FIBER_ASM_CONTEXT后Fiber改用这套实现
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define FIBER_HAS_ASM_CONTEXT 1
+#endif
+
+#if defined(FIBER_ASM_CONTEXT) && !defined(FIBER_HAS_ASM_CONTEXT)
+#error "FIBER_ASM_CONTEXT only supports x86_64 and aarch64"
+#endif
+
+#ifdef FIBER_HAS_ASM_CONTEXT
+extern "C" {
+    // 把callee-saved寄存器压到当前栈上，栈顶保存到*from_sp，然后切到to_sp并恢复那边的寄存器
+    void fiber_swap_context(void** from_sp, void* to_sp);
+}
+
+namespace Framework {
+    // 在[stack, stack + size)上伪造一个初始帧，第一次切换进去时从entry开始执行，entry不能返回
+    void* MakeFiberContext(void* stack, size_t size, void (*entry)());
+}
+#endif
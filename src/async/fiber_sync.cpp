@@ -0,0 +1,383 @@
+#include <algorithm>
+
+#include "cancel_context.h"
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "macro.h"
+
+namespace Framework {
+    struct FiberWaitQueue::Waiter {
+        typedef std::shared_ptr<Waiter> ptr;
+        enum State {
+            WAITING,
+            GRANTED,
+            TIMEOUT
+        };
+
+        std::atomic<int> state = { WAITING }; // 释放方和超时定时器CAS，赢的一方负责唤醒
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        int type = 0;
+        bool queued = false; // 以下由原语的锁保护
+        Waiter* prev = nullptr;
+        Waiter* next = nullptr;
+    };
+
+    // 超时定时器和取消上下文共用：等待者还没被选中的话标记为超时并唤醒它
+    static void ExpireWaiter(const std::weak_ptr<FiberWaitQueue::Waiter>& weak) {
+        FiberWaitQueue::Waiter::ptr w = weak.lock();
+        int expected = FiberWaitQueue::Waiter::WAITING;
+        if (w && w->state.compare_exchange_strong(expected, FiberWaitQueue::Waiter::TIMEOUT)) {
+            FiberWaitQueue::Wakeup{ w->scheduler, std::move(w->fiber) }();
+        }
+    }
+
+    void FiberWaitQueue::Wakeup::operator()() {
+        if (fiber) {
+            scheduler->schedule(&fiber); // 按地址传递，fiber被swap进任务里
+        }
+    }
+
+    bool FiberWaitQueue::wait(Spinlock::Lock& lock, int type, uint64_t timeout_ms, FiberMutex* unlock_after) {
+        Scheduler* scheduler = Scheduler::GetThis();
+        ASSERT_W(scheduler, "fiber sync wait outside of a scheduler");
+        // 限时等待同时受当前协程的截止时间/取消上下文约束；不限时的等待（lock、wait）调用方没法处理失败，不受影响
+        CancelContext::ptr cancel;
+        if (timeout_ms != ~0ull) {
+            cancel = Fiber::GetCurrentCancelContext();
+            if (cancel) {
+                if (cancel->isDone()) {
+                    lock.unlock();
+                    if (unlock_after) {
+                        unlock_after->unlock();
+                    }
+                    return false;
+                }
+                timeout_ms = std::min(timeout_ms, cancel->getRemaining());
+            }
+        }
+        // 定时器可能在协程返回之后才执行，等待者交给智能指针管理，定时器只持有weak_ptr
+        Waiter::ptr waiter(new Waiter);
+        waiter->scheduler = scheduler;
+        waiter->fiber = Fiber::GetThis();
+        waiter->type = type;
+        push(waiter.get());
+        lock.unlock();
+        if (unlock_after) {
+            unlock_after->unlock(); // 已经在队列里了，这之后的notify都能选中它
+        }
+
+        Timer::ptr timer;
+        uint64_t waker = 0;
+        if (timeout_ms != ~0ull) {
+            IOManager* iom = IOManager::GetThis();
+            ASSERT_W(iom, "fiber sync timed wait outside of an IOManager");
+            std::weak_ptr<Waiter> weak(waiter);
+            timer = iom->addTimer(timeout_ms, std::bind(ExpireWaiter, weak));
+            if (cancel) {
+                waker = cancel->addWaker([weak](int) { ExpireWaiter(weak); });
+                if (!waker) {
+                    ExpireWaiter(weak);
+                }
+            }
+        }
+        // 解锁之后、让出之前就被选中（或超时、取消）也没关系：调度器不会运行还处于EXEC状态的协程
+        Fiber::YieldToHold();
+
+        if (waker) {
+            cancel->delWaker(waker);
+        }
+        if (timer) {
+            timer->cancel();
+        }
+        if (waiter->state == Waiter::GRANTED) {
+            return true;
+        }
+        // 超时：释放方可能已经把它弹出并跳过，还在队列里就自己出队
+        lock.lock();
+        if (waiter->queued) {
+            remove(waiter.get());
+        }
+        lock.unlock();
+        return false;
+    }
+
+    int FiberWaitQueue::frontType() {
+        while (m_head && m_head->state == Waiter::TIMEOUT) {
+            remove(m_head);
+        }
+        return m_head ? m_head->type : -1;
+    }
+
+    FiberWaitQueue::Wakeup FiberWaitQueue::grantFront() {
+        Wakeup wakeup;
+        Waiter* waiter = m_head;
+        if (!waiter) {
+            return wakeup;
+        }
+        remove(waiter);
+        // 等待者的协程要等Wakeup调度后才会恢复，此前waiter一直有效
+        int expected = Waiter::WAITING;
+        if (waiter->state.compare_exchange_strong(expected, Waiter::GRANTED)) {
+            wakeup.scheduler = waiter->scheduler;
+            wakeup.fiber = std::move(waiter->fiber);
+        }
+        return wakeup;
+    }
+
+    FiberWaitQueue::Wakeup FiberWaitQueue::grantNext() {
+        while (m_head) {
+            Wakeup wakeup = grantFront();
+            if (wakeup.fiber) {
+                return wakeup;
+            }
+        }
+        return Wakeup();
+    }
+
+    void FiberWaitQueue::push(Waiter* waiter) {
+        waiter->queued = true;
+        waiter->prev = m_tail;
+        waiter->next = nullptr;
+        if (m_tail) {
+            m_tail->next = waiter;
+        }
+        else {
+            m_head = waiter;
+        }
+        m_tail = waiter;
+    }
+
+    void FiberWaitQueue::remove(Waiter* waiter) {
+        if (waiter->prev) {
+            waiter->prev->next = waiter->next;
+        }
+        else {
+            m_head = waiter->next;
+        }
+        if (waiter->next) {
+            waiter->next->prev = waiter->prev;
+        }
+        else {
+            m_tail = waiter->prev;
+        }
+        waiter->prev = waiter->next = nullptr;
+        waiter->queued = false;
+    }
+}
+
+namespace Framework {
+    void FiberMutex::lock() {
+        lockFor(~0ull);
+    }
+
+    bool FiberMutex::tryLock() {
+        Spinlock::Lock lock(m_mutex);
+        if (m_locked) {
+            return false;
+        }
+        m_locked = true;
+        return true;
+    }
+
+    bool FiberMutex::lockFor(uint64_t timeout_ms) {
+        Spinlock::Lock lock(m_mutex);
+        if (!m_locked) {
+            m_locked = true;
+            return true;
+        }
+        return m_waiters.wait(lock, 0, timeout_ms); // 被选中时锁已经交到本协程手上
+    }
+
+    void FiberMutex::unlock() {
+        FiberWaitQueue::Wakeup wakeup;
+        {
+            Spinlock::Lock lock(m_mutex);
+            ASSERT(m_locked);
+            // 有人等就直接把锁交给队头，不真正解锁，避免刚到的协程插队
+            wakeup = m_waiters.grantNext();
+            if (!wakeup.fiber) {
+                m_locked = false;
+            }
+        }
+        wakeup();
+    }
+}
+
+namespace Framework {
+    enum {
+        RW_READ = 0,
+        RW_WRITE = 1
+    };
+
+    void FiberRWMutex::rdlock() {
+        lock(false, ~0ull);
+    }
+
+    void FiberRWMutex::wrlock() {
+        lock(true, ~0ull);
+    }
+
+    bool FiberRWMutex::rdlockFor(uint64_t timeout_ms) {
+        return lock(false, timeout_ms);
+    }
+
+    bool FiberRWMutex::wrlockFor(uint64_t timeout_ms) {
+        return lock(true, timeout_ms);
+    }
+
+    bool FiberRWMutex::tryRdlock() {
+        Spinlock::Lock lock(m_mutex);
+        if (m_writer || m_waiters.frontType() != -1) {
+            return false;
+        }
+        ++m_readers;
+        return true;
+    }
+
+    bool FiberRWMutex::tryWrlock() {
+        Spinlock::Lock lock(m_mutex);
+        if (m_writer || m_readers || m_waiters.frontType() != -1) {
+            return false;
+        }
+        m_writer = true;
+        return true;
+    }
+
+    bool FiberRWMutex::lock(bool write, uint64_t timeout_ms) {
+        Spinlock::Lock lock(m_mutex);
+        // 有人排队时新来的也排队，读者不能越过等待中的写者
+        if (!m_writer && m_waiters.frontType() == -1 && (!write || !m_readers)) {
+            if (write) {
+                m_writer = true;
+            }
+            else {
+                ++m_readers;
+            }
+            return true;
+        }
+        return m_waiters.wait(lock, write ? RW_WRITE : RW_READ, timeout_ms);
+    }
+
+    void FiberRWMutex::unlock() {
+        std::vector<FiberWaitQueue::Wakeup> wakeups;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if (m_writer) {
+                m_writer = false;
+            }
+            else {
+                ASSERT(m_readers);
+                --m_readers;
+            }
+            // 按队列顺序交接：队头是写者就等读者全部退出后交给它，连续的读者一起放行
+            while (!m_writer) {
+                int type = m_waiters.frontType();
+                if (type == -1 || (type == RW_WRITE && m_readers)) {
+                    break;
+                }
+                FiberWaitQueue::Wakeup wakeup = m_waiters.grantFront();
+                if (!wakeup.fiber) {
+                    continue; // 恰好超时了，重新看队头
+                }
+                if (type == RW_WRITE) {
+                    m_writer = true;
+                }
+                else {
+                    ++m_readers;
+                }
+                wakeups.push_back(std::move(wakeup));
+            }
+        }
+        for (auto& i : wakeups) {
+            i();
+        }
+    }
+}
+
+namespace Framework {
+    FiberSemaphore::FiberSemaphore(uint32_t count)
+        : m_count(count) {
+    }
+
+    void FiberSemaphore::wait() {
+        waitFor(~0ull);
+    }
+
+    bool FiberSemaphore::tryWait() {
+        Spinlock::Lock lock(m_mutex);
+        if (!m_count) {
+            return false;
+        }
+        --m_count;
+        return true;
+    }
+
+    bool FiberSemaphore::waitFor(uint64_t timeout_ms) {
+        Spinlock::Lock lock(m_mutex);
+        if (m_count) {
+            --m_count;
+            return true;
+        }
+        return m_waiters.wait(lock, 0, timeout_ms); // 被选中时计数已经记在本协程名下
+    }
+
+    void FiberSemaphore::notify(uint32_t count) {
+        std::vector<FiberWaitQueue::Wakeup> wakeups;
+        {
+            Spinlock::Lock lock(m_mutex);
+            for (; count; --count) {
+                FiberWaitQueue::Wakeup wakeup = m_waiters.grantNext();
+                if (!wakeup.fiber) {
+                    break;
+                }
+                wakeups.push_back(std::move(wakeup));
+            }
+            m_count += count; // 剩下的没人等，攒起来
+        }
+        for (auto& i : wakeups) {
+            i();
+        }
+    }
+}
+
+namespace Framework {
+    void FiberCondVar::wait(FiberMutex& mutex) {
+        waitFor(mutex, ~0ull);
+    }
+
+    bool FiberCondVar::waitFor(FiberMutex& mutex, uint64_t timeout_ms) {
+        // 先入队再释放mutex，notify不会落在释放mutex和入队之间；释放mutex会把它交给下一个等待者（调度+写eventfd），
+        // 放到条件变量的自旋锁外面做，不让并发的notify空转
+        Spinlock::Lock lock(m_mutex);
+        bool rt = m_waiters.wait(lock, 0, timeout_ms, &mutex);
+        mutex.lock();
+        return rt;
+    }
+
+    void FiberCondVar::notifyOne() {
+        FiberWaitQueue::Wakeup wakeup;
+        {
+            Spinlock::Lock lock(m_mutex);
+            wakeup = m_waiters.grantNext();
+        }
+        wakeup();
+    }
+
+    void FiberCondVar::notifyAll() {
+        std::vector<FiberWaitQueue::Wakeup> wakeups;
+        {
+            Spinlock::Lock lock(m_mutex);
+            while (true) {
+                FiberWaitQueue::Wakeup wakeup = m_waiters.grantNext();
+                if (!wakeup.fiber) {
+                    break;
+                }
+                wakeups.push_back(std::move(wakeup));
+            }
+        }
+        for (auto& i : wakeups) {
+            i();
+        }
+    }
+}
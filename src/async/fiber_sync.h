@@ -0,0 +1,119 @@
+#pragma once
+// 协程同步原语：拿不到资源时只挂起当前协程，所在线程继续调度别的协程，不会像pthread锁那样卡住整个线程
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "fiber.h"
+#include "multithread.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace Framework {
+    class FiberMutex;
+
+    /*
+    挂起协程的FIFO队列，由各个原语在自己的Spinlock保护下使用
+    资源直接交接：释放方在锁内选出队头的等待者、把资源（锁的所有权、信号量计数）记到它名下，再唤醒它，醒来的协程不用再抢
+    超时由当前IOManager的定时器实现，定时器和释放方对等待者的状态做CAS，只有一方能唤醒它
+    限时等待还受当前协程的取消上下文约束（见cancel_context.h）：不会等过截止时间，取消时和超时一样立刻返回失败
+    等待必须发生在调度器里的协程上（限时等待要求是IOManager），唤醒可以在任意线程
+    */
+    class FiberWaitQueue : private Noncopyable {
+    public:
+        struct Waiter;
+        // 被选中的等待者，在释放原语的锁之后再调度，避免持有自旋锁时做调度和唤醒
+        struct Wakeup {
+            Scheduler* scheduler = nullptr;
+            Fiber::ptr fiber;
+
+            void operator()();
+        };
+
+        // 把当前协程排到队尾，释放lock后挂起，直到被选中或超时（timeout_ms为~0ull表示不限时）；返回是否被选中
+        // 返回时lock处于释放状态；unlock_after不为空时，释放lock之后、挂起之前再释放它（条件变量用）
+        bool wait(Spinlock::Lock& lock, int type = 0, uint64_t timeout_ms = ~0ull, FiberMutex* unlock_after = nullptr);
+
+        // 以下需持有lock，返回的Wakeup在解锁后调用
+        // 队头等待者的type（顺带清掉队头已经超时的），队列为空返回-1
+        int frontType();
+        // 队头出队并选中；它恰好在这期间超时的话返回空的Wakeup，调用方重新看队头
+        Wakeup grantFront();
+        // 选中第一个还在等待的，没有返回空的Wakeup
+        Wakeup grantNext();
+    private:
+        void push(Waiter* waiter);
+        void remove(Waiter* waiter);
+    private:
+        Waiter* m_head = nullptr;
+        Waiter* m_tail = nullptr;
+    };
+
+    // 协程互斥锁，等待者按FIFO顺序获得锁
+    class FiberMutex : private Noncopyable {
+    public:
+        typedef ScopedLockImpl<FiberMutex> Lock;
+
+        void lock();
+        bool tryLock();
+        // 限时加锁，超时返回false
+        bool lockFor(uint64_t timeout_ms);
+        void unlock();
+    private:
+        Spinlock m_mutex;
+        bool m_locked = false;
+        FiberWaitQueue m_waiters;
+    };
+
+    // 协程读写锁：FIFO，写者排队后新来的读者也要排在它后面，写者不会饿死
+    class FiberRWMutex : private Noncopyable {
+    public:
+        typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+        typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+        void rdlock();
+        void wrlock();
+        bool tryRdlock();
+        bool tryWrlock();
+        bool rdlockFor(uint64_t timeout_ms);
+        bool wrlockFor(uint64_t timeout_ms);
+        void unlock();
+    private:
+        bool lock(bool write, uint64_t timeout_ms);
+    private:
+        Spinlock m_mutex;
+        uint32_t m_readers = 0;
+        bool m_writer = false;
+        FiberWaitQueue m_waiters;
+    };
+
+    // 协程信号量
+    class FiberSemaphore : private Noncopyable {
+    public:
+        FiberSemaphore(uint32_t count = 0);
+
+        void wait();
+        bool tryWait();
+        bool waitFor(uint64_t timeout_ms);
+        void notify(uint32_t count = 1);
+    private:
+        Spinlock m_mutex;
+        uint32_t m_count;
+        FiberWaitQueue m_waiters;
+    };
+
+    // 协程条件变量，配合FiberMutex使用
+    class FiberCondVar : private Noncopyable {
+    public:
+        // 释放mutex并挂起，被唤醒后重新加锁再返回
+        void wait(FiberMutex& mutex);
+        // 限时等待，超时返回false（返回时同样已重新加锁）
+        bool waitFor(FiberMutex& mutex, uint64_t timeout_ms);
+        void notifyOne();
+        void notifyAll();
+    private:
+        Spinlock m_mutex;
+        FiberWaitQueue m_waiters;
+    };
+}
@@ -1,5 +1,8 @@
 ﻿#include <dlfcn.h> // dlsym
 
+#include <algorithm>
+
+#include "cancel_context.h"
 #include "config.h"
 #include "fdmanager.h"
 #include "hook.h"
@@ -19,6 +22,7 @@ namespace Framework {
         XX(socket) \
         XX(connect) \
         XX(accept) \
+        XX(accept4) \
         XX(read) \
         XX(readv) \
         XX(recv) \
@@ -81,10 +85,81 @@ namespace Framework {
     struct timer_info {
         int cancelled = 0;
     };
+
+    // 事件已经注册、协程准备挂起时登记到当前的取消上下文：取消时和超时一样强制触发事件，协程醒来后以取消的错误码失败
+    // 返回登记号，阻塞结束后要delWaker；登记前就已经取消的话直接触发事件，返回0
+    static uint64_t watch_cancel(CancelContext* cancel, const std::shared_ptr<timer_info>& tinfo
+        , IOManager* iom, int fd, uint32_t event) {
+        std::weak_ptr<timer_info> winfo(tinfo);
+        uint64_t id = cancel->addWaker([winfo, fd, iom, event](int error) {
+            auto t = winfo.lock();
+            if (!t || t->cancelled) {
+                return;
+            }
+            t->cancelled = error;
+            iom->cancelEvent(fd, (IOManager::Event)(event));
+        });
+        if (!id && !tinfo->cancelled) {
+            tinfo->cancelled = cancel->getError();
+            iom->cancelEvent(fd, (IOManager::Event)(event));
+        }
+        return id;
+    }
+
+    /*
+    挂起当前协程ms毫秒；当前协程有取消上下文时最多睡到截止时间，取消时立刻醒来
+    睡满返回0；提前醒来返回-1、errno为EINTR（和被信号打断的系统调用一样），left_ms为没睡的时间
+    */
+    static int fiber_sleep(uint64_t ms, uint64_t* left_ms = nullptr) {
+        Fiber::ptr fiber = Fiber::GetThis();
+        IOManager* iom = IOManager::GetThis();
+        CancelContext::ptr cancel = Fiber::GetCurrentCancelContext();
+        if (!cancel) {
+            iom->addTimer(ms, std::bind((void(Scheduler::*)(Fiber::ptr, int thread, Fiber::Priority))&IOManager::schedule, iom, fiber, -1, Fiber::INHERIT));
+            Fiber::YieldToHold();
+            return 0;
+        }
+
+        uint64_t begin = GetCurrentMS();
+        uint64_t to = std::min(ms, cancel->getRemaining());
+        // 定时器和取消都可能唤醒它，先到的一方负责调度并记下是谁
+        enum { WAITING, TIMER, CANCEL };
+        std::shared_ptr<std::atomic<int> > woken(new std::atomic<int>(WAITING));
+        if (to) {
+            auto wake = [woken, iom, fiber](int by) {
+                int expected = WAITING;
+                if (woken->compare_exchange_strong(expected, by)) {
+                    iom->schedule(fiber);
+                }
+            };
+            Timer::ptr timer = iom->addTimer(to, std::bind(wake, (int)TIMER));
+            uint64_t waker = cancel->addWaker([wake](int) { wake(CANCEL); });
+            if (!waker) {
+                wake(CANCEL);
+            }
+            Fiber::YieldToHold();
+            timer->cancel();
+            if (waker) {
+                cancel->delWaker(waker);
+            }
+        }
+        // 没被截止时间截短、定时器按时到点才算睡满
+        if (to == ms && (!to || *woken == TIMER)) {
+            return 0;
+        }
+        if (left_ms) {
+            uint64_t slept = GetCurrentMS() - begin;
+            *left_ms = slept < ms ? ms - slept : 0;
+        }
+        errno = EINTR;
+        return -1;
+    }
+
     // 可变参数模板
+    // uop：同一个操作交给io_uring时的描述，不走io_uring时不使用
     template<typename OriginFun, typename... Args>
     static ssize_t IOhook(int fd, OriginFun fun, const char* hook_fun_name,
-        uint32_t event, int timeout_so, Args&&... args) {
+        uint32_t event, int timeout_so, Framework::UringOp uop, Args&&... args) {
         // Args&& 是一个通用引用，它可以根据传入的实参类型推导出具体是左值引用还是右值引用
         // 未被hook，使用原函数
         if (!Framework::t_hook_enable) {
@@ -108,7 +183,30 @@ namespace Framework {
             return fun(fd, std::forward<Args>(args)...);
         }
 
+        // 当前协程的截止时间/取消上下文：已经结束的不再发起IO，阻塞的超时不超过剩余时间
+        Framework::CancelContext::ptr cancel = Framework::Fiber::GetCurrentCancelContext();
         uint64_t to = ctx->getTimeout(timeout_so);
+        if (cancel) {
+            int error = cancel->getError();
+            if (error) {
+                errno = error;
+                return -1;
+            }
+            to = std::min(to, cancel->getRemaining());
+        }
+        Framework::IOManager* iom = Framework::IOManager::GetThis();
+        // io_uring可用时直接把操作交给内核，协程挂起等结果，不用先试探、也不用注册epoll事件
+        if (iom && iom->canUseUring()) {
+            int res = iom->submitIo(fd, uop, to);
+            // 老内核对非阻塞的fd可能直接返回EAGAIN而不等待，这时退回epoll
+            if (res != -EAGAIN) {
+                if (res < 0) {
+                    errno = -res;
+                    return -1;
+                }
+                return res;
+            }
+        }
         std::shared_ptr<timer_info> tinfo(new timer_info);
 
     retry:
@@ -120,7 +218,6 @@ namespace Framework {
         }
         // 被阻塞，进入调度
         if (n == -1 && errno == EAGAIN) {
-            Framework::IOManager* iom = Framework::IOManager::GetThis();
             Framework::Timer::ptr timer;
             std::weak_ptr<timer_info> winfo(tinfo);
             /*
@@ -129,6 +226,10 @@ namespace Framework {
             可以确保：​只有当外部仍然持有 shared_ptr（即 tinfo 依然有效）时，我们才能通过 lock() 获取到一个有效的 shared_ptr 来访问对象；否则说明对象已经被释放，我们就不应该再操作它。​
             */
 
+            // 重试时截止时间又近了一些
+            if (cancel) {
+                to = std::min(to, cancel->getRemaining());
+            }
             // 如果设置了超时时间，就设置一个条件定时器，到时间自动cancel（立刻执行事件）
             if (to != (uint64_t)-1) {
                 timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
@@ -157,9 +258,21 @@ namespace Framework {
                 return -1;
             }
             else {
+                // 注册期间fd被别的线程关闭了：close的cancelAll可能早于注册，事件再也不会触发，自己取消掉
+                uint64_t waker = 0;
+                if (ctx->isClose()) {
+                    tinfo->cancelled = EBADF;
+                    iom->cancelEvent(fd, (Framework::IOManager::Event)(event));
+                }
+                else if (cancel) {
+                    waker = watch_cancel(cancel.get(), tinfo, iom, fd, event);
+                }
                 // 添加事件成功，让出执行权
                 Framework::Fiber::YieldToHold();
                 // 从其他地方重新获得执行权后，删掉定时器
+                if (waker) {
+                    cancel->delWaker(waker);
+                }
                 if (timer) {
                     timer->cancel();
                 }
@@ -182,9 +295,6 @@ extern "C" {
     HOOK_FUN(XX);
     #undef XX
 
-    struct timer_info {
-        int cancelled = 0;
-    };
     int IOHook_connect(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms) {
         if (!Framework::t_hook_enable) {
             return connect_f(fd, addr, addrlen);
@@ -213,8 +323,12 @@ extern "C" {
 
         Framework::IOManager* iom = Framework::IOManager::GetThis();
         Framework::Timer::ptr timer;
-        std::shared_ptr<timer_info> tinfo(new timer_info);
-        std::weak_ptr<timer_info> winfo(tinfo);
+        std::shared_ptr<Framework::timer_info> tinfo(new Framework::timer_info);
+        std::weak_ptr<Framework::timer_info> winfo(tinfo);
+        Framework::CancelContext::ptr cancel = Framework::Fiber::GetCurrentCancelContext();
+        if (cancel) {
+            timeout_ms = std::min(timeout_ms, cancel->getRemaining());
+        }
 
         if (timeout_ms != (uint64_t)-1) {
             timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() {
@@ -230,7 +344,14 @@ extern "C" {
         // 写事件立刻触发
         int rt = iom->addEvent(fd, Framework::IOManager::WRITE);
         if (rt == 0) {
+            uint64_t waker = 0;
+            if (cancel) {
+                waker = Framework::watch_cancel(cancel.get(), tinfo, iom, fd, Framework::IOManager::WRITE);
+            }
             Framework::Fiber::YieldToHold();
+            if (waker) {
+                cancel->delWaker(waker);
+            }
             if (timer) {
                 timer->cancel();
             }
@@ -265,11 +386,10 @@ extern "C" {
         if (!Framework::t_hook_enable) {
             return sleep_f(seconds);
         }
-        Framework::Fiber::ptr fiber = Framework::Fiber::GetThis();
-        Framework::IOManager* iom = Framework::IOManager::GetThis();
-        // iom->addTimer(seconds * 1000, [iom, fiber]() {iom->schedule(fiber); });
-        iom->addTimer(seconds * 1000, std::bind((void(Framework::Scheduler::*)(Framework::Fiber::ptr, int thread))&Framework::IOManager::schedule, iom, fiber, -1));
-        Framework::Fiber::YieldToHold();
+        uint64_t left_ms = 0;
+        if (Framework::fiber_sleep(seconds * 1000ull, &left_ms)) {
+            return (left_ms + 999) / 1000; // 和被打断的sleep一样返回没睡的秒数
+        }
         return 0;
     }
 
@@ -277,24 +397,21 @@ extern "C" {
         if (!Framework::t_hook_enable) {
             return usleep_f(usec);
         }
-        Framework::Fiber::ptr fiber = Framework::Fiber::GetThis();
-        Framework::IOManager* iom = Framework::IOManager::GetThis();
-        // iom->addTimer(usec / 1000, [iom, fiber]() {iom->schedule(fiber); });
-        iom->addTimer(usec / 1000, std::bind((void(Framework::Scheduler::*)(Framework::Fiber::ptr, int thread))&Framework::IOManager::schedule, iom, fiber, -1));
-        Framework::Fiber::YieldToHold();
-        return 0;
+        return Framework::fiber_sleep(usec / 1000);
     }
 
     int nanosleep(const struct timespec* req, struct timespec* rem) {
         if (!Framework::t_hook_enable) {
             return nanosleep_f(req, rem);
         }
-        int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-        Framework::Fiber::ptr fiber = Framework::Fiber::GetThis();
-        Framework::IOManager* iom = Framework::IOManager::GetThis();
-        iom->addTimer(timeout_ms, [iom, fiber]() {iom->schedule(fiber); });
-        Framework::Fiber::YieldToHold();
-        return 0;
+        uint64_t timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+        uint64_t left_ms = 0;
+        int rt = Framework::fiber_sleep(timeout_ms, &left_ms);
+        if (rt && rem) {
+            rem->tv_sec = left_ms / 1000;
+            rem->tv_nsec = (left_ms % 1000) * 1000 * 1000;
+        }
+        return rt;
     }
 
     // socket IO
@@ -317,7 +434,17 @@ extern "C" {
     }
 
     int accept(int s, struct sockaddr* addr, socklen_t* addrlen) {
-        int fd = Framework::IOhook(s, accept_f, "accept", Framework::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+        int fd = Framework::IOhook(s, accept_f, "accept", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Accept(addr, addrlen), addr, addrlen);
+        if (fd >= 0) {
+            Framework::FdMgr::GetInstance()->get(fd, true);
+        }
+        return fd;
+    }
+
+    int accept4(int s, struct sockaddr* addr, socklen_t* addrlen, int flags) {
+        int fd = Framework::IOhook(s, accept4_f, "accept4", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Accept(addr, addrlen, flags), addr, addrlen, flags);
         if (fd >= 0) {
             Framework::FdMgr::GetInstance()->get(fd, true);
         }
@@ -325,43 +452,53 @@ extern "C" {
     }
 
     ssize_t read(int fd, void* buf, size_t count) {
-        return Framework::IOhook(fd, read_f, "read", Framework::IOManager::READ, SO_RCVTIMEO, buf, count);
+        return Framework::IOhook(fd, read_f, "read", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Buffer(IORING_OP_READ, buf, count), buf, count);
     }
 
     ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
-        return Framework::IOhook(fd, readv_f, "readv", Framework::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+        return Framework::IOhook(fd, readv_f, "readv", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Vector(IORING_OP_READV, iov, iovcnt), iov, iovcnt);
     }
 
     ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
-        return Framework::IOhook(sockfd, recv_f, "recv", Framework::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+        return Framework::IOhook(sockfd, recv_f, "recv", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Buffer(IORING_OP_RECV, buf, len, flags), buf, len, flags);
     }
 
     ssize_t recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* src_addr, socklen_t* addrlen) {
-        return Framework::IOhook(sockfd, recvfrom_f, "recvfrom", Framework::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+        return Framework::IOhook(sockfd, recvfrom_f, "recvfrom", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Named(IORING_OP_RECVMSG, buf, len, flags, src_addr, 0, addrlen), buf, len, flags, src_addr, addrlen);
     }
 
     ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
-        return Framework::IOhook(sockfd, recvmsg_f, "recvmsg", Framework::IOManager::READ, SO_RCVTIMEO, msg, flags);
+        return Framework::IOhook(sockfd, recvmsg_f, "recvmsg", Framework::IOManager::READ, SO_RCVTIMEO,
+            Framework::UringOp::Message(IORING_OP_RECVMSG, msg, flags), msg, flags);
     }
 
     ssize_t write(int fd, const void* buf, size_t count) {
-        return Framework::IOhook(fd, write_f, "write", Framework::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+        return Framework::IOhook(fd, write_f, "write", Framework::IOManager::WRITE, SO_SNDTIMEO,
+            Framework::UringOp::Buffer(IORING_OP_WRITE, buf, count), buf, count);
     }
 
     ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
-        return Framework::IOhook(fd, writev_f, "writev", Framework::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+        return Framework::IOhook(fd, writev_f, "writev", Framework::IOManager::WRITE, SO_SNDTIMEO,
+            Framework::UringOp::Vector(IORING_OP_WRITEV, iov, iovcnt), iov, iovcnt);
     }
 
     ssize_t send(int s, const void* msg, size_t len, int flags) {
-        return Framework::IOhook(s, send_f, "send", Framework::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+        return Framework::IOhook(s, send_f, "send", Framework::IOManager::WRITE, SO_SNDTIMEO,
+            Framework::UringOp::Buffer(IORING_OP_SEND, msg, len, flags), msg, len, flags);
     }
 
     ssize_t sendto(int s, const void* msg, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
-        return Framework::IOhook(s, sendto_f, "sendto", Framework::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+        return Framework::IOhook(s, sendto_f, "sendto", Framework::IOManager::WRITE, SO_SNDTIMEO,
+            Framework::UringOp::Named(IORING_OP_SENDMSG, msg, len, flags, to, tolen, nullptr), msg, len, flags, to, tolen);
     }
 
     ssize_t sendmsg(int s, const struct msghdr* msg, int flags) {
-        return Framework::IOhook(s, sendmsg_f, "sendmsg", Framework::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+        return Framework::IOhook(s, sendmsg_f, "sendmsg", Framework::IOManager::WRITE, SO_SNDTIMEO,
+            Framework::UringOp::Message(IORING_OP_SENDMSG, msg, flags), msg, flags);
     }
 
     int close(int fd) {
@@ -371,11 +508,13 @@ extern "C" {
 
         Framework::FdCtx::ptr ctx = Framework::FdMgr::GetInstance()->get(fd);
         if (ctx) {
+            // 先标记关闭再取消：正在注册事件的协程注册完会检查这个标志，两边总有一方能看到对方
+            ctx->close();
             auto iom = Framework::IOManager::GetThis();
             if (iom) {
                 iom->cancelAll(fd);
+                iom->unbindFd(fd);
             }
-            ctx->close();
             Framework::FdMgr::GetInstance()->del(fd);
         }
         return close_f(fd);
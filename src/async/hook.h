@@ -35,6 +35,9 @@ extern "C" {
 	typedef int (*accept_fun)(int s, struct sockaddr* addr, socklen_t* addrlen);
 	extern accept_fun accept_f;
 
+	typedef int (*accept4_fun)(int s, struct sockaddr* addr, socklen_t* addrlen, int flags);
+	extern accept4_fun accept4_f;
+
 	typedef ssize_t (*read_fun)(int fd, void* buf, size_t count);
 	extern read_fun read_f;
 
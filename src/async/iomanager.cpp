@@ -1,9 +1,16 @@
 ﻿#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include "cancel_context.h"
+#include "config.h"
+#include "fdmanager.h"
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
@@ -11,80 +18,232 @@
 namespace Framework {
 	static Framework::Logger::ptr g_logger = LOG_NAME("system");
 
+    static ConfigVar<bool>::ptr g_iomanager_multi_reactor =
+        Config::Lookup<bool>("iomanager.multi_reactor", false, "iomanager one epoll instance per worker thread");
+
+    static ConfigVar<bool>::ptr g_iomanager_io_uring =
+        Config::Lookup<bool>("iomanager.io_uring", false, "iomanager hooked socket io through io_uring, epoll if unsupported");
+
+    static ConfigVar<bool>::ptr g_iomanager_persistent_epoll =
+        Config::Lookup<bool>("iomanager.persistent_epoll", false, "iomanager register sockets once as edge-triggered read|write instead of per wait");
+
+    static ConfigVar<uint32_t>::ptr g_iomanager_busy_poll_us =
+        Config::Lookup<uint32_t>("iomanager.busy_poll_us", 0, "max microseconds an idle worker busy polls before sleeping in epoll_wait, tuned by recent arrival gaps, 0 disables");
+
+    static const uint32_t URING_ENTRIES = 256;
+    // 线程一直有任务做时，攒下的SQE最多再等这么多个任务就提交
+    static const uint32_t URING_BUSY_SUBMIT_TASKS = 8;
+    // io_uring的user_data：0不关心结果（取消请求），1为epoll实例的POLL_ADD，其余为UringRequest的地址，最低位为1表示它的超时
+    static const uint64_t URING_IGNORE = 0;
+    static const uint64_t URING_EPOLL = 1;
+    static const uint64_t URING_TIMEOUT_BIT = 1;
+    // 一次epoll_wait最多取出的事件数
+    static const int MAX_EVENTS = 64;
+    // 等待在这么短的时间内返回，认为事件在调用之前就已经就绪（过载判断用）
+    static const uint64_t POLL_IMMEDIATE_US = 100;
+
+    // 一次io_uring操作，放在发起协程的栈上，协程挂起期间一直有效
+    struct UringRequest {
+        Fiber::ptr fiber;
+        std::atomic<int>* fdOps = nullptr;
+        size_t* ringOps = nullptr;
+        int res = 0;
+        int timeoutRes = 0;
+        int pending = 0; // 还没收到的CQE数，操作本身一个，带超时再加一个
+    };
+
     IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
         : Scheduler(threads, use_caller, name) {
+        m_multiReactor = g_iomanager_multi_reactor->getValue();
+        m_persistentEpoll = g_iomanager_persistent_epoll->getValue();
+        m_busyPollUs = g_iomanager_busy_poll_us->getValue();
+        if (m_busyPollUs && sysconf(_SC_NPROCESSORS_ONLN) <= 1) {
+            // 只有一个CPU时自旋只会抢走要投递任务的那个线程的时间
+            LOG_INFO(g_logger) << "single cpu, iomanager.busy_poll_us ignored";
+            m_busyPollUs = 0;
+        }
+        // 开启弹性线程数时实际的线程数可能比参数多，按调度器建好的线程数来
+        threads = m_threadCount + (use_caller ? 1 : 0);
+        // 多reactor模式下每个调度线程（含use_caller的主线程）一个epoll实例
+        size_t count = m_multiReactor ? threads : 1;
+        for (size_t i = 0; i < count; ++i) {
+            m_reactors.emplace_back(new Reactor);
+            initReactor(*m_reactors.back());
+        }
+        if (m_multiReactor) {
+            m_firstWorkerReactor = (use_caller && threads > 1) ? 1 : 0;
+            enableLocalQueues(); // 事件绑定线程后任务大多投给指定线程，本地队列避免在共享队列里逐个跳过
+        }
+
+        if (g_iomanager_io_uring->getValue()) {
+            if (IoUring::Supported()) {
+                for (size_t i = 0; i < threads; ++i) {
+                    m_rings.emplace_back(new IoUring(URING_ENTRIES));
+                }
+                m_ringStates.resize(threads);
+            }
+            else {
+                LOG_WARN(g_logger) << "io_uring is not supported by this kernel, fall back to epoll";
+            }
+        }
+
+        // 启动调度器相关操作
+        start();
+    }
+
+    IOManager::~IOManager() {
+        stop(); // 停止调度器
+        for (auto& reactor : m_reactors) {
+            close(reactor->epfd); // 关闭epoll文件描述符
+            close(reactor->eventFd); // 关闭唤醒用的eventfd
+        }
+        m_fdContexts.foreach([](std::atomic<FdContext*>& i) { // 清空任务队列
+            delete i.load();
+        });
+    }
+
+    void IOManager::initReactor(Reactor& reactor) {
         // 创建一个epoll实例，最大文件描述符数量设置为5000
-        m_epfd = epoll_create(5000);
-        // 断言epoll实例创建成功（m_epfd大于0）
-        ASSERT(m_epfd > 0);
+        reactor.epfd = epoll_create(5000);
+        // 断言epoll实例创建成功（epfd大于0）
+        ASSERT(reactor.epfd > 0);
 
-        // 创建一个管道，用于线程间通信等用途
-        int rt = pipe(m_tickleFds);
-        // 断言管道创建成功（返回值为0）
-        ASSERT(!rt);
+        // 创建一个eventfd用于唤醒，多次写入只累加计数，一次read全部取走
+        reactor.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        // 断言eventfd创建成功
+        ASSERT(reactor.eventFd >= 0);
 
         epoll_event event;
         // 将epoll_event结构体清零
         memset(&event, 0, sizeof(epoll_event));
         // 设置关注的事件类型为EPOLLIN（读就绪）和EPOLLET（边缘触发）
         event.events = EPOLLIN | EPOLLET;
-        // 将要监控的文件描述符设置为管道的读端
-        event.data.fd = m_tickleFds[0];
-
-        // 将管道的读端设置为非阻塞模式
-        rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-        // 断言设置非阻塞模式操作成功（返回值为0）
-        ASSERT(!rt);
+        // 将要监控的文件描述符设置为eventfd
+        event.data.fd = reactor.eventFd;
 
-        // 将管道的读端添加到epoll监控列表中
-        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+        // 将eventfd添加到epoll监控列表中
+        int rt = epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, reactor.eventFd, &event);
         // 断言添加操作成功（返回值为0）
         ASSERT(!rt);
+    }
 
-        // 任务队列初始化
-        contextResize(32);
-
-        // 启动调度器相关操作
-        start();
+    IOManager::Reactor* IOManager::bindReactor(FdContext* fd_ctx) {
+        if (fd_ctx->reactor < 0) {
+            int idx = 0;
+            if (m_multiReactor) {
+                // 工作线程上注册的fd留在本线程，外部线程注册的交给最闲的线程
+                idx = inSchedulingLoop() ? getThreadIndex() : leastLoadedReactor();
+            }
+            fd_ctx->reactor = idx;
+            ++m_reactors[idx]->load;
+        }
+        return m_reactors[fd_ctx->reactor].get();
     }
 
-    IOManager::~IOManager() {
-        stop(); // 停止调度器
-        close(m_epfd); // 关闭epoll文件描述符
-        close(m_tickleFds[0]); // 关闭通知管道
-        close(m_tickleFds[1]); // 关闭通知管道
-        for (size_t i = 0; i < m_fdContexts.size(); ++i) { // 清空任务队列
-            if (m_fdContexts[i]) {
-                delete m_fdContexts[i];
+    int IOManager::leastLoadedReactor() const {
+        size_t best = m_firstWorkerReactor;
+        for (size_t i = best + 1; i < m_reactors.size(); ++i) {
+            if (m_reactors[i]->load < m_reactors[best]->load) {
+                best = i;
             }
         }
+        return (int)best;
     }
 
-    void IOManager::contextResize(size_t size) {
-        // 空间换时间，队列的索引值=文件描述符，减少锁的粒度
-        m_fdContexts.resize(size);
+    int IOManager::epollCtl(Reactor* reactor, int op, FdContext* fd_ctx, uint32_t events) {
+        epoll_event epevent;
+        epevent.events = events;
+        epevent.data.ptr = fd_ctx;
+        reactor->ctlCount.fetch_add(1, std::memory_order_relaxed);
+        int rt = epoll_ctl(reactor->epfd, op, fd_ctx->fd, &epevent);
+        if (rt) {
+            LOG_ERROR(g_logger) << "epoll_ctl(" << reactor->epfd << ", "
+                << op << "," << fd_ctx->fd << "," << events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        }
+        return rt;
+    }
 
-        for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-            if (!m_fdContexts[i]) {
-                m_fdContexts[i] = new FdContext;
-                m_fdContexts[i]->fd = i;
-            }
+    int IOManager::eventThread(FdContext* fd_ctx, Event event) {
+        // 只有本IOManager的任务才能绑定到本IOManager的线程上
+        if (!m_multiReactor || fd_ctx->reactor < 0 || fd_ctx->getContext(event).scheduler != this) {
+            return -1;
         }
+        return m_threadIds[fd_ctx->reactor];
     }
 
-    int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb) {
-        // 从事件队列里拿一个（空）事件，拿不到扩容了再拿
-        FdContext* fd_ctx = nullptr;
-        RWMutex::ReadLock lock(m_mutex);
-        if (m_fdContexts.size() > fd) {
-            fd_ctx = m_fdContexts[fd];
-            lock.unlock();
+    int IOManager::assignFd(int fd) {
+        if (!m_multiReactor) {
+            return -1;
         }
-        else {
-            lock.unlock();
-            RWMutex::WriteLock lock2(m_mutex);
-            contextResize(fd * 1.5);
-            fd_ctx = m_fdContexts[fd];
+        FdContext* fd_ctx = getFdContext(fd, true);
+        if (!fd_ctx) {
+            return -1;
+        }
+        Mutex::Lock lock(fd_ctx->mutex);
+        if (fd_ctx->reactor < 0) {
+            fd_ctx->reactor = leastLoadedReactor();
+            ++m_reactors[fd_ctx->reactor]->load;
+        }
+        return m_threadIds[fd_ctx->reactor];
+    }
+
+    void IOManager::setExclusiveWakeup(int fd) {
+        FdContext* fd_ctx = getFdContext(fd, true);
+        if (!fd_ctx) {
+            return;
+        }
+        Mutex::Lock lock(fd_ctx->mutex);
+        fd_ctx->exclusive = true;
+    }
+
+    void IOManager::unbindFd(int fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if (!fd_ctx) {
+            return;
+        }
+        Mutex::Lock lock(fd_ctx->mutex);
+        // 持久注册的fd在关闭前摘掉，fd号被复用时重新登记，残留的就绪状态也一起清掉
+        if (fd_ctx->registered && !fd_ctx->m_events) {
+            epollCtl(m_reactors[fd_ctx->reactor].get(), EPOLL_CTL_DEL, fd_ctx, 0);
+            fd_ctx->registered = false;
+            fd_ctx->ready = NONE;
+        }
+        fd_ctx->exclusive = false;
+        // 还挂着事件说明epoll里仍有登记，不能换reactor
+        if (fd_ctx->reactor >= 0 && !fd_ctx->m_events) {
+            --m_reactors[fd_ctx->reactor]->load;
+            fd_ctx->reactor = -1;
+        }
+    }
+
+    IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create) {
+        // 空间换时间，队列的索引值=文件描述符，减少锁的粒度
+        if (fd < 0) {
+            return nullptr;
+        }
+        std::atomic<FdContext*>* slot = auto_create ? m_fdContexts.getOrCreate(fd) : m_fdContexts.get(fd);
+        if (!slot) {
+            return nullptr;
+        }
+        FdContext* fd_ctx = slot->load(std::memory_order_acquire);
+        if (fd_ctx || !auto_create) {
+            return fd_ctx;
+        }
+        FdContext* fresh = new FdContext;
+        fresh->fd = fd;
+        if (slot->compare_exchange_strong(fd_ctx, fresh, std::memory_order_acq_rel)) {
+            return fresh;
+        }
+        delete fresh; // 别的线程先创建了，fd_ctx已被更新为它创建的那个
+        return fd_ctx;
+    }
+
+    int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb) {
+        // 从事件队列里拿一个（空）事件，没有就创建
+        FdContext* fd_ctx = getFdContext(fd, true);
+        if (!fd_ctx) {
+            return -1;
         }
 
         Mutex::Lock lock2(fd_ctx->mutex);
@@ -93,18 +252,23 @@ namespace Framework {
             ASSERT(!(fd_ctx->m_events & event));
         }
 
-        // 把事件修改到/挂到epoll红黑树上，事件=原有事件按位或新事件
-        int op = fd_ctx->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-        epoll_event epevent;
-        epevent.events = EPOLLET | fd_ctx->m_events | event;
-        epevent.data.ptr = fd_ctx;
-
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << op << "," << fd << "," << epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return -1;
+        Reactor* reactor = bindReactor(fd_ctx);
+        if (m_persistentEpoll) {
+            // 只在第一次等待时登记，读写一起，之后不再修改
+            if (!fd_ctx->registered) {
+                if (epollCtl(reactor, EPOLL_CTL_ADD, fd_ctx, EPOLLIN | EPOLLOUT | EPOLLET | (fd_ctx->exclusive ? EPOLLEXCLUSIVE : 0))) {
+                    return -1;
+                }
+                fd_ctx->registered = true;
+            }
+        }
+        else {
+            // 把事件修改到/挂到epoll红黑树上，事件=原有事件按位或新事件
+            int op = fd_ctx->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            uint32_t flags = (op == EPOLL_CTL_ADD && fd_ctx->exclusive) ? EPOLLEXCLUSIVE : 0;
+            if (epollCtl(reactor, op, fd_ctx, EPOLLET | flags | fd_ctx->m_events | event)) {
+                return -1;
+            }
         }
         ++m_pendingEventCount;
 
@@ -121,17 +285,22 @@ namespace Framework {
             event_ctx.fiber = Fiber::GetThis();
             ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
         }
+
+        // 边沿在没人等的时候已经来过，不会再报一次，直接触发；多半是真的就绪，偶尔是旧的，调用方重试一次会再挂起
+        if (fd_ctx->ready & event) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            fd_ctx->triggerEvent(event, eventThread(fd_ctx, event));
+            --m_pendingEventCount;
+        }
         return 0;
     }
 
     bool IOManager::delEvent(int fd, Event event) {
         // 从事件队列里取出事件（准备删了他），如果超过队列长度，则出错
-        RWMutex::ReadLock lock(m_mutex);
-        if (m_fdContexts.size() <= fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if (!fd_ctx) {
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
 
         Mutex::Lock lock2(fd_ctx->mutex);
         if (!(fd_ctx->m_events & event)) {
@@ -140,17 +309,11 @@ namespace Framework {
 
         // 从m_events里删一个事件，如果读写都被删了，就是删掉红黑树节点，否则是修改
         Event new_events = (Event)(fd_ctx->m_events & ~event);
-        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = EPOLLET | new_events;
-        epevent.data.ptr = fd_ctx;
-
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << op << "," << fd << "," << epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+        if (!m_persistentEpoll) {
+            int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            if (epollCtl(m_reactors[fd_ctx->reactor].get(), op, fd_ctx, EPOLLET | new_events)) {
+                return false;
+            }
         }
 
         --m_pendingEventCount;
@@ -165,12 +328,10 @@ namespace Framework {
     bool IOManager::cancelEvent(int fd, Event event) {
         // cancel和del的不同是，cancel会强制执行事件再删除
         // 从事件队列里取出事件（准备删了他），如果超过队列长度，则出错
-        RWMutex::ReadLock lock(m_mutex);
-        if (m_fdContexts.size() <= fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if (!fd_ctx) {
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
 
         Mutex::Lock lock2(fd_ctx->mutex);
         if (!(fd_ctx->m_events & event)) {
@@ -179,21 +340,15 @@ namespace Framework {
 
         // 从m_events里删一个事件，如果读写都被删了，就是删掉红黑树节点，否则是修改
         Event new_events = (Event)(fd_ctx->m_events & ~event);
-        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = EPOLLET | new_events; // 边缘触发
-        epevent.data.ptr = fd_ctx;
-
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << op << "," << fd << "," << epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+        if (!m_persistentEpoll) {
+            int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            if (epollCtl(m_reactors[fd_ctx->reactor].get(), op, fd_ctx, EPOLLET | new_events)) { // 边缘触发
+                return false;
+            }
         }
 
         // 强制触发事件
-        fd_ctx->triggerEvent(event);
+        fd_ctx->triggerEvent(event, eventThread(fd_ctx, event));
         --m_pendingEventCount;
         return true;
     }
@@ -201,39 +356,32 @@ namespace Framework {
     bool IOManager::cancelAll(int fd) {
         // 删除所有事件：读和写
         // 从事件队列里取出事件（准备删了他），如果超过队列长度，则出错
-        RWMutex::ReadLock lock(m_mutex);
-        if (m_fdContexts.size() <= fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if (!fd_ctx) {
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
+
+        if (fd_ctx->uringOps > 0) {
+            cancelUring(fd);
+        }
 
         Mutex::Lock lock2(fd_ctx->mutex);
         if (!fd_ctx->m_events) {
             return false;
         }
 
-        // 删掉红黑树节点
-        int op = EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = 0;
-        epevent.data.ptr = fd_ctx;
-
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << op << "," << fd << "," << epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        // 删掉红黑树节点（持久注册的留到unbindFd再删）
+        if (!m_persistentEpoll && epollCtl(m_reactors[fd_ctx->reactor].get(), EPOLL_CTL_DEL, fd_ctx, 0)) {
             return false;
         }
 
         // 强制触发事件
         if (fd_ctx->m_events & IOManager::Event::READ) {
-            fd_ctx->triggerEvent(IOManager::Event::READ);
+            fd_ctx->triggerEvent(IOManager::Event::READ, eventThread(fd_ctx, IOManager::Event::READ));
             --m_pendingEventCount;
         }
         if (fd_ctx->m_events & IOManager::Event::WRITE) {
-            fd_ctx->triggerEvent(IOManager::Event::WRITE);
+            fd_ctx->triggerEvent(IOManager::Event::WRITE, eventThread(fd_ctx, IOManager::Event::WRITE));
             --m_pendingEventCount;
         }
 
@@ -241,6 +389,180 @@ namespace Framework {
         return true;
     }
 
+    bool IOManager::canUseUring() const {
+        // 共享栈协程切出后栈被别的协程占用，内核还在往栈上的缓冲区、请求里写数据，只能走epoll
+        return !m_rings.empty() && inSchedulingLoop() && !Fiber::GetThis()->isSharedStack();
+    }
+
+    int IOManager::submitIo(int fd, UringOp& op, uint64_t timeout_ms) {
+        int idx = getThreadIndex();
+        IoUring* ring = m_rings[idx].get();
+        FdContext* fd_ctx = getFdContext(fd, true);
+        if (!fd_ctx) {
+            return -EBADF;
+        }
+
+        UringRequest req;
+        req.fiber = Fiber::GetThis();
+        req.fdOps = &fd_ctx->uringOps;
+        req.ringOps = &m_ringStates[idx].ops;
+        req.pending = timeout_ms != ~0ull ? 2 : 1;
+        __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+        ++fd_ctx->uringOps;
+        ++*req.ringOps;
+        ++m_pendingEventCount;
+        // 超时用链接在后面的LINK_TIMEOUT实现，到时间内核取消前面的操作
+        ring->push(req.pending, [&](io_uring_sqe** sqes) {
+            op.prepare(sqes[0], fd);
+            sqes[0]->user_data = (uint64_t)&req;
+            if (req.pending == 2) {
+                sqes[0]->flags |= IOSQE_IO_LINK;
+                sqes[1]->opcode = IORING_OP_LINK_TIMEOUT;
+                sqes[1]->fd = -1;
+                sqes[1]->addr = (uint64_t)&ts;
+                sqes[1]->len = 1;
+                sqes[1]->user_data = (uint64_t)&req | URING_TIMEOUT_BIT;
+            }
+        });
+        // 与hook的close竞争：close的cancelAll早于上面的计数时不会取消这个操作，fd关掉后它就永远挂着了
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+        if (!ctx || ctx->isClose()) {
+            cancelUring(fd);
+        }
+        // 当前协程的上下文被取消时，让内核取消这一个操作（按user_data匹配），完成后协程照常被收割恢复
+        CancelContext::ptr cancel = Fiber::GetCurrentCancelContext();
+        uint64_t waker = 0;
+        if (cancel) {
+            auto cancel_op = [ring, &req](int) {
+                ring->push(1, [&req](io_uring_sqe** sqes) {
+                    sqes[0]->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqes[0]->fd = -1;
+                    sqes[0]->addr = (uint64_t)&req;
+                    sqes[0]->user_data = URING_IGNORE;
+                });
+                ring->submit();
+            };
+            waker = cancel->addWaker(cancel_op);
+            if (!waker) {
+                cancel_op(0);
+            }
+        }
+        // 完成只会在本线程上被收割（idle里，或者两个任务之间），让出之前不会被恢复
+        Fiber::YieldToHold();
+        if (waker) {
+            cancel->delWaker(waker); // 之后唤醒函数不会再访问栈上的req
+        }
+
+        if (req.res >= 0) {
+            op.complete();
+        }
+        else if (req.timeoutRes == -ETIME) {
+            return -ETIMEDOUT;
+        }
+        else if (req.res == -ECANCELED && cancel && cancel->isDone()) {
+            return -cancel->getError();
+        }
+        return req.res;
+    }
+
+    void IOManager::onUringComplete(io_uring_cqe& cqe) {
+        UringRequest* req = (UringRequest*)(cqe.user_data & ~URING_TIMEOUT_BIT);
+        if (cqe.user_data & URING_TIMEOUT_BIT) {
+            req->timeoutRes = cqe.res;
+        }
+        else {
+            req->res = cqe.res;
+        }
+        // 操作和它的超时两个CQE都收到之后才能恢复协程，否则晚到的那个会访问已经失效的栈
+        if (--req->pending > 0) {
+            return;
+        }
+        --*req->fdOps;
+        --*req->ringOps;
+        --m_pendingEventCount;
+        Fiber::ptr fiber;
+        fiber.swap(req->fiber);
+        schedule(&fiber); // req在协程栈上，调度之后不能再访问
+    }
+
+    void IOManager::cancelUring(int fd) {
+        // 操作可能挂在任何一个线程的io_uring上，逐个提交取消
+        for (auto& ring : m_rings) {
+            ring->push(1, [fd](io_uring_sqe** sqes) {
+                sqes[0]->opcode = IORING_OP_ASYNC_CANCEL;
+                sqes[0]->fd = fd;
+                sqes[0]->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                sqes[0]->user_data = URING_IGNORE;
+            });
+            ring->submit();
+        }
+    }
+
+    bool IOManager::waitUring(size_t idx, Reactor* reactor, int timeout_ms) {
+        IoUring* ring = m_rings[idx].get();
+        RingState& state = m_ringStates[idx];
+        // epoll实例本身也可以poll，把它交给io_uring，IO完成、fd事件、唤醒都能让io_uring_enter返回
+        if (!state.epollArmed) {
+            ring->push(1, [reactor](io_uring_sqe** sqes) {
+                sqes[0]->opcode = IORING_OP_POLL_ADD;
+                sqes[0]->fd = reactor->epfd;
+                sqes[0]->poll32_events = POLLIN;
+                sqes[0]->user_data = URING_EPOLL;
+            });
+            state.epollArmed = true;
+        }
+        ring->submit(true, timeout_ms); // 超时返回-ETIME，被信号打断返回-EINTR，都当作没有事件
+        state.busyTasks = 0;
+        return reapUring(idx);
+    }
+
+    bool IOManager::reapUring(size_t idx) {
+        RingState& state = m_ringStates[idx];
+        bool epoll_ready = false;
+        m_rings[idx]->reap([this, &state, &epoll_ready](io_uring_cqe& cqe) {
+            if (cqe.user_data == URING_EPOLL) {
+                // POLL_ADD是一次性的，下次等待前重新提交；在任务之间收割到时epoll的事件留给idle，重新提交的POLL_ADD会马上完成
+                state.epollArmed = false;
+                epoll_ready = true;
+            }
+            else if (cqe.user_data != URING_IGNORE) {
+                onUringComplete(cqe);
+            }
+        });
+        return epoll_ready;
+    }
+
+    bool IOManager::canPark() {
+        // 多reactor模式下fd绑定在线程上；本线程io_uring上的操作、私有的定时器也只有本线程会收割
+        if (m_multiReactor || hasLocalTimers()) {
+            return false;
+        }
+        int idx = getThreadIndex();
+        return m_ringStates.empty() || idx < 0 || m_ringStates[idx].ops == 0;
+    }
+
+    void IOManager::pollBetweenTasks() {
+        int idx = getThreadIndex();
+        if (m_ringStates.empty() || idx < 0 || m_ringStates[idx].ops == 0) {
+            return;
+        }
+        // 线程忙着执行任务时不会进idle，本线程io_uring上的操作没人提交、没人收割，挂起的协程恢复不了
+        // 攒下的SQE每URING_BUSY_SUBMIT_TASKS个任务提交一次，仍然几个任务的IO合并成一次系统调用；
+        // 收割前只比较一下CQ环的头尾，没有完成的就什么都不做
+        IoUring* ring = m_rings[idx].get();
+        RingState& state = m_ringStates[idx];
+        if (ring->pending() && ++state.busyTasks >= URING_BUSY_SUBMIT_TASKS) {
+            ring->submit();
+            state.busyTasks = 0;
+        }
+        if (ring->hasCompletions()) {
+            reapUring(idx);
+        }
+    }
+
     IOManager* IOManager::GetThis() {
         return dynamic_cast<IOManager*>(Scheduler::GetThis());
     }
@@ -264,15 +586,15 @@ namespace Framework {
         ctx.cb = nullptr;
     }
 
-    void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+    void IOManager::FdContext::triggerEvent(IOManager::Event event, int thread) {
         ASSERT(m_events & event);
         m_events = (Event)(m_events & ~event);
         EventContext& ctx = getContext(event);
         if (ctx.cb) {
-            ctx.scheduler->schedule(&ctx.cb); // 传递地址自动被swap掉，所有权被move了
+            ctx.scheduler->schedule(&ctx.cb, thread); // 传递地址自动被swap掉，所有权被move了
         }
         else {
-            ctx.scheduler->schedule(&ctx.fiber);
+            ctx.scheduler->schedule(&ctx.fiber, thread);
         }
         ctx.scheduler = nullptr; // 调度器使用完成，置空
     }
@@ -280,13 +602,104 @@ namespace Framework {
 
 // 实现父类虚函数
 namespace Framework {
-    // 向管道写数据，如果有空闲线程或者陷入epoll wait的线程，则唤醒这个线程执行任务
+    // 写eventfd，如果有空闲线程或者陷入epoll wait的线程，则唤醒这个线程执行任务
     void IOManager::tickle() {
         if (!hasIdleThreads()) {
             return;
         }
-        int rt = write(m_tickleFds[1], "T", 1);
-        ASSERT(rt == 1);
+        if (!m_multiReactor) {
+            wakeReactor(0);
+            return;
+        }
+        // 每个线程睡在自己的epoll上，从上次的位置往后找一个空闲的线程唤醒
+        int self = inSchedulingLoop() ? getThreadIndex() : -1;
+        size_t n = m_reactors.size();
+        size_t start = m_tickleCursor++;
+        for (size_t i = 0; i < n; ++i) {
+            size_t idx = (start + i) % n;
+            if ((int)idx != self && isThreadIdle(idx)) {
+                wakeReactor(idx);
+                return;
+            }
+        }
+    }
+
+    void IOManager::tickleThread(int thread) {
+        if (!m_multiReactor || thread == -1) {
+            tickle();
+            return;
+        }
+        if (thread == (int)GetThreadId()) {
+            return; // 本线程处理完手头的任务自然会去取
+        }
+        int idx = getQueueIndex(thread);
+        if (idx < 0) {
+            tickle();
+        }
+        else if (isThreadIdle(idx)) {
+            wakeReactor(idx);
+        }
+    }
+
+    void IOManager::wakeReactor(size_t idx) {
+        Reactor* reactor = m_reactors[idx].get();
+        reactor->tickleNeeded.fetch_add(1, std::memory_order_relaxed);
+        // 上一次的唤醒还没被消费，对方醒来后会去取任务，不必再写
+        if (reactor->signaled.exchange(true)) {
+            return;
+        }
+        reactor->tickleSent.fetch_add(1, std::memory_order_relaxed);
+        uint64_t one = 1;
+        int rt = write(reactor->eventFd, &one, sizeof(one));
+        ASSERT(rt == sizeof(one));
+    }
+
+    uint64_t IOManager::getTickleNeeded() const {
+        uint64_t total = 0;
+        for (auto& reactor : m_reactors) {
+            total += reactor->tickleNeeded.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t IOManager::getTickleSent() const {
+        uint64_t total = 0;
+        for (auto& reactor : m_reactors) {
+            total += reactor->tickleSent.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t IOManager::getEpollCtlCount() const {
+        uint64_t total = 0;
+        for (auto& reactor : m_reactors) {
+            total += reactor->ctlCount.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t IOManager::getEpollWaitCount() const {
+        uint64_t total = 0;
+        for (auto& reactor : m_reactors) {
+            total += reactor->waitCount.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t IOManager::getBusyPollSpins() const {
+        uint64_t total = 0;
+        for (auto& reactor : m_reactors) {
+            total += reactor->pollSpins.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t IOManager::getBusyPollHits() const {
+        uint64_t total = 0;
+        for (auto& reactor : m_reactors) {
+            total += reactor->pollHits.load(std::memory_order_relaxed);
+        }
+        return total;
     }
 
     // 满足父类的停止条件，且未解决的事件为0，即可停止
@@ -297,24 +710,101 @@ namespace Framework {
 
     bool IOManager::stopping(uint64_t& timer) {
         timer = getNextTimer();
-        return timer == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+        // getNextTimer只看得到本线程能触发的定时器，其他线程私有的定时器用hasTimer判断
+        return timer == ~0ull && !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
+    }
+
+    static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // 空闲自旋的时长：最近平均空闲间隔的两倍，间隔达到上限说明任务来得稀疏，自旋只是白白占着CPU
+    static uint64_t BusyPollWindow(uint64_t max_us, uint64_t avg_gap_us) {
+        static const uint64_t MIN_SPIN_US = 5;
+        if (!max_us || avg_gap_us >= max_us) {
+            return 0;
+        }
+        return std::min(max_us, avg_gap_us * 2 + MIN_SPIN_US);
     }
 
     void IOManager::idle() {
-        epoll_event* events = new epoll_event[64]();
+        epoll_event* events = new epoll_event[MAX_EVENTS]();
         std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) {
             delete[] ptr;
         }); // 智能指针不一定支持数组，必须显式指定自定义删除器​（如 delete[]）
+        bindThreadTimers(); // 开启timer.per_thread时，本线程之后添加的定时器都归本线程所有
+        Reactor* reactor = m_reactors[m_multiReactor ? getThreadIndex() : 0].get();
+        IoUring* ring = m_rings.empty() ? nullptr : m_rings[getThreadIndex()].get();
+        uint64_t avg_gap_us = 0; // 最近的空闲间隔（进入idle到有任务/事件），指数平均
+
+        // 等一次事件，timeout_ms为0时只是轮询
+        auto wait_events = [&](int timeout_ms) {
+            reactor->waitCount.fetch_add(1, std::memory_order_relaxed);
+            if (ring) {
+                // 先在io_uring上等，epoll可读时再非阻塞地取出事件
+                return waitUring(getThreadIndex(), reactor, timeout_ms) ? epoll_wait(reactor->epfd, events, MAX_EVENTS, 0) : 0;
+            }
+            return epoll_wait(reactor->epfd, events, MAX_EVENTS, timeout_ms); // 等待事件，没有事件超时后自动唤醒
+        };
 
         while (true) {
             uint64_t next_timeout = 0;
 			if (stopping(next_timeout)) {
 				LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+                unbindThreadTimers();
 				break;
 			}
            
             int rt = 0;
-            do {
+            uint64_t idle_begin = GetCurrentUS();
+            // 在这之前有线程空闲着等这个reactor，那时已经就绪的事件会被它取走
+            uint64_t seen_idle = isAdmissionControl() ? reactor->lastIdleUs.exchange(idle_begin, std::memory_order_relaxed) : 0;
+            bool ready = false; // 自旋期间等到了任务或事件，不用再阻塞
+            uint64_t spin_us = BusyPollWindow(m_busyPollUs, avg_gap_us);
+            if (spin_us) {
+                // 定时器快到了就只自旋到那时
+                if (next_timeout != ~0ull && next_timeout * 1000 < spin_us) {
+                    spin_us = next_timeout * 1000;
+                }
+                reactor->pollSpins.fetch_add(1, std::memory_order_relaxed);
+                uint64_t tickles = reactor->tickleNeeded.load();
+                bool got_task = false;
+                reactor->signaled = true; // 醒着的线程不需要eventfd唤醒，生产者只做一次原子交换
+                do {
+                    if (hasRunnableTask()) {
+                        ready = got_task = true;
+                        break;
+                    }
+                    rt = wait_events(0);
+                    if (rt > 0) {
+                        ready = true;
+                        break;
+                    }
+                    CpuRelax();
+                } while (GetCurrentUS() - idle_begin < spin_us);
+                reactor->signaled = false;
+                if (!ready && hasRunnableTask()) {
+                    ready = got_task = true; // 清标记之前被合并掉的唤醒，补查一次
+                }
+                if (ready) {
+                    reactor->pollHits.fetch_add(1, std::memory_order_relaxed);
+                    // 自旋时合并掉了好几个任务的唤醒，本线程只能先处理一个，剩下的交给睡着的线程
+                    // 多reactor时投给本线程的任务别的线程执行不了，不需要转交
+                    uint64_t merged = reactor->tickleNeeded.load() - tickles;
+                    if (!m_multiReactor && merged > (got_task ? 1u : 0u)) {
+                        tickle();
+                    }
+                }
+                if (rt < 0) {
+                    rt = 0;
+                }
+            }
+
+            while (!ready) {
                 static const int MAX_TIMEOUT = 5000; // epoll支持毫秒级粒度，设置定时器也只需设置成毫秒级即可
 
                 // Timer
@@ -325,14 +815,42 @@ namespace Framework {
                     next_timeout = MAX_TIMEOUT;
                 }
 
-                rt = epoll_wait(m_epfd, events, 64, (int)next_timeout); // 等待事件，没有事件超时后自动唤醒
-
+                rt = wait_events((int)next_timeout);
                 if (rt < 0 && errno == EINTR) { // 如果没有等待到事件，或只是操作系统的中断事件，则继续等待
                 }
                 else {
                     break; // 有事件，则退出这层循环
                 }
-            } while (true);
+            }
+
+            uint64_t ready_time = 0; // 这次取出的fd事件按这个时间入队，0表示按当前时间
+            if (isAdmissionControl()) {
+                /*
+                线程都在忙时没人等epoll，事件就绪后先在内核里等着，这段时间也要算进排队时间，否则过载时
+                每批事件刚取出来排队时间都很短，看不出过载。等待马上返回说明事件在调用之前就已经就绪，
+                最早可能在上一次取空这个reactor、或者上一次有线程空闲着等它之后就绪，按其中较晚的时间入队（setEnqueueTime里再封顶）；
+                一次取满MAX_EVENTS个说明还有没取完的，它们在这次之前就已经就绪，不更新取空的时间。
+                真的阻塞过说明事件是刚发生的，调度队列也已经空了，解除过载
+                只用于这次取出的fd事件，到期的定时器回调按放进调度队列的时间算
+                */
+                uint64_t now = GetCurrentUS();
+                uint64_t last = reactor->lastDrainUs.load(std::memory_order_relaxed);
+                if (rt < MAX_EVENTS) {
+                    reactor->lastDrainUs.store(now, std::memory_order_relaxed);
+                }
+                if (now - idle_begin < POLL_IMMEDIATE_US) {
+                    ready_time = std::max(last, seen_idle);
+                }
+                else {
+                    resetQueueDelay();
+                }
+            }
+
+            if (m_busyPollUs) {
+                // 过长的间隔截断，负载回升后几轮就能重新开始自旋
+                uint64_t gap = std::min<uint64_t>(GetCurrentUS() - idle_begin, (uint64_t)m_busyPollUs * 4);
+                avg_gap_us = (avg_gap_us * 7 + gap) / 8;
+            }
 
             // Timer task
             std::vector<std::function<void()> > cbs;
@@ -341,18 +859,21 @@ namespace Framework {
                 schedule(cbs.begin(), cbs.end());
                 cbs.clear();
             }
+            if (ready_time) {
+                setEnqueueTime(ready_time);
+            }
 
             // 对于epoll_wait获取的所有事件做操作
             for (int i = 0; i < rt; ++i) {
                 epoll_event& event = events[i];
-                if (event.data.fd == m_tickleFds[0]) {
-                    uint8_t dummy;
-                    while (read(m_tickleFds[0], &dummy, 1) == 1);
-                    /*在 ET 模式下，如果文件描述符可读，epoll 只会通知一次。
-                    如果应用程序没有一次性读取完所有数据，后续即使有更多数据到达，epoll 也不会再次通知，除非文件描述符的状态再次发生变化（比如又有新数据写入）。
-                    因此，在 ET 模式下，通常需要循环读取直到 read 返回 EAGAIN 或 EWOULDBLOCK，以确保所有数据都被处理。
-                    尽管 tickle fd 通常只写入 1 字节，但也需要while循环保证管道被清空。*/
-                    continue; // 如果是管道通知事件，则直接继续
+                if (event.data.fd == reactor->eventFd) {
+                    // 先读再清标记：反过来的话，清标记和read之间写入的唤醒会被这次read吃掉，
+                    // 标记却留在true，之后的唤醒全被当成重复的跳过
+                    // 读完到清标记之间被跳过的唤醒不会丢，本线程已经醒着，回到调度循环就会去取任务
+                    uint64_t dummy;
+                    read(reactor->eventFd, &dummy, sizeof(dummy)); // 一次read就把计数清零
+                    reactor->signaled = false;
+                    continue; // 如果是唤醒通知事件，则直接继续
                 }
 
                 FdContext* fd_ctx = (FdContext*)event.data.ptr;
@@ -368,35 +889,41 @@ namespace Framework {
                     real_events |= IOManager::Event::WRITE;
                 }
 
+                if (m_persistentEpoll) {
+                    // 没人等的事件记下来，边沿只报一次，等下次addEvent时用
+                    fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->m_events));
+                    real_events &= fd_ctx->m_events;
+                }
+
                 // 如果epoll红黑树上挂载的事件和epoll wait返回的待执行事件没有交集，例如我挂载读事件，但是epoll返回的是EPOLLOUT写事件，那么就无需执行任何操作
                 if ((fd_ctx->m_events & real_events) == IOManager::Event::NONE) {
                     continue;
                 }
 
                 // 如果这个epoll wait等来的事件是我需要处理的话，则需要把它从epoll红黑树上修改（如果所有事件都取出则是摘下）
-                int left_events = (fd_ctx->m_events & ~real_events);
-                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-                event.events = EPOLLET | left_events;
-
-                int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-                if (rt2) {
-                    LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                        << op << "," << fd_ctx->fd << "," << event.events << ");"
-                        << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                    continue;
+                if (!m_persistentEpoll) {
+                    // EPOLLERR/EPOLLHUP补上的读写事件里可能有没登记的那一个，不能触发
+                    real_events &= fd_ctx->m_events;
+                    int left_events = (fd_ctx->m_events & ~real_events);
+                    int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                    if (epollCtl(reactor, op, fd_ctx, EPOLLET | left_events)) {
+                        continue;
+                    }
                 }
 
                 // 最后，有读事件解决读事件，有写事件解决写事件
                 if (real_events & IOManager::Event::READ) {
-                    fd_ctx->triggerEvent(IOManager::Event::READ);
+                    fd_ctx->triggerEvent(IOManager::Event::READ, eventThread(fd_ctx, IOManager::Event::READ));
                     --m_pendingEventCount;
                 }
                 if (real_events & IOManager::Event::WRITE) {
-                    fd_ctx->triggerEvent(IOManager::Event::WRITE);
+                    fd_ctx->triggerEvent(IOManager::Event::WRITE, eventThread(fd_ctx, IOManager::Event::WRITE));
                     --m_pendingEventCount;
                 }
             }
 
+            setEnqueueTime(0);
+
             // 处理完for循环里的所有事件之后，让出执行权到协程调度框架
             Fiber::ptr cur = Fiber::GetThis();
             auto raw_ptr = cur.get();
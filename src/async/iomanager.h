@@ -1,7 +1,9 @@
 #pragma once
 
 #include "scheduler.h"
+#include "segmented_array.h"
 #include "timer.h"
+#include "uring.h"
 
 namespace Framework {
     class IOManager : public Scheduler, public TimerManager {
@@ -25,11 +27,36 @@ namespace Framework {
             EventContext write;    //写事件
             int fd = 0;                //事件关联的句柄
             Event m_events = NONE; //已经注册的事件
+            int reactor = -1;      //fd绑定的reactor下标，-1表示还没绑定
+            std::atomic<int> uringOps = { 0 }; //还在io_uring里没完成的操作数
+            // 持久注册模式：fd是否已经以EPOLLIN|EPOLLOUT|EPOLLET登记在epoll里，以及epoll报告过、还没有协程消费的就绪事件
+            bool registered = false;
+            Event ready = NONE;
+            bool exclusive = false; // 以EPOLLEXCLUSIVE登记
+
             Mutex mutex;
 
             EventContext& getContext(Event event);
             void resetContext(EventContext& ctx);
-            void triggerEvent(Event event);
+            // thread不为-1时，本IOManager的事件绑定到该线程上执行
+            void triggerEvent(Event event, int thread = -1);
+        };
+
+        // 一个epoll实例及其唤醒用的eventfd
+        struct Reactor {
+            int epfd = -1;
+            int eventFd = -1;
+            // eventfd已经写过、但等待的线程还没醒来消费，这期间的唤醒都合并到这一次里
+            std::atomic<bool> signaled = { false };
+            std::atomic<size_t> load = { 0 }; // 绑定在这个reactor上的fd数量
+            std::atomic<uint64_t> tickleNeeded = { 0 }; // 需要唤醒的次数
+            std::atomic<uint64_t> tickleSent = { 0 };   // 实际写eventfd的次数
+            std::atomic<uint64_t> ctlCount = { 0 };     // 为fd调用epoll_ctl的次数
+            std::atomic<uint64_t> waitCount = { 0 };    // 调用epoll_wait的次数
+            std::atomic<uint64_t> pollSpins = { 0 };    // 空闲时先自旋轮询的次数
+            std::atomic<uint64_t> pollHits = { 0 };     // 自旋期间等到了任务或事件、不用睡眠的次数
+            std::atomic<uint64_t> lastDrainUs = { 0 };  // 最近一次把就绪事件全部取完的时间，开启过载判断时才记录
+            std::atomic<uint64_t> lastIdleUs = { 0 };   // 最近一次有线程进入空闲、开始等这个reactor的时间，同上
         };
     public:
         IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
@@ -40,26 +67,112 @@ namespace Framework {
         bool delEvent(int fd, Event event);
         bool cancelEvent(int fd, Event event);
 
+        // 同时取消这个fd上所有还在io_uring里的操作
         bool cancelAll(int fd);
 
+        // 当前协程能否走io_uring（开启了iomanager.io_uring、内核支持、当前线程正在调度循环里，且不在共享栈上）
+        bool canUseUring() const;
+        // 通过当前线程的io_uring执行一次IO，挂起当前协程直到完成，timeout_ms为~0ull表示不超时
+        // 返回值同系统调用，失败返回-errno，超时返回-ETIMEDOUT
+        int submitIo(int fd, UringOp& op, uint64_t timeout_ms);
+
+        // fd之后的登记都带EPOLLEXCLUSIVE：多个epoll实例（或同一监听socket dup出的多个fd）同时等待时，一次就绪只唤醒其中一个
+        // 只能用于不会同时等待读写的fd（监听socket），EPOLLEXCLUSIVE不允许EPOLL_CTL_MOD；fd关闭时失效
+        void setExclusiveWakeup(int fd);
+
+        // 多reactor模式下把fd绑定到负载最低的工作线程，返回该线程id，之后应把处理这个fd的任务调度到该线程
+        // 已经绑定的fd保持原绑定；单epoll模式返回-1
+        int assignFd(int fd);
+        // fd关闭时解除绑定，fd号被复用时重新选择reactor
+        void unbindFd(int fd);
+        bool isMultiReactor() const { return m_multiReactor; }
+        // 唤醒统计（所有reactor之和）：需要唤醒空闲线程的次数，以及合并后实际写eventfd的次数
+        uint64_t getTickleNeeded() const;
+        uint64_t getTickleSent() const;
+        // epoll系统调用统计（所有reactor之和）
+        uint64_t getEpollCtlCount() const;
+        uint64_t getEpollWaitCount() const;
+        // 空闲自旋统计（所有reactor之和）
+        uint64_t getBusyPollSpins() const;
+        uint64_t getBusyPollHits() const;
+        bool isPersistentEpoll() const { return m_persistentEpoll; }
+
         static IOManager* GetThis();
     protected:
         void tickle() override;
+        void tickleThread(int thread) override;
         bool stopping() override;
         void idle() override;
 
         void onTimerInsertedAtFront() override;
+        bool isTimerThread() override { return inSchedulingLoop(); }
+        bool canPark() override;
+        void pollBetweenTasks() override;
 
-        void contextResize(size_t size); // 重置事件队列大小
+        // fd对应的事件上下文，auto_create时不存在就创建，否则不存在返回nullptr
+        FdContext* getFdContext(int fd, bool auto_create);
         bool hasIdleThreads() { return m_idleThreadCount > 0; }
         bool stopping(uint64_t& timer);
     private:
-        int m_epfd = 0;
-        int m_tickleFds[2]; // 通知的pipe管道
+        void initReactor(Reactor& reactor);
+        // fd所在的reactor，还没绑定时选一个绑定上，需持有fd_ctx->mutex
+        Reactor* bindReactor(FdContext* fd_ctx);
+        int leastLoadedReactor() const;
+        // 对fd调用epoll_ctl并计数，失败时打日志，返回epoll_ctl的结果
+        int epollCtl(Reactor* reactor, int op, FdContext* fd_ctx, uint32_t events);
+        // 事件触发后应当在哪个线程上恢复，-1表示任意线程
+        int eventThread(FdContext* fd_ctx, Event event);
+        void wakeReactor(size_t idx);
+        // io_uring模式下的等待：提交攒下的SQE，等IO完成、epoll可读或超时，返回epoll是否可读
+        bool waitUring(size_t idx, Reactor* reactor, int timeout_ms);
+        // 收割idx号io_uring上已经完成的CQE，恢复对应的协程，返回epoll是否可读
+        bool reapUring(size_t idx);
+        void onUringComplete(io_uring_cqe& cqe);
+        void cancelUring(int fd);
+    private:
+        /*
+        iomanager.multi_reactor=false（默认）：所有线程共用m_reactors[0]，哪个线程等到事件就由哪个线程调度
+        iomanager.multi_reactor=true：每个调度线程一个epoll实例（下标与m_threadIds一致），
+            fd第一次注册事件时绑定到当前工作线程（外部线程注册则选负载最低的），直到fd关闭都不变，
+            这个fd的事件只由所属线程等待，唤醒的协程/回调也绑定在所属线程上执行，避免连接在线程间来回迁移
+        */
+        bool m_multiReactor = false;
+        std::vector<std::unique_ptr<Reactor> > m_reactors;
+        size_t m_firstWorkerReactor = 0; // use_caller时0号reactor属于主线程，只有stop()里才会等待，不参与分配
+        std::atomic<size_t> m_tickleCursor = { 0 }; // 轮流唤醒空闲reactor
+
+        /*
+        iomanager.persistent_epoll=false（默认）：协程挂起时ADD/MOD感兴趣的事件，事件触发或取消后再MOD/DEL，每次阻塞的读写都要改epoll
+        iomanager.persistent_epoll=true：fd第一次等待时以EPOLLIN|EPOLLOUT|EPOLLET登记一次，直到关闭（unbindFd）才删除
+            epoll报告的事件没人等就记在FdContext::ready里，之后的addEvent看到就绪直接唤醒，挂起/唤醒都不再调用epoll_ctl
+        */
+        bool m_persistentEpoll = false;
+
+        /*
+        iomanager.busy_poll_us=0（默认）：队列一空就睡进epoll_wait，下一个任务/事件要付一次eventfd写和线程唤醒
+        iomanager.busy_poll_us>0：idle()先自旋轮询任务队列和epoll_wait(0)，最多这么多微秒，等不到再阻塞
+            自旋窗口按本线程最近的空闲间隔自适应：间隔短（负载高）时自旋到间隔的两倍，间隔超过上限（负载低）时不自旋
+            自旋期间reactor视为已唤醒，生产者不写eventfd
+        */
+        uint32_t m_busyPollUs = 0;
+
+        /*
+        iomanager.io_uring=true且内核支持时，每个调度线程一个io_uring（下标与m_threadIds一致），否则为空、全部走epoll
+        hook的读写直接提交给本线程的io_uring，协程挂起，完成后带着结果恢复，不需要先试探也不需要epoll_ctl
+        SQE不马上提交，本线程空闲时连同epoll的等待一起用一次io_uring_enter提交，一轮循环里的IO合并成一次系统调用
+        线程一直有任务做、进不了idle时，在任务之间收割已经完成的CQE，攒下的SQE每隔几个任务提交一次（pollBetweenTasks）
+        */
+        struct RingState {
+            size_t ops = 0;           // 还没完成的操作数
+            bool epollArmed = false;  // epoll实例的POLL_ADD是否还挂在io_uring上
+            uint32_t busyTasks = 0;   // 有SQE攒着没提交时，又执行了多少个任务
+        };
+        std::vector<IoUring::ptr> m_rings;
+        std::vector<RingState> m_ringStates; // 下标与m_rings一致，只有所属线程读写
 
         std::atomic<size_t> m_pendingEventCount = { 0 }; // 等待执行的事件数量
-        RWMutex m_mutex; // IO调度器的读写锁
-        std::vector<FdContext*> m_fdContexts; // 事件队列
+        // 事件队列，下标=文件描述符；分段惰性分配、不会移动，查找不加锁，FdContext创建后直到IOManager析构才释放
+        SegmentedArray<std::atomic<FdContext*> > m_fdContexts;
     };
 
 
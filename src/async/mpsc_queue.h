@@ -0,0 +1,80 @@
+#pragma once
+// 无锁多生产者单消费者队列（Vyukov intrusive MPSC）
+
+#include <stddef.h>
+
+#include <atomic>
+
+#include "noncopyable.h"
+
+namespace Framework {
+    // 侵入式节点，需要入队的对象继承它即可，入队不会额外申请内存
+    struct MpscNode {
+        std::atomic<MpscNode*> next = { nullptr };
+    };
+
+    /*
+    push：任意线程并发调用，一次exchange + 一次store，无锁、不会阻塞
+    pop：同一时刻只能有一个消费者（由调用方保证，例如持有某把锁）
+    生产者exchange完m_head、还没来得及链接next的瞬间，消费者会看到队列“暂时为空”，此时pop返回nullptr，稍后再取即可
+    这个窗口通常只有一条指令，但生产者恰好在这里被抢占时可能持续一个调度周期，它后面入队的节点也都取不到，用pending()区分
+    */
+    class MpscQueue : private Noncopyable {
+    public:
+        MpscQueue()
+            : m_head(&m_stub), m_tail(&m_stub) {
+        }
+
+        void push(MpscNode* node) {
+            pushNode(node);
+        }
+
+        MpscNode* pop() {
+            MpscNode* tail = m_tail;
+            MpscNode* next = tail->next.load(std::memory_order_acquire);
+            if (tail == &m_stub) { // 跳过哨兵节点
+                if (!next) {
+                    return nullptr;
+                }
+                m_tail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next) {
+                m_tail = next;
+                return tail;
+            }
+            if (tail != m_head.load(std::memory_order_acquire)) {
+                return nullptr; // 有生产者正在入队
+            }
+            // tail是最后一个节点，把哨兵重新放回队尾，才能把tail取出来
+            pushNode(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next) {
+                m_tail = next;
+                return tail;
+            }
+            return nullptr;
+        }
+
+        // 只能由消费者调用；生产者入队到一半时也会返回true
+        bool empty() const {
+            return m_tail == &m_stub && !m_stub.next.load(std::memory_order_acquire);
+        }
+
+        // 只能由消费者在pop返回nullptr之后调用：true表示有生产者入队到一半，队列并不是真的空了
+        bool pending() const {
+            return m_head.load(std::memory_order_acquire) != m_tail;
+        }
+    private:
+        void pushNode(MpscNode* node) {
+            node->next.store(nullptr, std::memory_order_relaxed);
+            MpscNode* prev = m_head.exchange(node, std::memory_order_acq_rel);
+            prev->next.store(node, std::memory_order_release);
+        }
+    private:
+        std::atomic<MpscNode*> m_head; // 生产者端
+        MpscNode* m_tail;              // 消费者端
+        MpscNode m_stub;
+    };
+}
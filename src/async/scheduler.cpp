@@ -1,5 +1,10 @@
+#include <sched.h>
+
+#include <algorithm>
 #include <vector>
 
+#include "config.h"
+#include "cpu_affinity.h"
 #include "hook.h"
 #include "log.h"
 #include "macro.h"
@@ -10,6 +15,91 @@ namespace Framework {
 
 	static thread_local Scheduler* t_scheduler = nullptr; // 当前线程关联的调度器
 	static thread_local Fiber* t_fiber = nullptr; // 当前线程正在执行的协程(当前协程)
+	static thread_local int t_queueIndex = -1; // 当前线程在所属调度器中的本地队列下标
+	static thread_local Scheduler* t_running = nullptr; // 当前线程正在执行哪个调度器的run()
+	static thread_local uint64_t t_taskDelay = 0; // 当前任务的排队时间（微秒），任务切出后清零
+	static thread_local uint64_t t_enqueueTime = 0; // 非0时作为本线程入队任务的入队时间
+
+    static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+        Config::Lookup<bool>("scheduler.work_stealing", false, "scheduler per-thread run queues with work stealing");
+    static ConfigVar<uint32_t>::ptr g_scheduler_priority_aging =
+        Config::Lookup<uint32_t>("scheduler.priority_aging", 8, "run a waiting lower priority task after this many higher priority ones, 0 means strict priority");
+    static ConfigVar<std::string>::ptr g_scheduler_cpu_affinity =
+        Config::Lookup<std::string>("scheduler.cpu_affinity", "", "cpu list the scheduler worker threads are pinned to one by one, e.g. 0-3,8-11, empty means no pinning");
+    static ConfigVar<bool>::ptr g_scheduler_numa_aware =
+        Config::Lookup<bool>("scheduler.numa_aware", false, "group scheduler worker threads per numa node and prefer node local memory");
+    static ConfigVar<uint32_t>::ptr g_scheduler_elastic_min_threads =
+        Config::Lookup<uint32_t>("scheduler.elastic_min_threads", 0, "park idle worker threads down to this many running ones, 0 disables elastic scaling");
+    static ConfigVar<uint32_t>::ptr g_scheduler_elastic_max_threads =
+        Config::Lookup<uint32_t>("scheduler.elastic_max_threads", 0, "worker threads created when elastic scaling is on, the ones beyond the constructor's count start parked, 0 means the constructor's count");
+    static ConfigVar<uint32_t>::ptr g_scheduler_elastic_park_idle_ms =
+        Config::Lookup<uint32_t>("scheduler.elastic_park_idle_ms", 1000, "park a worker thread after it has found no task for this long");
+    static ConfigVar<uint32_t>::ptr g_scheduler_elastic_unpark_queue =
+        Config::Lookup<uint32_t>("scheduler.elastic_unpark_queue", 16, "unpark a worker thread when no thread is idle and this many tasks are queued");
+    static ConfigVar<uint32_t>::ptr g_scheduler_codel_target_ms =
+        Config::Lookup<uint32_t>("scheduler.codel_target_ms", 0, "report overload once task queueing delay stays at or above this for a whole interval, 0 disables admission control");
+    static ConfigVar<uint32_t>::ptr g_scheduler_codel_interval_ms =
+        Config::Lookup<uint32_t>("scheduler.codel_interval_ms", 100, "how long queueing delay must stay above the target before reporting overload");
+
+    // 工作线程的放置：绑定的CPU（空表示不绑定）和所属的NUMA节点（-1表示不设置内存策略）
+    struct ThreadPlacement {
+        std::vector<int> cpus;
+        int node = -1;
+    };
+
+    /*
+    只配置scheduler.cpu_affinity：第i个线程绑到列表里第i个CPU上（线程比CPU多时循环使用）
+    开启scheduler.numa_aware：线程按顺序整块分给各个节点，同一节点的线程编号相邻；
+    配置了CPU列表时只用列表里的CPU，每个线程绑一个核，否则绑到整个节点，由内核在节点内调度
+    */
+    static std::vector<ThreadPlacement> PlanThreadPlacement(size_t count) {
+        std::vector<ThreadPlacement> plan(count);
+        const std::string& list = g_scheduler_cpu_affinity->getValue();
+        std::vector<int> cpus = ParseCpuList(list);
+        if (!list.empty() && cpus.empty()) {
+            LOG_WARN(g_logger) << "invalid scheduler.cpu_affinity: " << list;
+        }
+        if (!g_scheduler_numa_aware->getValue()) {
+            for (size_t i = 0; i < count && !cpus.empty(); ++i) {
+                plan[i].cpus.push_back(cpus[i % cpus.size()]);
+            }
+            return plan;
+        }
+
+        std::vector<NumaNode> nodes;
+        for (auto& node : GetNumaTopology()) {
+            if (!cpus.empty()) {
+                std::vector<int> used;
+                for (int cpu : node.cpus) {
+                    if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+                        used.push_back(cpu);
+                    }
+                }
+                node.cpus.swap(used);
+            }
+            if (!node.cpus.empty()) {
+                nodes.push_back(node);
+            }
+        }
+        if (nodes.empty()) {
+            LOG_WARN(g_logger) << "no numa node left for scheduler.cpu_affinity: " << list;
+            return plan;
+        }
+        size_t n = nodes.size();
+        for (size_t i = 0; i < count; ++i) {
+            size_t k = i * n / count;
+            size_t first = (k * count + n - 1) / n; // 分到节点k的第一个线程
+            const NumaNode& node = nodes[k];
+            if (cpus.empty()) {
+                plan[i].cpus = node.cpus;
+            }
+            else {
+                plan[i].cpus.push_back(node.cpus[(i - first) % node.cpus.size()]);
+            }
+            plan[i].node = node.id;
+        }
+        return plan;
+    }
 
     Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name) 
         :m_name(name){
@@ -21,17 +111,47 @@ namespace Framework {
 
             ASSERT(GetThis() == nullptr); // 确保本线程不能已经拥有一个调度器
             t_scheduler = this; // 当前线程的调度器就是正在构造的这个 Scheduler 对象
-            m_rootFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, true)); // 设置调度器主协程
+            m_rootFiber.reset(new Fiber(std::bind(&Scheduler::run, this, nullptr), 0, true)); // 设置调度器主协程
             Multithread::SetName(m_name);
             
             t_fiber = m_rootFiber.get(); // 当前线程正在执行的协程就是调度器主协程
             m_rootThread = GetThreadId(); // 设置调度器主线程
             m_threadIds.push_back(m_rootThread);
+            t_queueIndex = 0;
         }
         else {
             m_rootThread = -1;
         }
         m_threadCount = threads;
+
+        /*
+        弹性线程数：按elastic_max_threads建好全部线程，初始只让构造参数指定的数量（不少于下限）运行，其余停放；
+        之后空闲够久的线程停放自己，积压任务时再唤醒。线程只是睡在信号量上，不会真的退出和重建，
+        本地队列、reactor、io_uring等按线程下标建好的结构都不受影响
+        */
+        m_minThreads = g_scheduler_elastic_min_threads->getValue();
+        if (m_minThreads) {
+            m_threadCount = std::max<size_t>(threads, g_scheduler_elastic_max_threads->getValue());
+            m_initialThreads = std::min(std::max(threads, m_minThreads), m_threadCount);
+            m_parkIdleMs = g_scheduler_elastic_park_idle_ms->getValue();
+            m_unparkQueue = std::max<uint32_t>(g_scheduler_elastic_unpark_queue->getValue(), 1);
+            if (m_minThreads >= m_threadCount) {
+                m_minThreads = 0; // 下限不小于线程数，没有可停放的线程
+            }
+        }
+
+        m_codelTargetUs = (uint64_t)g_scheduler_codel_target_ms->getValue() * 1000;
+        m_codelIntervalUs = (uint64_t)g_scheduler_codel_interval_ms->getValue() * 1000;
+
+        m_workStealing = g_scheduler_work_stealing->getValue();
+        m_priorityAging = g_scheduler_priority_aging->getValue();
+        if (m_workStealing) {
+            // 队列在构造时就建好，start之前schedule的任务也能直接进入本地队列
+            size_t count = m_threadCount + (use_caller ? 1 : 0);
+            for (size_t i = 0; i < count; ++i) {
+                m_localQueues.emplace_back(new LocalQueue);
+            }
+        }
     }
 
     Scheduler::~Scheduler() {
@@ -49,6 +169,14 @@ namespace Framework {
         return t_fiber;
     }
 
+    uint64_t Scheduler::GetCurrentTaskDelay() {
+        return t_taskDelay;
+    }
+
+    void Scheduler::AddCurrentTaskDelay(uint64_t us) {
+        t_taskDelay += us;
+    }
+
     void Scheduler::setThis() {
         t_scheduler = this;
     }
@@ -64,10 +192,53 @@ namespace Framework {
 
         // 注册线程到线程池，统一执行run方法
         m_threads.resize(m_threadCount);
+        if (m_minThreads) {
+            Mutex::Lock lock(m_parkMutex);
+            m_parkDisabled = false;
+            for (size_t i = 0; i < m_threadCount; ++i) {
+                m_workers.emplace_back(new WorkerSlot);
+                m_workers[i]->parkAtStart = i >= m_initialThreads;
+            }
+        }
+        m_threadIds.reserve(m_threadIds.size() + m_threadCount);
+        int base = m_rootFiber ? 1 : 0;
+        // 工作线程先等在这里，全部线程的id登记完再放行：线程一跑起来就会按id找队列、唤醒停放的线程（getQueueIndex、unpark）
+        std::shared_ptr<Semaphore> started = std::make_shared<Semaphore>();
+        // use_caller的主线程是用户的线程，不动它的亲和性
+        std::vector<ThreadPlacement> plan = PlanThreadPlacement(m_threadCount);
         for (size_t i = 0; i < m_threadCount; ++i) {
-            m_threads[i].reset(new Multithread(std::bind(&Scheduler::run, this)
-                , m_name + "_" + std::to_string(i)));
+            int idx = base + i;
+            const ThreadPlacement& placement = plan[i];
+            // 线程名带上绑定的核（或节点），如io_3@12、io_3@n1
+            std::string name = m_name + "_" + std::to_string(i);
+            if (placement.cpus.size() == 1) {
+                name += "@" + std::to_string(placement.cpus[0]);
+            }
+            else if (placement.node >= 0) {
+                name += "@n" + std::to_string(placement.node);
+            }
+            WorkerSlot* slot = m_minThreads ? m_workers[i].get() : nullptr;
+            m_threads[i].reset(new Multithread([this, idx, placement, slot, started]() {
+                    started->wait();
+                    // 先绑核、设置内存策略，之后本线程自己申请的协程栈、缓冲区都在本节点上缺页分配；
+                    // fd上下文表（FdManager）是所有线程共用的，分段落在哪个节点取决于谁先碰到它，不保证在本节点
+                    if (!placement.cpus.empty()) {
+                        PinThisThread(placement.cpus);
+                    }
+                    if (placement.node >= 0) {
+                        PreferThisThreadMemory(placement.node);
+                    }
+                    t_queueIndex = idx;
+                    run(slot);
+                }
+                , name));
             m_threadIds.push_back(m_threads[i]->getId()); // 线程部信号量控制必能获得id（见线程头文件）
+            if (slot) {
+                slot->thread = m_threadIds.back();
+            }
+        }
+        for (size_t i = 0; i < m_threadCount; ++i) {
+            started->notify();
         }
         //lock.unlock();
 
@@ -103,6 +274,7 @@ namespace Framework {
         }
 
         m_stopping = true;
+        unparkAll(); // 停放的线程也要回来把剩下的任务做完再退出
         for (size_t i = 0; i < m_threadCount; ++i) {
             tickle();
         }
@@ -131,15 +303,21 @@ namespace Framework {
         for (auto& i : thrs) {
             i->join();
         }
+        {
+            // 外部线程的schedule()可能还在unpark里遍历m_workers
+            Mutex::Lock lock(m_parkMutex);
+            m_workers.clear();
+        }
 
         //if(exit_on_this_fiber) {
         //}
     }
 
-    void Scheduler::run() {
+    void Scheduler::run(WorkerSlot* slot) {
         set_hook_enable(true);
         // 设置当前调度器为本线程所属调度器
         setThis();
+        t_running = this;
         // 如果当前线程不是主线程，设置一下当前线程的正在执行run的协程
         if (Framework::GetThreadId() != m_rootThread) {
             t_fiber = Fiber::GetThis().get();
@@ -150,42 +328,25 @@ namespace Framework {
         Fiber::ptr cb_fiber;
 
         FiberAndThread ft;
+        uint64_t idle_since = 0; // 从什么时候起一直没取到任务，弹性线程数用来决定是否停放
+        if (slot && slot->parkAtStart) {
+            park(slot, true);
+        }
         while (true) {
             // 重置FiberAndThread对象
             ft.reset();
+            pollBetweenTasks();
             // 标记是否有线程需要被唤醒
             bool tickle_me = false;
             bool is_active = false;
             // 从fibers队列里面取出一个任务给ft
-            {
-                // 锁定互斥锁，保护对m_fibers容器的访问
-                Mutex::Lock lock(m_mutex);
-                auto it = m_fibers.begin();
-                while (it != m_fibers.end()) {
-                    // 如果指定执行的线程不是本线程，则需要唤醒那个线程
-                    if (it->thread != -1 && it->thread != Framework::GetThreadId()) {
-                        // 移动到下一个任务
-                        ++it;
-                        // 标记需要唤醒其他线程
-                        tickle_me = true;
-                        continue;
-                    }
-                    // 断言：任务要么有纤程，要么有回调函数
-                    ASSERT(it->fiber || it->cb);
-                    // 如果任务有纤程且纤程处于执行状态，已经执行就不需要执行了
-                    if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                        // 移动到下一个任务
-                        ++it;
-                        continue;
-                    }
-                    // 将当前任务赋值给ft
-                    ft = *it;
-                    // 从任务列表中移除该任务
-                    m_fibers.erase(it);
-                    ++m_activeThreadCount;
-                    is_active = true;
-
-                    break;
+            if (m_workStealing ? takeLocal(ft, tickle_me) : takeShared(ft, tickle_me)) {
+                is_active = true;
+                idle_since = 0;
+                t_taskDelay = ft.enqueueUs ? updateQueueDelay(ft.enqueueUs) : 0;
+                // 任务是在本线程还空闲时一口气投进来的，投递方看不出积压，由取任务的一方接着唤醒
+                if (m_parkedCount) {
+                    unpark(-1);
                 }
             }
             // 如果有线程需要被唤醒
@@ -195,14 +356,16 @@ namespace Framework {
             }
             // 如果ft中有纤程且纤程状态不是终止状态
             if (ft.fiber && (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT)) {              
-                // 将纤程切换进来执行
+                // 将纤程切换进来执行，协程在里面再调度的回调继承这次的优先级
+                ft.fiber->setPriority(ft.priority);
                 ft.fiber->swapIn();
+                t_taskDelay = 0;
                 --m_activeThreadCount;
 
                 // 如果纤程状态变为就绪
                 if (ft.fiber->getState() == Fiber::READY) {
-                    // 重新扔到队列里
-                    schedule(ft.fiber);
+                    // 重新扔到队列里，按地址传递，引用直接转交给新任务
+                    schedule(&ft.fiber);
                 }
                 // 如果纤程状态既不是终止状态也不是异常状态
                 else if (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
@@ -215,19 +378,20 @@ namespace Framework {
             // 如果不是Fiber而是普通回调
             else if (ft.cb) {
                 if (cb_fiber) {
-                    cb_fiber->reset(ft.cb);
+                    cb_fiber->reset(std::move(ft.cb));
                 }
                 else {
-                    cb_fiber.reset(new Fiber(ft.cb));
+                    cb_fiber = Fiber::Create(std::move(ft.cb));
                 }
+                cb_fiber->setPriority(ft.priority);
                 ft.reset();
 
                 cb_fiber->swapIn();
+                t_taskDelay = 0;
                 --m_activeThreadCount;
 
                 if (cb_fiber->getState() == Fiber::READY) {
-                    schedule(cb_fiber);
-                    cb_fiber.reset();
+                    schedule(&cb_fiber);
                 }
                 else if (cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM) {
                     cb_fiber->reset(nullptr);
@@ -246,16 +410,47 @@ namespace Framework {
                 if (idle_fiber->getState() == Fiber::TERM) {
                     break;
                 }
+                if (slot) {
+                    uint64_t now = GetCurrentMS();
+                    if (!idle_since) {
+                        idle_since = now;
+                    }
+                    else if (now - idle_since >= m_parkIdleMs && park(slot, false)) {
+                        idle_since = 0;
+                        continue;
+                    }
+                }
 
+                LocalQueue* local = (m_workStealing && t_queueIndex >= 0) ? m_localQueues[t_queueIndex].get() : nullptr;
+                if (local) {
+                    local->idle = true;
+                }
                 ++m_idleThreadCount;
+                // 先登记空闲再补查一次：enqueue是先入队再看空闲计数，两边至少有一边能看到对方
+                // 否则在"取不到任务"和"登记空闲"之间投进来的任务不会触发tickle，绑定本线程的任务要等到epoll超时
+                if (hasRunnableTask()) {
+                    --m_idleThreadCount;
+                    if (local) {
+                        local->idle = false;
+                    }
+                    continue;
+                }
                 idle_fiber->swapIn();
                 --m_idleThreadCount;
+                if (local) {
+                    local->idle = false;
+                }
 
                 if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
                     idle_fiber->setState(Fiber::HOLD);
                 }    
             }
         }
+        t_running = nullptr;
+    }
+
+    bool Scheduler::inSchedulingLoop() const {
+        return t_running == this;
     }
 
     void Scheduler::tickle() {
@@ -264,13 +459,572 @@ namespace Framework {
 
     bool Scheduler::stopping() {
         Mutex::Lock lock(m_mutex);
-        return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+        return m_autoStop && m_stopping && m_sharedTaskCount == 0
+            && m_localTaskCount == 0 && m_activeThreadCount == 0;
     }
 
     void Scheduler::idle() {
         LOG_INFO(g_logger) << "idle";
         while (!stopping()) {
+            if (m_codelTargetUs) {
+                resetQueueDelay(); // 没有任务可做，队列已经排空
+            }
             Fiber::YieldToHold();
         }
     }
-}
\ No newline at end of file
+}
+
+// TaskNode池
+namespace Framework {
+    /*
+    每个线程缓存一批空闲节点，分配和释放都只碰线程本地的链表
+    节点常常在一个线程分配、在另一个线程执行后释放，缓存超过两批就把一批还给全局池，本地空了再从全局池整批取回，
+    全局池只在整批转移时加锁，稳定运行时不再向系统申请内存
+    */
+    static const size_t TASK_NODE_BATCH = 64;
+
+    struct FreeTaskNode {
+        FreeTaskNode* next;
+        FreeTaskNode* nextBatch; // 全局池里每批的第一个节点用来串起各批
+        size_t batchSize;        // 这一批的节点数，线程退出时还回来的最后一批可能不满
+    };
+
+    struct TaskNodeGlobalPool {
+        Spinlock mutex;
+        FreeTaskNode* batches = nullptr;
+    };
+
+    static TaskNodeGlobalPool& GetTaskNodeGlobalPool() {
+        static TaskNodeGlobalPool* s_pool = new TaskNodeGlobalPool; // 线程退出时还要用，不析构
+        return *s_pool;
+    }
+
+    struct TaskNodeCache {
+        FreeTaskNode* head = nullptr;
+        size_t count = 0;
+
+        ~TaskNodeCache() {
+            while (count) {
+                giveBack(std::min(count, TASK_NODE_BATCH));
+            }
+        }
+
+        // 从本地链表头部摘下n个节点，整批挂到全局池
+        void giveBack(size_t n) {
+            FreeTaskNode* first = head;
+            FreeTaskNode* last = head;
+            for (size_t i = 1; i < n; ++i) {
+                last = last->next;
+            }
+            head = last->next;
+            last->next = nullptr;
+            count -= n;
+            first->batchSize = n;
+            TaskNodeGlobalPool& pool = GetTaskNodeGlobalPool();
+            Spinlock::Lock lock(pool.mutex);
+            first->nextBatch = pool.batches;
+            pool.batches = first;
+        }
+
+        bool takeBatch() {
+            TaskNodeGlobalPool& pool = GetTaskNodeGlobalPool();
+            FreeTaskNode* batch;
+            {
+                Spinlock::Lock lock(pool.mutex);
+                batch = pool.batches;
+                if (!batch) {
+                    return false;
+                }
+                pool.batches = batch->nextBatch;
+            }
+            head = batch;
+            count = batch->batchSize;
+            return true;
+        }
+    };
+
+    static thread_local TaskNodeCache t_taskNodeCache;
+
+    void* Scheduler::TaskNode::operator new(size_t size) {
+        static_assert(sizeof(TaskNode) >= sizeof(FreeTaskNode), "TaskNode too small for the free list");
+        ASSERT(size == sizeof(TaskNode));
+        TaskNodeCache& cache = t_taskNodeCache;
+        if (!cache.head && !cache.takeBatch()) {
+            return ::operator new(size);
+        }
+        FreeTaskNode* node = cache.head;
+        cache.head = node->next;
+        --cache.count;
+        return node;
+    }
+
+    void Scheduler::TaskNode::operator delete(void* p) {
+        if (!p) {
+            return;
+        }
+        TaskNodeCache& cache = t_taskNodeCache;
+        FreeTaskNode* node = static_cast<FreeTaskNode*>(p);
+        node->next = cache.head;
+        cache.head = node;
+        if (++cache.count >= TASK_NODE_BATCH * 2) {
+            cache.giveBack(TASK_NODE_BATCH);
+        }
+    }
+}
+
+// 任务队列
+namespace Framework {
+    void Scheduler::TaskList::pushBack(TaskNode* node) {
+        node->prev = tail;
+        node->succ = nullptr;
+        if (tail) {
+            tail->succ = node;
+        }
+        else {
+            head = node;
+        }
+        tail = node;
+        ++size;
+    }
+
+    void Scheduler::TaskList::erase(TaskNode* node) {
+        if (node->prev) {
+            node->prev->succ = node->succ;
+        }
+        else {
+            head = node->succ;
+        }
+        if (node->succ) {
+            node->succ->prev = node->prev;
+        }
+        else {
+            tail = node->prev;
+        }
+        node->prev = node->succ = nullptr;
+        --size;
+    }
+
+    void Scheduler::TaskList::spliceBack(TaskList& other) {
+        if (other.empty()) {
+            return;
+        }
+        if (tail) {
+            tail->succ = other.head;
+            other.head->prev = tail;
+        }
+        else {
+            head = other.head;
+        }
+        tail = other.tail;
+        size += other.size;
+        other.head = other.tail = nullptr;
+        other.size = 0;
+    }
+
+    bool Scheduler::PriorityTaskList::empty() const {
+        for (auto& i : lists) {
+            if (!i.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t Scheduler::PriorityTaskList::size() const {
+        size_t n = 0;
+        for (auto& i : lists) {
+            n += i.size;
+        }
+        return n;
+    }
+
+    void Scheduler::PriorityTaskList::spliceBack(PriorityTaskList& other) {
+        for (int p = 0; p < Fiber::PRIORITY_COUNT; ++p) {
+            lists[p].spliceBack(other.lists[p]);
+        }
+    }
+
+    template<class Pred>
+    Scheduler::TaskNode* Scheduler::PriorityTaskList::take(uint32_t aging, Pred can_take) {
+        auto starving = [this, aging](int p) {
+            return aging && p > 0 && skipped[p] >= aging && !lists[p].empty();
+        };
+        // 饿得最久（优先级最低）的先取，其余按优先级
+        int order[Fiber::PRIORITY_COUNT];
+        int n = 0;
+        for (int p = Fiber::PRIORITY_COUNT - 1; p > 0; --p) {
+            if (starving(p)) {
+                order[n++] = p;
+            }
+        }
+        for (int p = 0; p < Fiber::PRIORITY_COUNT; ++p) {
+            if (!starving(p)) {
+                order[n++] = p;
+            }
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int p = order[i];
+            for (TaskNode* it = lists[p].head; it; it = it->succ) {
+                if (!can_take(it)) {
+                    continue;
+                }
+                lists[p].erase(it);
+                skipped[p] = 0;
+                for (int q = p + 1; q < Fiber::PRIORITY_COUNT; ++q) {
+                    skipped[q] = lists[q].empty() ? 0 : skipped[q] + 1;
+                }
+                return it;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Scheduler::enqueue(TaskNode* node, int& thread) {
+        // 共享栈协程的栈地址属于某个线程，只能回到那个线程上运行，优先于调用方指定的线程
+        if (node->ft.fiber && node->ft.fiber->getHomeThread() != -1) {
+            node->ft.thread = node->ft.fiber->getHomeThread();
+        }
+        if (node->ft.priority == Fiber::INHERIT) {
+            node->ft.priority = node->ft.fiber ? node->ft.fiber->getPriority() : Fiber::GetCurrentPriority();
+        }
+        thread = node->ft.thread; // 入队之后节点可能马上被别的线程取走，先记下来
+        if (m_codelTargetUs) {
+            // 任务执行中产生的任务继承它已经排过的队，比如accept协程排队等了多久，它接下来的连接就已经等了多久
+            node->ft.enqueueUs = t_enqueueTime ? t_enqueueTime : GetCurrentUS() - t_taskDelay;
+        }
+        if (m_workStealing) {
+            int idx = -1;
+            if (node->ft.thread != -1) {
+                idx = getQueueIndex(node->ft.thread);
+            }
+            else if (t_scheduler == this) {
+                idx = t_queueIndex;
+            }
+
+            if (idx >= 0 && idx < (int)m_localQueues.size()) {
+                LocalQueue* queue = m_localQueues[idx].get();
+                Spinlock::Lock lock(queue->mutex);
+                // 投递到别的线程的队列时，那个线程可能正睡在epoll里，必须唤醒
+                bool need_tickle = queue->fibers.empty() || idx != t_queueIndex;
+                queue->fibers.pushBack(node);
+                ++m_localTaskCount;
+                return need_tickle;
+            }
+        }
+
+        // 外部线程提交的任务、epoll循环触发的事件、或者绑定的线程还没登记，都走注入队列
+        // 只有共享队列原本为空时才需要唤醒，队列里还有任务说明已经有线程会来取
+        // 绑定了其他线程的任务例外：取任务的线程可能在看到它之前就返回了，目标线程会一直睡下去
+        bool need_tickle = m_sharedTaskCount.fetch_add(1) == 0
+            || (node->ft.thread != -1 && node->ft.thread != (int)Framework::GetThreadId());
+        m_inject.push(node);
+        if (!need_tickle) {
+            // 计数不为0不代表有线程会来取：前一个生产者可能exchange完还没链接就被抢占，取任务的线程看到队列"暂时为空"去睡了，
+            // 它链接时计数同样不为0，也不会唤醒。所以链接之后再看一眼，有线程空闲就唤醒（与run()里先登记空闲再补查配对）
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            need_tickle = m_idleThreadCount.load(std::memory_order_relaxed) > 0;
+        }
+        return need_tickle;
+    }
+
+    void Scheduler::drainInjectNoLock() {
+        // 有生产者入队到一半时，它后面的任务（可能优先级更高）都被挡住，让出CPU等它链接上，有上限，它迟迟不动就先用已经取到的
+        static const int INJECT_LINK_YIELDS = 16;
+        for (int i = 0; ; ++i) {
+            while (MpscNode* n = m_inject.pop()) {
+                m_fibers.pushBack(static_cast<TaskNode*>(n));
+            }
+            if (i == INJECT_LINK_YIELDS || !m_inject.pending()) {
+                return;
+            }
+            sched_yield();
+        }
+    }
+
+    bool Scheduler::takeShared(FiberAndThread& ft, bool& tickle_me) {
+        // 锁定互斥锁，保护对m_fibers容器的访问
+        Mutex::Lock lock(m_mutex);
+        drainInjectNoLock();
+        TaskNode* it = m_fibers.take(m_priorityAging, [&tickle_me](TaskNode* n) {
+            // 如果指定执行的线程不是本线程，则需要唤醒那个线程
+            if (n->ft.thread != -1 && n->ft.thread != (int)Framework::GetThreadId()) {
+                // 标记需要唤醒其他线程
+                tickle_me = true;
+                return false;
+            }
+            // 断言：任务要么有纤程，要么有回调函数
+            ASSERT(n->ft.fiber || n->ft.cb);
+            // 如果任务有纤程且纤程处于执行状态，已经执行就不需要执行了
+            return !(n->ft.fiber && n->ft.fiber->getState() == Fiber::EXEC);
+        });
+        if (!it) {
+            return false;
+        }
+        // 已从任务列表中移除，把任务交给ft
+        --m_sharedTaskCount;
+        ft = std::move(it->ft);
+        // 在锁内计数，保证stopping()看不到“任务已出队但还没算作活跃”的中间状态
+        ++m_activeThreadCount;
+        lock.unlock();
+        delete it;
+        return true;
+    }
+
+    bool Scheduler::takeLocal(FiberAndThread& ft, bool& tickle_me) {
+        int idx = t_queueIndex;
+        if (idx < 0 || idx >= (int)m_localQueues.size()) {
+            return takeShared(ft, tickle_me);
+        }
+        if (popLocal(idx, ft)) {
+            return true;
+        }
+        if (takeShared(ft, tickle_me)) {
+            return true;
+        }
+        if (steal(idx, tickle_me)) {
+            return popLocal(idx, ft);
+        }
+        return false;
+    }
+
+    bool Scheduler::popLocal(size_t idx, FiberAndThread& ft) {
+        LocalQueue* queue = m_localQueues[idx].get();
+        TaskNode* it = nullptr;
+        {
+            Spinlock::Lock lock(queue->mutex);
+            it = queue->fibers.take(m_priorityAging, [](TaskNode* n) {
+                ASSERT(n->ft.fiber || n->ft.cb);
+                // 协程可能还没从别的线程上切出去
+                return !(n->ft.fiber && n->ft.fiber->getState() == Fiber::EXEC);
+            });
+            if (it) {
+                ++m_activeThreadCount;
+                --m_localTaskCount;
+            }
+        }
+        if (!it) {
+            return false;
+        }
+        ft = std::move(it->ft);
+        delete it;
+        return true;
+    }
+
+    bool Scheduler::hasRunnableTask() {
+        if (m_workStealing && t_queueIndex >= 0) {
+            LocalQueue* queue = m_localQueues[t_queueIndex].get();
+            Spinlock::Lock lock(queue->mutex);
+            if (!queue->fibers.empty()) {
+                return true;
+            }
+        }
+        if (m_sharedTaskCount == 0) {
+            return false;
+        }
+        Mutex::Lock lock(m_mutex);
+        drainInjectNoLock();
+        for (auto& list : m_fibers.lists) {
+            for (TaskNode* it = list.head; it; it = it->succ) {
+                if (it->ft.thread == -1 || it->ft.thread == (int)Framework::GetThreadId()) {
+                    return true;
+                }
+            }
+        }
+        // 还有生产者没链接完，回去再取一次，不去睡
+        return m_inject.pending();
+    }
+
+    bool Scheduler::steal(size_t idx, bool& tickle_me) {
+        size_t n = m_localQueues.size();
+        for (size_t i = 1; i < n; ++i) {
+            LocalQueue* victim = m_localQueues[(idx + i) % n].get();
+            PriorityTaskList stolen;
+            {
+                Spinlock::Lock lock(victim->mutex);
+                size_t want = (victim->fibers.size() + 1) / 2;
+                // 高优先级的先偷
+                for (int p = 0; p < Fiber::PRIORITY_COUNT && want > 0; ++p) {
+                    TaskList& from = victim->fibers.lists[p];
+                    TaskList& to = stolen.lists[p];
+                    TaskNode* cur = from.tail;
+                    while (want > 0 && cur) {
+                        TaskNode* prev = cur->prev;
+                        // 绑定线程的任务不能偷，若它的主人在睡觉则需要唤醒
+                        if (cur->ft.thread != -1) {
+                            if (victim->idle) {
+                                tickle_me = true;
+                            }
+                        }
+                        else if (!cur->ft.fiber || cur->ft.fiber->getState() != Fiber::EXEC) {
+                            from.erase(cur);
+                            // 从队尾往前偷，头插保持原有顺序
+                            cur->succ = to.head;
+                            if (to.head) {
+                                to.head->prev = cur;
+                            }
+                            else {
+                                to.tail = cur;
+                            }
+                            to.head = cur;
+                            ++to.size;
+                            --want;
+                        }
+                        cur = prev;
+                    }
+                }
+            }
+            if (!stolen.empty()) {
+                LocalQueue* queue = m_localQueues[idx].get();
+                Spinlock::Lock lock(queue->mutex);
+                queue->fibers.spliceBack(stolen);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Scheduler::park(WorkerSlot* slot, bool force) {
+        {
+            Mutex::Lock lock(m_parkMutex);
+            // 始终保留下限个线程；非强制时至少还要有一个别的线程空着，新任务来了有人接
+            if (m_parkDisabled || m_threadCount - m_parkedCount <= m_minThreads
+                || (!force && m_idleThreadCount == 0) || !canPark()) {
+                return false;
+            }
+            slot->parked = true;
+            ++m_parkedCount;
+        }
+        // 先登记停放再补查一次，与schedule()里"先入队再看m_parkedCount"配对，投给本线程的任务不会被落下
+        if (hasRunnableTask()) {
+            Mutex::Lock lock(m_parkMutex);
+            if (slot->parked) {
+                slot->parked = false;
+                --m_parkedCount;
+                return false;
+            }
+            // 已经被别人唤醒了，信号量上有一次notify，走下面的wait消费掉
+        }
+        LOG_DEBUG(g_logger) << m_name << " park thread " << slot->thread;
+        slot->sem.wait();
+        LOG_DEBUG(g_logger) << m_name << " unpark thread " << slot->thread;
+        return true;
+    }
+
+    void Scheduler::unpark(int thread) {
+        if (!m_minThreads) {
+            return;
+        }
+        if (thread == -1 && (m_idleThreadCount != 0 || m_sharedTaskCount + m_localTaskCount < m_unparkQueue)) {
+            return;
+        }
+        // m_workers只在持有m_parkMutex时访问，stop()清空它时外部线程可能还在调度
+        Mutex::Lock lock(m_parkMutex);
+        for (auto& i : m_workers) {
+            if (thread == -1 ? i->parked.load() : i->thread == thread) {
+                if (i->parked) {
+                    i->parked = false;
+                    --m_parkedCount;
+                    i->sem.notify();
+                }
+                return;
+            }
+        }
+    }
+
+    void Scheduler::unparkAll() {
+        Mutex::Lock lock(m_parkMutex);
+        m_parkDisabled = true;
+        for (auto& i : m_workers) {
+            if (i->parked) {
+                i->parked = false;
+                --m_parkedCount;
+                i->sem.notify();
+            }
+        }
+    }
+
+    uint64_t Scheduler::updateQueueDelay(uint64_t enqueue_us) {
+        uint64_t now = GetCurrentUS();
+        uint64_t delay = now > enqueue_us ? now - enqueue_us : 0;
+        m_queueDelayUs.store(delay, std::memory_order_relaxed);
+        if (delay < m_codelTargetUs) {
+            resetQueueDelay();
+            return delay;
+        }
+        // 每个线程都会来更新，先读一下，状态没变时不写，避免共享的缓存行来回失效
+        uint64_t first = m_codelFirstAboveUs.load(std::memory_order_relaxed);
+        if (!first) {
+            m_codelFirstAboveUs.compare_exchange_strong(first, now + m_codelIntervalUs, std::memory_order_relaxed);
+        }
+        else if (now >= first && !m_overloaded.load(std::memory_order_relaxed)) {
+            if (!m_overloaded.exchange(true, std::memory_order_relaxed)) {
+                ++m_overloadCount;
+                LOG_WARN(g_logger) << m_name << " overloaded, queueing delay " << delay << "us";
+            }
+        }
+        return delay;
+    }
+
+    bool Scheduler::shouldShed() const {
+        if (!m_codelTargetUs) {
+            return false;
+        }
+        return t_taskDelay >= (isOverloaded() ? m_codelTargetUs : m_codelIntervalUs);
+    }
+
+    void Scheduler::setEnqueueTime(uint64_t us) {
+        if (us) {
+            us = std::max(us, GetCurrentUS() - m_codelIntervalUs / 2);
+        }
+        t_enqueueTime = us;
+    }
+
+    void Scheduler::resetQueueDelay() {
+        if (m_codelFirstAboveUs.load(std::memory_order_relaxed)) {
+            m_codelFirstAboveUs.store(0, std::memory_order_relaxed);
+        }
+        if (m_overloaded.load(std::memory_order_relaxed)) {
+            m_overloaded.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    int Scheduler::getThreadIndex() const {
+        return t_scheduler == this ? t_queueIndex : -1;
+    }
+
+    bool Scheduler::isThreadIdle(size_t idx) const {
+        return idx < m_localQueues.size() && m_localQueues[idx]->idle;
+    }
+
+    void Scheduler::enableLocalQueues() {
+        ASSERT(m_stopping && m_threads.empty());
+        if (m_workStealing) {
+            return;
+        }
+        m_workStealing = true;
+        size_t count = m_threadCount + (m_rootFiber ? 1 : 0);
+        for (size_t i = 0; i < count; ++i) {
+            m_localQueues.emplace_back(new LocalQueue);
+        }
+    }
+
+    std::vector<int> Scheduler::getWorkerThreadIds() const {
+        std::vector<int> ids;
+        for (auto id : m_threadIds) {
+            if (id != (int)m_rootThread || m_threadIds.size() == 1) {
+                ids.push_back(id);
+            }
+        }
+        return ids;
+    }
+
+    int Scheduler::getQueueIndex(int thread) const {
+        for (size_t i = 0; i < m_threadIds.size(); ++i) {
+            if (m_threadIds[i] == thread) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+}
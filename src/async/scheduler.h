@@ -3,8 +3,12 @@
 
 #include <functional>
 #include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "fiber.h"
+#include "inline_function.h"
+#include "mpsc_queue.h"
 #include "multithread.h"
 
 namespace Framework {
@@ -16,48 +20,135 @@ namespace Framework {
         virtual ~Scheduler();
 
         const std::string& getName() const { return m_name; }
+        // 是否开启了每线程本地队列+任务窃取的调度模式（构造时读取配置scheduler.work_stealing）
+        bool isWorkStealing() const { return m_workStealing; }
+        // 工作线程的id，可作为schedule的thread参数；use_caller的主线程只在stop()里调度，有其他线程时不计入
+        std::vector<int> getWorkerThreadIds() const;
+        // 弹性线程数（scheduler.elastic_min_threads不为0时开启）：正在调度的工作线程数、被停放的工作线程数
+        size_t getRunningThreadCount() const { return m_threadCount - m_parkedCount; }
+        size_t getParkedThreadCount() const { return m_parkedCount; }
+        /*
+        CoDel式的过载判断（scheduler.codel_target_ms不为0时开启）：schedule()时给任务打时间戳，run()取出任务时算排队时间，
+        排队时间连续一个interval都不低于target就认为过载，有一个任务低于target或者线程空闲下来（IOManager里是真的阻塞等待）时解除
+        任务执行中产生的任务继承它已经排过的队；调度器不丢弃任务，由上层据此拒绝新请求（HttpServer回503）、暂停accept（TcpServer）
+        */
+        bool isAdmissionControl() const { return m_codelTargetUs > 0; }
+        bool isOverloaded() const { return m_overloaded.load(std::memory_order_relaxed); }
+        uint64_t getCodelTargetUs() const { return m_codelTargetUs; }
+        // 最近一个出队任务的排队时间（微秒）
+        uint64_t getQueueDelayUs() const { return m_queueDelayUs.load(std::memory_order_relaxed); }
+        // 进入过载状态的次数
+        uint64_t getOverloadCount() const { return m_overloadCount.load(std::memory_order_relaxed); }
+        // 当前正在执行的任务是否该被拒绝：排队超过interval的一律拒绝，过载时排队超过target的也拒绝
+        // 在任务刚被恢复、还没让出之前调用才准确（如收完一个请求之后）
+        bool shouldShed() const;
 
         static Scheduler* GetThis();     
         static Fiber* GetMainFiber(); // 调度器也有一个主协程
+        // 当前线程正在执行的任务排队等了多久（微秒），没开启过载判断时为0
+        static uint64_t GetCurrentTaskDelay();
+        // 当前任务在调度队列之外还等了us（如暂停accept期间连接在内核的backlog里等着），算进它的排队时间，
+        // 它接下来产生的任务也会继承
+        static void AddCurrentTaskDelay(uint64_t us);
 
         void setThis();
         void start();
         void stop();
 
+        // priority为INHERIT时：协程用它自己的优先级，回调继承当前协程的优先级
         template<class FiberOrCb>
-        void schedule(FiberOrCb fc, int thread = -1) {
-            bool need_tickle = false;
-            {
-                Mutex::Lock lock(m_mutex);
-                need_tickle = scheduleNoLock(fc, thread);
+        void schedule(FiberOrCb fc, int thread = -1, Fiber::Priority priority = Fiber::INHERIT) {
+            TaskNode* node = new TaskNode(std::move(fc), thread, priority);
+            if (!node->ft.fiber && !node->ft.cb) {
+                delete node;
+                return;
             }
-
-            if (need_tickle) {
-                tickle();
+            int target = -1;
+            if (enqueue(node, target)) {
+                tickleThread(target);
+            }
+            if (m_parkedCount) {
+                unpark(target);
             }
-
         }
 
-        // 批量调度，确保一组任务顺序执行
+        // 批量调度，确保一组任务顺序执行；thread不为-1时整批绑定到该线程，最后只唤醒一次
         template<class InputIterator>
-        void schedule(InputIterator begin, InputIterator end) {
+        void schedule(InputIterator begin, InputIterator end, int thread = -1, Fiber::Priority priority = Fiber::INHERIT) {
             bool need_tickle = false;
-            {
-                Mutex::Lock lock(m_mutex);
-                while (begin != end) {
-                    need_tickle = scheduleNoLock(&*begin, -1) || need_tickle; // 思考：这里指针指出又取地址是为什么？
-                    ++begin;
+            bool need_tickle_thread = false;
+            while (begin != end) {
+                TaskNode* node = new TaskNode(&*begin, thread, priority); // 思考：这里指针指出又取地址是为什么？
+                if (node->ft.fiber || node->ft.cb) {
+                    int target = -1;
+                    if (enqueue(node, target)) {
+                        if (target == -1) {
+                            need_tickle = true;
+                        }
+                        else if (target == thread) {
+                            need_tickle_thread = true;
+                        }
+                        else {
+                            tickleThread(target); // 共享栈协程会被绑回它的线程，要单独唤醒
+                            if (m_parkedCount) {
+                                unpark(target);
+                            }
+                        }
+                    }
+                }
+                else {
+                    delete node;
                 }
+                ++begin;
+            }
+            if (need_tickle_thread) {
+                tickleThread(thread);
             }
             if (need_tickle) {
                 tickle();
             }
+            if (m_parkedCount) {
+                unpark(thread);
+            }
         }
     protected:
         virtual void tickle();
-        void run();
+        // 唤醒指定线程（-1表示任意线程），默认与tickle()相同
+        virtual void tickleThread(int thread) { tickle(); }
+        // 弹性线程数：每个工作线程一个，被停放的线程睡在自己的信号量上
+        struct WorkerSlot {
+            Semaphore sem;
+            int thread = -1;
+            std::atomic<bool> parked = { false };
+            bool parkAtStart = false; // 超出初始线程数的线程，启动后直接停放
+        };
+
+        // slot为nullptr表示这个线程不参与弹性伸缩（use_caller的主线程，或者没有开启）
+        void run(WorkerSlot* slot = nullptr);
         virtual bool stopping();
         virtual void idle(); // 空闲协程该执行的任务，轮空、睡眠？
+        // 当前线程是否正在执行本调度器的run()（use_caller的主线程只有在stop()里才算）
+        bool inSchedulingLoop() const;
+        // 当前线程在本调度器中的下标（与m_threadIds一致），不属于本调度器返回-1
+        int getThreadIndex() const;
+        // 线程id -> 下标，找不到返回-1
+        int getQueueIndex(int thread) const;
+        // 下标对应的线程是否处于空闲协程中，只在有本地队列时有效
+        bool isThreadIdle(size_t idx) const;
+        // 开启每线程本地队列（同时允许任务窃取），必须在start()之前调用
+        void enableLocalQueues();
+        // 是否有本线程能执行的任务（不取出），进入idle前用来补查，空闲自旋时用来轮询
+        bool hasRunnableTask();
+        // 之后本线程入队的任务按us作为入队时间（开启过载判断时），0表示恢复用当前时间
+        // 用于把任务入队之前就已经在等的时间算进排队时间，如epoll里早已就绪、还没被取走的事件
+        // 这只是估计，往前最多推半个interval：单凭它不会让没过载的调度器拒绝请求，持续高于target一个interval才算过载
+        void setEnqueueTime(uint64_t us);
+        // 队列已经排空（线程空闲下来）时调用，解除过载
+        void resetQueueDelay();
+        // 调度循环每次取任务之前调用，线程一直有任务做、不进idle时也会调用，子类在这里处理只有本线程能收割的完成事件，必须足够便宜
+        virtual void pollBetweenTasks() {}
+        // 当前线程此刻能否被停放，有只能由本线程处理的状态（自己的epoll、私有定时器等）时子类返回false
+        virtual bool canPark() { return true; }
 
         // 用于存储线程ID的向量
         std::vector<int> m_threadIds;
@@ -72,24 +163,15 @@ namespace Framework {
         // 标识是否自动停止的标志，true表示自动停止
         bool m_autoStop = false;
     private:
-        // 将一个协程（或回调函数）加入到调度器的任务队列中，如果当前调度队列 m_fibers 是空的，那么新加入的任务就需要“唤醒”调度器
-        template<class FiberOrCb>
-        bool scheduleNoLock(FiberOrCb fc, int thread) {
-            bool need_tickle = m_fibers.empty();
-            FiberAndThread ft(fc, thread);
-            if (ft.fiber || ft.cb) {
-                m_fibers.push_back(ft);
-            }
-            return need_tickle;
-        }
-
         struct FiberAndThread {
             Fiber::ptr fiber;
-            std::function<void()> cb;
+            InlineFunction cb; // 小的回调直接存在节点里，不再单独申请内存
             int thread;
+            Fiber::Priority priority = Fiber::NORMAL;
+            uint64_t enqueueUs = 0; // 入队时间，只在开启过载判断时记录
 
             FiberAndThread(Fiber::ptr f, int thr)
-                :fiber(f), thread(thr) {
+                :fiber(std::move(f)), thread(thr) {
             }
 
             FiberAndThread(Fiber::ptr* f, int thr)
@@ -97,13 +179,19 @@ namespace Framework {
                 fiber.swap(*f);
             }
 
-            FiberAndThread(std::function<void()> f, int thr)
-                :cb(f), thread(thr) {
+            FiberAndThread(std::function<void()>* f, int thr)
+                :cb(std::move(*f)), thread(thr) {
+                *f = nullptr;
             }
 
-            FiberAndThread(std::function<void()>* f, int thr)
-                :thread(thr) {
-                cb.swap(*f);
+            FiberAndThread(InlineFunction* f, int thr)
+                :cb(std::move(*f)), thread(thr) {
+            }
+
+            // lambda、std::function等可调用对象
+            template<class F, class = std::enable_if_t<std::is_invocable_v<std::decay_t<F>&> > >
+            FiberAndThread(F&& f, int thr)
+                :cb(std::forward<F>(f)), thread(thr) {
             }
 
             FiberAndThread() 
@@ -115,15 +203,118 @@ namespace Framework {
                 fiber = nullptr;
                 cb = nullptr;
                 thread = -1;
+                priority = Fiber::NORMAL;
+                enqueueUs = 0;
             }
 
         }; // 思考：为什么会有两个版本：智能指针、以及智能指针的指针？智能指针的指针为什么需要使用fiber.swap(*f);？这里可以替代成移动构造函数吗？
+
+        // 侵入式任务节点：同一个节点依次经过无锁注入队列、共享队列、本地队列，全程不再申请内存
+        // 节点本身从TaskNode池里取，执行完还回池里，稳定运行时schedule/执行一个任务不会有堆分配
+        struct TaskNode : public MpscNode {
+            template<class FiberOrCb>
+            TaskNode(FiberOrCb&& fc, int thr, Fiber::Priority prio)
+                : ft(std::forward<FiberOrCb>(fc), thr) {
+                ft.priority = prio; // INHERIT在enqueue里确定
+            }
+
+            static void* operator new(size_t size);
+            static void operator delete(void* p);
+
+            FiberAndThread ft;
+            TaskNode* prev = nullptr;
+            TaskNode* succ = nullptr;
+        };
+
+        // 侵入式双向链表，只在持有对应的锁时访问
+        struct TaskList {
+            TaskNode* head = nullptr;
+            TaskNode* tail = nullptr;
+            size_t size = 0;
+
+            bool empty() const { return head == nullptr; }
+            void pushBack(TaskNode* node);
+            void erase(TaskNode* node);
+            void spliceBack(TaskList& other); // other整体接到队尾，other被清空
+        };
+
+        /*
+        按优先级分开排队，每个优先级内部仍是FIFO
+        取任务时先看高优先级；高优先级连续被选中aging次、而低优先级一直有任务在等时，让等得最久的低优先级先取一次，避免饿死
+        */
+        struct PriorityTaskList {
+            TaskList lists[Fiber::PRIORITY_COUNT];
+            uint32_t skipped[Fiber::PRIORITY_COUNT] = { 0 }; // 有任务却因为更高优先级被跳过的次数
+
+            bool empty() const;
+            size_t size() const;
+            void pushBack(TaskNode* node) { lists[node->ft.priority].pushBack(node); }
+            void spliceBack(PriorityTaskList& other);
+            // 按优先级（考虑防饿死）取第一个满足can_take的任务并摘下，没有返回nullptr
+            template<class Pred>
+            TaskNode* take(uint32_t aging, Pred can_take);
+        };
+
+        // 每个调度线程私有的任务队列，本线程从队头取任务，空闲线程从队尾窃取
+        struct LocalQueue {
+            Spinlock mutex;
+            PriorityTaskList fibers;
+            std::atomic<bool> idle = { false }; // 所属线程是否处于空闲协程中
+        };
+
+        // 入队，返回是否需要唤醒线程，thread带回任务最终绑定的线程（-1表示不绑定）
+        // 任务窃取模式下：调度线程内部产生的任务、线程绑定的任务进入对应线程的本地队列；
+        // 其余情况（外部线程、非窃取模式）一律无锁地压入注入队列m_inject，生产者之间、生产者与消费者之间互不阻塞
+        bool enqueue(TaskNode* node, int& thread);
+        // 把注入队列里的任务搬到m_fibers，需持有m_mutex（m_mutex同时也保证了注入队列只有一个消费者）
+        void drainInjectNoLock();
+        // 从共享队列中取一个可以在本线程执行的任务
+        bool takeShared(FiberAndThread& ft, bool& tickle_me);
+        // 任务窃取模式下取任务：本地队列 -> 共享队列 -> 从其他线程窃取
+        bool takeLocal(FiberAndThread& ft, bool& tickle_me);
+        bool popLocal(size_t idx, FiberAndThread& ft);
+        // 从其他线程的本地队列队尾窃取一半可窃取的任务到idx队列
+        bool steal(size_t idx, bool& tickle_me);
+
+        // 停放当前线程直到被唤醒，没能停放返回false；force为true时不要求有别的线程空闲（启动时多出来的线程）
+        bool park(WorkerSlot* slot, bool force);
+        // 任务入队后调用：绑定线程thread的任务要唤醒那个线程，不绑定的任务在没有空闲线程、积压足够多时唤醒一个
+        void unpark(int thread);
+        void unparkAll();
+        // 取出任务时用它的排队时间更新过载状态，返回排队时间
+        uint64_t updateQueueDelay(uint64_t enqueue_us);
     private:
         Mutex m_mutex;
         std::vector<Multithread::ptr> m_threads;
-        std::list<FiberAndThread> m_fibers; // 待执行的队列，执行体既可以是线程，也可以是协程
+        PriorityTaskList m_fibers; // 待执行的队列，执行体既可以是线程，也可以是协程
+        MpscQueue m_inject; // 无锁注入队列，schedule()的生产者只碰它
+        std::atomic<size_t> m_sharedTaskCount = { 0 }; // m_inject与m_fibers中的任务总数
         std::string m_name;
         uint32_t m_rootThread;
         Fiber::ptr m_rootFiber;
+
+        bool m_workStealing = false;
+        uint32_t m_priorityAging = 0; // 构造时读取配置scheduler.priority_aging
+        // 下标与m_threadIds一致：use_caller时0号为调度器主线程，其余依次为工作线程
+        std::vector<std::unique_ptr<LocalQueue> > m_localQueues;
+        std::atomic<size_t> m_localTaskCount = { 0 }; // 所有本地队列中的任务总数
+
+        // 弹性线程数，构造时读取scheduler.elastic_*配置，m_minThreads为0表示不开启
+        size_t m_minThreads = 0;
+        size_t m_initialThreads = 0;
+        uint64_t m_parkIdleMs = 0;
+        size_t m_unparkQueue = 0;
+        Mutex m_parkMutex;
+        std::vector<std::unique_ptr<WorkerSlot> > m_workers; // 下标与m_threads一致，由m_parkMutex保护
+        std::atomic<size_t> m_parkedCount = { 0 };
+        bool m_parkDisabled = false; // stop()之后不再停放，由m_parkMutex保护
+
+        // 过载判断，构造时读取scheduler.codel_*配置，m_codelTargetUs为0表示不开启
+        uint64_t m_codelTargetUs = 0;
+        uint64_t m_codelIntervalUs = 0;
+        std::atomic<uint64_t> m_codelFirstAboveUs = { 0 }; // 排队时间持续高于target到这个时间就进入过载，0表示当前不高于target
+        std::atomic<bool> m_overloaded = { false };
+        std::atomic<uint64_t> m_queueDelayUs = { 0 };
+        std::atomic<uint64_t> m_overloadCount = { 0 };
     };
 }
\ No newline at end of file
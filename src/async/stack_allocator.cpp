@@ -0,0 +1,176 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "stack_allocator.h"
+
+namespace Framework {
+    static Logger::ptr g_logger = LOG_NAME("system");
+
+    static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_size =
+        Config::Lookup<uint32_t>("fiber.stack_pool_size", 64, "fiber stack pool size per thread");
+    static ConfigVar<bool>::ptr g_fiber_stack_guard =
+        Config::Lookup<bool>("fiber.stack_guard", true, "fiber stack guard page");
+    static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+        Config::Lookup<uint32_t>("fiber.shared_stack_count", 0, "fiber shared stack count per thread, 0 means disabled");
+    static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+        Config::Lookup<uint32_t>("fiber.shared_stack_size", 8 * 1024 * 1024, "fiber shared stack size");
+
+    // 每次释放/映射协程栈都要看这两项，缓存一份，避免读配置加锁
+    static std::atomic<uint32_t> s_stack_pool_size{ 0 };
+    static std::atomic<bool> s_stack_guard{ true };
+    struct _StackPoolIniter {
+        _StackPoolIniter() {
+            s_stack_pool_size = g_fiber_stack_pool_size->getValue();
+            g_fiber_stack_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+                s_stack_pool_size = new_value;
+            });
+            s_stack_guard = g_fiber_stack_guard->getValue();
+            g_fiber_stack_guard->addListener([](const bool& old_value, const bool& new_value) {
+                s_stack_guard = new_value;
+            });
+        }
+    };
+    static _StackPoolIniter s_stack_pool_initer;
+
+    static std::atomic<uint64_t> s_pool_hits{ 0 };
+    static std::atomic<uint64_t> s_pool_misses{ 0 };
+    static std::atomic<uint64_t> s_pool_releases{ 0 };
+
+    static size_t GetPageSize() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        return s_page_size;
+    }
+
+    static size_t RoundToPage(size_t size) {
+        size_t page = GetPageSize();
+        return (size + page - 1) / page * page;
+    }
+
+    // 不论是否开启保护页，都多映射一页，这样释放时不需要知道申请时的配置
+    static void* MapStack(size_t size) {
+        size_t page = GetPageSize();
+        size_t len = RoundToPage(size) + page;
+        void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            LOG_ERROR(g_logger) << "mmap fiber stack fail, size=" << len << " errno=" << errno << " errstr=" << strerror(errno);
+            throw std::bad_alloc();
+        }
+        // 保护页设置失败（通常是映射数超过vm.max_map_count）就不交出没有保护的栈，溢出会悄悄踩坏相邻内存
+        if (s_stack_guard.load(std::memory_order_relaxed) && mprotect(base, page, PROT_NONE)) {
+            LOG_ERROR(g_logger) << "mprotect fiber stack guard fail, size=" << len << " errno=" << errno << " errstr=" << strerror(errno);
+            munmap(base, len);
+            throw std::bad_alloc();
+        }
+        return (char*)base + page;
+    }
+
+    static void UnmapStack(void* vp, size_t size) {
+        size_t page = GetPageSize();
+        munmap((char*)vp - page, RoundToPage(size) + page);
+    }
+
+    // 只缓存一种大小的栈（通常就是fiber.stack_size），大小不同的栈直接mmap/munmap
+    struct ThreadStackPool {
+        size_t size = 0;
+        std::vector<void*> stacks;
+        bool alive = true; // 线程退出时别的thread_local（协程回收池）可能在它析构之后才释放协程栈
+
+        ~ThreadStackPool() {
+            for (auto& i : stacks) {
+                UnmapStack(i, size);
+            }
+            stacks.clear();
+            alive = false;
+        }
+    };
+    static thread_local ThreadStackPool t_stack_pool;
+
+    void* MallocStackAllocator::Alloc(size_t size) {
+        return malloc(size);
+    }
+
+    void MallocStackAllocator::Dealloc(void* vp, size_t size) {
+        return free(vp);
+    }
+
+    void* PooledStackAllocator::Alloc(size_t size) {
+        ThreadStackPool& pool = t_stack_pool;
+        if (pool.alive && pool.size == size && !pool.stacks.empty()) {
+            void* vp = pool.stacks.back();
+            pool.stacks.pop_back();
+            s_pool_hits.fetch_add(1, std::memory_order_relaxed);
+            return vp;
+        }
+        s_pool_misses.fetch_add(1, std::memory_order_relaxed);
+        return MapStack(size);
+    }
+
+    void PooledStackAllocator::Dealloc(void* vp, size_t size) {
+        ThreadStackPool& pool = t_stack_pool;
+        if (!pool.alive) {
+            UnmapStack(vp, size);
+            return;
+        }
+        if (pool.stacks.empty()) {
+            pool.size = size; // 池子空了就跟随最新的栈大小
+        }
+        if (pool.size == size && pool.stacks.size() < s_stack_pool_size.load(std::memory_order_relaxed)) {
+            pool.stacks.push_back(vp);
+            return;
+        }
+        s_pool_releases.fetch_add(1, std::memory_order_relaxed);
+        UnmapStack(vp, size);
+    }
+
+    uint64_t PooledStackAllocator::GetHits() {
+        return s_pool_hits;
+    }
+
+    uint64_t PooledStackAllocator::GetMisses() {
+        return s_pool_misses;
+    }
+
+    uint64_t PooledStackAllocator::GetReleases() {
+        return s_pool_releases;
+    }
+
+    struct ThreadSharedStacks {
+        std::vector<SharedStack> stacks;
+        size_t next = 0;
+
+        ~ThreadSharedStacks() {
+            for (auto& i : stacks) {
+                UnmapStack(i.buffer, i.size);
+            }
+        }
+    };
+    static thread_local ThreadSharedStacks t_shared_stacks;
+
+    bool SharedStack::IsEnabled() {
+        return g_fiber_shared_stack_count->getValue() > 0;
+    }
+
+    SharedStack* SharedStack::Next() {
+        ThreadSharedStacks& ss = t_shared_stacks;
+        if (ss.stacks.empty()) {
+            uint32_t count = g_fiber_shared_stack_count->getValue();
+            ss.stacks.resize(count ? count : 1);
+            for (auto& i : ss.stacks) {
+                i.size = g_fiber_shared_stack_size->getValue();
+                i.buffer = (char*)MapStack(i.size);
+            }
+        }
+        SharedStack* rt = &ss.stacks[ss.next];
+        ss.next = (ss.next + 1) % ss.stacks.size();
+        return rt;
+    }
+}
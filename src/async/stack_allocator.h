@@ -0,0 +1,51 @@
+#pragma once
+// 协程栈内存分配器
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Framework {
+    // 通用栈内存分配器
+    class MallocStackAllocator {
+    public:
+        static void* Alloc(size_t size);
+        static void Dealloc(void* vp, size_t size);
+    };
+
+    /*
+    每线程的栈池，栈用mmap申请，栈底（低地址）留一页PROT_NONE的保护页，栈溢出时直接段错误而不是踩坏别的内存
+    协程析构时栈回到当前线程的池子里，下一个协程直接复用，省掉反复mmap/munmap
+    配置项：
+        fiber.stack_size       栈大小
+        fiber.stack_pool_size  每个线程最多缓存多少个栈，0表示不缓存
+        fiber.stack_guard      是否开启保护页
+    */
+    class PooledStackAllocator {
+    public:
+        static void* Alloc(size_t size);
+        static void Dealloc(void* vp, size_t size);
+
+        static uint64_t GetHits();     // 从池子里拿到栈的次数
+        static uint64_t GetMisses();   // 池子为空、需要新mmap的次数
+        static uint64_t GetReleases(); // 池子已满、直接munmap的次数
+    };
+
+    class Fiber;
+    /*
+    共享栈（copy-on-switch）：每个线程只有几个很大的运行栈，协程轮流在上面跑
+    协程切出时栈内容先留在共享栈上，等别的协程要用这块栈时，才把它[sp, 栈底)这段真正用到的部分拷到刚好够大的堆内存里
+    大量空闲长连接场景下，每个连接只占用它实际用到的那几KB栈
+    配置项：
+        fiber.shared_stack_count  每个线程的共享栈个数，0表示关闭（默认）
+        fiber.shared_stack_size   每个共享栈的大小
+    */
+    struct SharedStack {
+        char* buffer = nullptr;
+        size_t size = 0;
+        Fiber* occupant = nullptr; // 当前栈上保存着谁的数据，只在所属线程上访问
+
+        static bool IsEnabled();
+        // 轮流返回本线程的共享栈
+        static SharedStack* Next();
+    };
+}
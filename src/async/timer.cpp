@@ -1,7 +1,47 @@
+#include "config.h"
 #include "timer.h"
 #include "utils.h"
 
 namespace Framework {
+    static ConfigVar<bool>::ptr g_timer_wheel =
+        Config::Lookup<bool>("timer.wheel", false, "use hierarchical timing wheel instead of std::set for timers");
+    static ConfigVar<bool>::ptr g_timer_per_thread =
+        Config::Lookup<bool>("timer.per_thread", false, "io threads own the timers they create, other threads cancel them by message");
+
+    // 其他线程发给定时器所属线程的消息
+    struct TimerMessage : public MpscNode {
+        enum Op {
+            CANCEL,
+            REFRESH,
+            RESET
+        };
+        Timer::ptr timer;
+        int op = CANCEL;
+        uint64_t ms = 0;
+        bool from_now = false;
+        uint64_t now_ms = 0; // 发消息时的时间，from_now以这个时间为准
+    };
+
+    // 一个线程私有的定时器队列，只有所属线程会访问timers
+    struct ThreadTimers {
+        ThreadTimers(TimerManager* m, bool use_wheel)
+            : manager(m), timers(use_wheel), previous(Framework::GetCurrentMS()) {
+        }
+        ~ThreadTimers() {
+            while (MpscNode* node = messages.pop()) {
+                delete static_cast<TimerMessage*>(node);
+            }
+        }
+
+        TimerManager* manager;
+        TimerQueue timers;
+        MpscQueue messages;
+        uint64_t previous; // 时钟回拨检测
+    };
+
+    static thread_local ThreadTimers* t_thread_timers = nullptr;
+    static thread_local TimerManager* t_thread_timers_manager = nullptr;
+
     bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const {
         // 比较两个定时器，谁执行时间短就小，执行时间一样就比较地址大小
         if (!lhs && !rhs) {
@@ -31,52 +71,89 @@ namespace Framework {
         : m_next(next) {
     }
 
-    TimerManager::TimerManager() {
+    TimerManager::TimerManager()
+        : m_timers(g_timer_wheel->getValue()) {
         m_previous = Framework::GetCurrentMS();
+        m_useWheel = g_timer_wheel->getValue();
+        m_perThread = g_timer_per_thread->getValue();
     }
 
     TimerManager::~TimerManager() {
     }
 
     bool Timer::cancel() {
+        if (m_owner) {
+            bool expected = true;
+            if (!m_active.compare_exchange_strong(expected, false)) {
+                return false;
+            }
+            --m_manager->m_threadTimerCount;
+            if (m_owner == t_thread_timers) {
+                m_owner->timers.erase(shared_from_this());
+                m_cb = nullptr;
+            }
+            else {
+                // 不碰别的线程的队列，也不用唤醒它：定时器已经标记为无效，到期了也不会触发
+                m_manager->postMessage(shared_from_this(), TimerMessage::CANCEL);
+            }
+            return true;
+        }
+
         RWMutex::WriteLock lock(m_manager->m_mutex);
         if (m_cb) {
             m_cb = nullptr;
-            auto it = m_manager->m_timers.find(shared_from_this());
-            m_manager->m_timers.erase(it);
+            m_manager->m_timers.erase(shared_from_this());
             return true;
         }
         return false;
     }
 
     bool Timer::refresh() {
+        if (m_owner) {
+            if (!m_active) {
+                return false;
+            }
+            if (m_owner == t_thread_timers) {
+                return m_manager->applyReset(m_owner, shared_from_this(), m_ms, true, Framework::GetCurrentMS());
+            }
+            m_manager->postMessage(shared_from_this(), TimerMessage::REFRESH);
+            return true;
+        }
+
         RWMutex::WriteLock lock(m_manager->m_mutex);
         if (!m_cb) {
             return false;
         }
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if (it == m_manager->m_timers.end()) {
+        if (!m_manager->m_timers.erase(shared_from_this())) { // 先删除再重新设定时间，不然set内部排序会乱
             return false;
         }
-        m_manager->m_timers.erase(it); // 先删除再重新设定时间，不然set内部排序会乱
         m_next = Framework::GetCurrentMS() + m_ms;
         m_manager->m_timers.insert(shared_from_this());
         return true;
     }
 
     bool Timer::reset(uint64_t ms, bool from_now) {
+        if (m_owner) {
+            if (m_owner == t_thread_timers) {
+                return m_manager->applyReset(m_owner, shared_from_this(), ms, from_now, Framework::GetCurrentMS());
+            }
+            if (!m_active) {
+                return false;
+            }
+            m_manager->postMessage(shared_from_this(), TimerMessage::RESET, ms, from_now);
+            return true;
+        }
+
         RWMutex::WriteLock lock(m_manager->m_mutex);
         if (ms == m_ms && !from_now) {
             return true;
-        }        
+        }
         if (!m_cb) {
             return false;
         }
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if (it == m_manager->m_timers.end()) {
+        if (!m_manager->m_timers.erase(shared_from_this())) { // 先删除再重新设定时间，不然set内部排序会乱
             return false;
         }
-        m_manager->m_timers.erase(it); // 先删除再重新设定时间，不然set内部排序会乱
 
         uint64_t start = 0;
         // 如果from_now，则下一次的执行时间为now+新的间隔，不然的话原定下一次执行的时间不变
@@ -88,16 +165,131 @@ namespace Framework {
         }
         m_ms = ms;
         m_next = start + m_ms;
-        
+
         m_manager->addTimer(shared_from_this(), lock);
         return true;
     }
 }
 
+namespace Framework {
+    TimerQueue::TimerQueue(bool use_wheel)
+        : m_useWheel(use_wheel) {
+        if (m_useWheel) {
+            m_wheel.reset(new TimingWheel(Framework::GetCurrentMS()));
+        }
+    }
+
+    TimerQueue::~TimerQueue() {
+        if (m_useWheel) {
+            // 时间轮上的定时器各自持有自己的引用，需要手动解开
+            std::vector<Timer*> timers;
+            m_wheel->clear(0, timers);
+            for (auto& timer : timers) {
+                timer->m_self.reset();
+            }
+        }
+    }
+
+    bool TimerQueue::insert(const Timer::ptr& timer) {
+        ++m_size;
+        if (!m_useWheel) {
+            return m_timers.insert(timer).first == m_timers.begin(); // 插入的迭代器位置在最前，说明插入的定时器最小
+        }
+        if (m_wheel->empty()) {
+            // 空的时间轮可能停在很久以前的刻度上，先拨到当前时间
+            std::vector<Timer*> none;
+            m_wheel->advance(Framework::GetCurrentMS(), none);
+        }
+        timer->m_self = timer;
+        m_wheel->insert(timer.get());
+        // 时间轮找最小值不是O(1)的，和idle线程上次算出的等待时间比较即可
+        return timer->m_next < m_wheelDeadline;
+    }
+
+    bool TimerQueue::erase(const Timer::ptr& timer) {
+        if (!m_useWheel) {
+            auto it = m_timers.find(timer);
+            if (it == m_timers.end()) {
+                return false;
+            }
+            m_timers.erase(it);
+            --m_size;
+            return true;
+        }
+        if (!timer->m_wheelSlot) {
+            return false;
+        }
+        m_wheel->remove(timer.get());
+        timer->m_self.reset(); // 调用方还持有timer，这里不会析构
+        --m_size;
+        return true;
+    }
+
+    uint64_t TimerQueue::nextExpire() {
+        if (m_useWheel) {
+            uint64_t next = m_wheel->nextExpire();
+            m_wheelDeadline = next;
+            return next;
+        }
+        if (m_timers.empty()) {
+            return ~0ull;
+        }
+        return (*m_timers.begin())->m_next;
+    }
+
+    void TimerQueue::listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr>& expired) {
+        if (m_useWheel) {
+            if (m_wheel->empty()) {
+                return;
+            }
+            std::vector<Timer*> raw;
+            if (rollover) {
+                m_wheel->clear(now_ms, raw);
+            }
+            else {
+                m_wheel->advance(now_ms, raw);
+            }
+            expired.reserve(expired.size() + raw.size());
+            for (auto& timer : raw) {
+                expired.push_back(std::move(timer->m_self)); // 接管时间轮持有的引用
+            }
+            m_size -= raw.size();
+            return;
+        }
+
+        if (m_timers.empty()) {
+            return;
+        }
+        if (!rollover && (*m_timers.begin())->m_next > now_ms) {
+            return;
+        }
+
+        Timer::ptr now_timer(new Timer(now_ms));
+        auto it = rollover ? m_timers.end() : m_timers.upper_bound(now_timer); // >now_timer的定时器
+        size_t old = expired.size();
+        expired.insert(expired.end(), m_timers.begin(), it);
+        m_timers.erase(m_timers.begin(), it);
+        m_size -= expired.size() - old;
+    }
+}
 
 namespace Framework {
     Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool _recurring) {
         Timer::ptr timer(new Timer(ms, cb, _recurring, this));
+        ThreadTimers* local = localTimers();
+        if (!local && m_perThread && isTimerThread()) {
+            // 工作线程在第一次进入idle之前就可能添加定时器
+            bindThreadTimers();
+            local = localTimers();
+        }
+        if (local) {
+            // 本线程正在运行，下次进入idle时会重新计算超时，不需要唤醒谁
+            timer->m_owner = local;
+            ++m_threadTimerCount;
+            local->timers.insert(timer);
+            return timer;
+        }
+
         RWMutex::WriteLock lock(m_mutex);
         addTimer(timer, lock);
 
@@ -105,9 +297,8 @@ namespace Framework {
     }
 
     void TimerManager::addTimer(Timer::ptr timer, RWMutex::WriteLock& lock) {
-        auto it = m_timers.insert(timer).first;
-        bool at_front = (it == m_timers.begin()) && !m_tickled; // 插入的迭代器位置在最前，说明插入的定时器最小
-        
+        bool at_front = m_timers.insert(timer) && !m_tickled;
+
         // if (at_front) {
         //     m_tickled = true;
         //     lock.unlock();
@@ -140,39 +331,68 @@ namespace Framework {
     }
 
     uint64_t TimerManager::getNextTimer() {
-        RWMutex::ReadLock lock(m_mutex);
         m_tickled = false;
-        if (m_timers.empty()) {
+        uint64_t next = ~0ull;
+        ThreadTimers* local = localTimers();
+        if (local) {
+            processMessages(local);
+            next = local->timers.nextExpire();
+        }
+        // 开启线程私有定时器后共享队列通常是空的，不必加锁
+        if (!local || m_timers.size()) {
+            RWMutex::ReadLock lock(m_mutex);
+            uint64_t shared_next = m_timers.nextExpire();
+            if (shared_next < next) {
+                next = shared_next;
+            }
+        }
+        if (next == ~0ull) {
             return ~0ull;
         }
-        const Timer::ptr& next = *m_timers.begin();
         uint64_t now_ms = Framework::GetCurrentMS();
-        if (now_ms >= next->m_next) { // 因为某些原因当前时间已经超过了下一个定时器的时间，则需要立刻执行下一个定时器
+        if (now_ms >= next) { // 因为某些原因当前时间已经超过了下一个定时器的时间，则需要立刻执行下一个定时器
             return 0;
         }
         else {
-            return next->m_next - now_ms; // 不然的话，就可以等待一段时间
+            return next - now_ms; // 不然的话，就可以等待一段时间
         }
     }
 
     void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
         uint64_t now_ms = Framework::GetCurrentMS();
         std::vector<Timer::ptr> expired;
-        
-        RWMutex::WriteLock lock(m_mutex);
-		if (m_timers.empty()) {
-			return;
-		}
-         
-        bool rollover = detectClockRollover(now_ms);
-        if (!rollover && (*m_timers.begin())->m_next > now_ms) {
+
+        ThreadTimers* local = localTimers();
+        if (local) {
+            processMessages(local);
+            local->timers.listExpired(now_ms, detectClockRollover(now_ms, local->previous), expired);
+            for (auto& timer : expired) {
+                if (!timer->m_active) { // 已经被其他线程取消，消息还没处理到
+                    timer->m_cb = nullptr;
+                    continue;
+                }
+                if (timer->m_recurring) {
+                    cbs.push_back(timer->m_cb);
+                    timer->m_next = now_ms + timer->m_ms;
+                    local->timers.insert(timer);
+                    continue;
+                }
+                // 和其他线程的cancel()抢，谁改成功算谁的
+                bool expected = true;
+                if (timer->m_active.compare_exchange_strong(expected, false)) {
+                    --m_threadTimerCount;
+                    cbs.push_back(std::move(timer->m_cb));
+                }
+                timer->m_cb = nullptr;
+            }
+            expired.clear();
+        }
+        if (!m_timers.size()) {
             return;
         }
 
-        Timer::ptr now_timer(new Timer(now_ms));
-        auto it = rollover ? m_timers.end() : m_timers.upper_bound(now_timer); // >now_timer的定时器
-        expired.assign(m_timers.begin(), it);
-        m_timers.erase(m_timers.begin(), it);
+        RWMutex::WriteLock lock(m_mutex);
+        m_timers.listExpired(now_ms, detectClockRollover(now_ms, m_previous), expired);
 
         for (auto& timer : expired) {
             cbs.push_back(timer->m_cb); // 回调
@@ -187,16 +407,94 @@ namespace Framework {
     }
 
     bool TimerManager::hasTimer() {
-        RWMutex::ReadLock lock(m_mutex);
-        return !m_timers.empty();
+        return m_threadTimerCount > 0 || m_timers.size() > 0;
+    }
+
+    bool TimerManager::hasLocalTimers() const {
+        ThreadTimers* local = localTimers();
+        return local && local->timers.size() > 0;
     }
 
-	bool TimerManager::detectClockRollover(uint64_t now_ms) {
+    void TimerManager::bindThreadTimers() {
+        if (!m_perThread || localTimers()) {
+            return;
+        }
+        ThreadTimers* local = new ThreadTimers(this, m_useWheel);
+        {
+            RWMutex::WriteLock lock(m_mutex);
+            m_threadTimers.emplace_back(local);
+        }
+        t_thread_timers = local;
+        t_thread_timers_manager = this;
+    }
+
+    void TimerManager::unbindThreadTimers() {
+        ThreadTimers* local = localTimers();
+        if (local) {
+            processMessages(local);
+            t_thread_timers = nullptr;
+            t_thread_timers_manager = nullptr;
+        }
+    }
+
+    ThreadTimers* TimerManager::localTimers() const {
+        return t_thread_timers_manager == this ? t_thread_timers : nullptr;
+    }
+
+    void TimerManager::postMessage(const Timer::ptr& timer, int op, uint64_t ms, bool from_now) {
+        TimerMessage* msg = new TimerMessage;
+        msg->timer = timer;
+        msg->op = op;
+        msg->ms = ms;
+        msg->from_now = from_now;
+        msg->now_ms = Framework::GetCurrentMS();
+        timer->m_owner->messages.push(msg);
+        if (op != TimerMessage::CANCEL) {
+            // 到期时间可能提前了，所属线程也许正睡在epoll里
+            onTimerInsertedAtFront();
+        }
+    }
+
+    void TimerManager::processMessages(ThreadTimers* local) {
+        while (MpscNode* node = local->messages.pop()) {
+            TimerMessage* msg = static_cast<TimerMessage*>(node);
+            if (msg->op == TimerMessage::CANCEL) {
+                local->timers.erase(msg->timer);
+                msg->timer->m_cb = nullptr;
+            }
+            else if (msg->op == TimerMessage::REFRESH) {
+                applyReset(local, msg->timer, msg->timer->m_ms, true, msg->now_ms);
+            }
+            else {
+                applyReset(local, msg->timer, msg->ms, msg->from_now, msg->now_ms);
+            }
+            delete msg;
+        }
+    }
+
+    bool TimerManager::applyReset(ThreadTimers* local, const Timer::ptr& timer, uint64_t ms, bool from_now, uint64_t now_ms) {
+        if (ms == timer->m_ms && !from_now) {
+            return true;
+        }
+        if (!timer->m_active) {
+            return false;
+        }
+        if (!local->timers.erase(timer)) { // 先删除再重新设定时间，不然set内部排序会乱
+            return false;
+        }
+        uint64_t start = from_now ? now_ms : timer->m_next - timer->m_ms;
+        timer->m_ms = ms;
+        timer->m_next = start + ms;
+        local->timers.insert(timer);
+        return true;
+    }
+
+	bool TimerManager::detectClockRollover(uint64_t now_ms, uint64_t& previous) {
 		bool rollover = false;
-		if (now_ms < (m_previous - (uint64_t)(60 * 60 * 1000))) {
+		if (now_ms < (previous - (uint64_t)(60 * 60 * 1000))) {
 			rollover = true;
 		}
-		m_previous = now_ms;
+		previous = now_ms;
 		return rollover;
 	}
-}
\ No newline at end of file
+}
@@ -1,14 +1,21 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <set>
 
+#include "mpsc_queue.h"
 #include "multithread.h"
+#include "timing_wheel.h"
 
 namespace Framework {
     class TimerManager;
+    class TimerQueue;
+    struct ThreadTimers;
     class Timer : public std::enable_shared_from_this<Timer> {
         friend class TimerManager;
+        friend class TimerQueue;
+        friend class TimingWheel;
     public:
         typedef std::shared_ptr<Timer> ptr;
         bool cancel();
@@ -16,19 +23,65 @@ namespace Framework {
         bool reset(uint64_t ms, bool from_now);
     private:
         Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager); // 私有构造，不允许直接使用Timer，而是需要manager构造
-        Timer(uint64_t next);       
+        Timer(uint64_t next);
     private:
         bool m_recurring = false;        //是否循环定时器
         uint64_t m_ms = 0;               //执行周期
         uint64_t m_next = 0;             //下一次应该被触发的绝对时间
         std::function<void()> m_cb;
         TimerManager* m_manager = nullptr;
+
+        // 时间轮后端使用：侵入式链表指针，以及挂在时间轮上期间对自己的引用
+        Timer* m_wheelPrev = nullptr;
+        Timer* m_wheelNext = nullptr;
+        Timer** m_wheelSlot = nullptr;
+        Timer::ptr m_self;
+
+        // 线程私有定时器：所属线程的定时器队列，nullptr表示在共享队列里（由m_cb是否为空表示是否有效）
+        ThreadTimers* m_owner = nullptr;
+        std::atomic<bool> m_active = { true }; // 线程私有定时器是否有效，别的线程取消时只改这个标记
     private:
         struct Comparator {
             bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const; // 设定一个仿函数专门用于比较
         };
     };
 
+    // 一组定时器，std::set或时间轮，本身不加锁
+    class TimerQueue : private Noncopyable {
+    public:
+        TimerQueue(bool use_wheel);
+        ~TimerQueue();
+
+        // 返回新定时器是否比之前最早的还要早
+        bool insert(const Timer::ptr& timer);
+        bool erase(const Timer::ptr& timer);
+        bool empty() const { return m_size == 0; }
+        // 不加锁也可以读，用来在队列为空时跳过加锁
+        size_t size() const { return m_size; }
+        // 最早的到期时间（绝对毫秒），没有定时器返回~0ull
+        uint64_t nextExpire();
+        // 取出到期时间<=now_ms的定时器，rollover时取出全部
+        void listExpired(uint64_t now_ms, bool rollover, std::vector<Timer::ptr>& expired);
+    private:
+        bool m_useWheel;
+        std::set<Timer::ptr, Timer::Comparator> m_timers; // 有序存放Timer，但是set的默认排序按照指针地址排序，需要设定排序规则
+        std::unique_ptr<TimingWheel> m_wheel;
+        std::atomic<uint64_t> m_wheelDeadline = { ~0ull }; // 上次nextExpire算出的最早到期时间
+        std::atomic<size_t> m_size = { 0 };
+    };
+
+    /*
+    定时器管理，两种后端：
+        std::set（默认）：按到期时间排序，插入、删除O(log n)
+        分层时间轮（timer.wheel=true）：插入、删除O(1)，适合大量连接各自带超时、且大多数超时在到期前就被取消的场景
+    后端在构造时根据配置确定，之后不再改变
+
+    timer.per_thread=true时，调用过bindThreadTimers()的线程（IOManager的工作线程）有自己的定时器队列：
+        在本线程添加的定时器进入本线程的队列，添加、取消都不加锁，也不需要唤醒别的线程
+        别的线程取消/重设这个定时器时，给所属线程发一条消息，由所属线程下次计算超时的时候处理
+        定时器只由所属线程触发，所属线程一直在忙的话会相应地晚一点触发
+    其他线程添加的定时器仍然进入加锁的共享队列，任意空闲线程都可以触发
+    */
     class TimerManager {
         friend class Timer;
     public:
@@ -39,17 +92,39 @@ namespace Framework {
         void addTimer(Timer::ptr p, RWMutex::WriteLock& lock);
         // 条件定时器，满足条件才触发，weak_ptr引用计数为0时该条件变量失效
         Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+        // 距离本线程能触发的最早定时器还有多久（本线程的队列+共享队列）
         uint64_t getNextTimer();
         void listExpiredCb(std::vector<std::function<void()> >& cbs); // 列出已经到时间可以执行的定时器
     protected:
         virtual void onTimerInsertedAtFront() = 0;
+        // 当前线程能否拥有自己的定时器队列（即是否为会调用listExpiredCb的工作线程）
+        virtual bool isTimerThread() { return false; }
+        // 是否还有定时器，包括其他线程私有的
         bool hasTimer();
+        // 本线程私有的定时器队列里是否还有定时器（只有本线程能触发它们）
+        bool hasLocalTimers() const;
+        // 让当前线程拥有自己的定时器队列，timer.per_thread关闭时什么也不做
+        void bindThreadTimers();
+        void unbindThreadTimers();
     private:
-        bool detectClockRollover(uint64_t now_ms); // 防止服务器突然修改时间
+        bool detectClockRollover(uint64_t now_ms, uint64_t& previous); // 防止服务器突然修改时间
+        // 当前线程属于本manager的定时器队列，没有返回nullptr
+        ThreadTimers* localTimers() const;
+        // 处理其他线程发给本线程定时器队列的消息
+        void processMessages(ThreadTimers* local);
+        // 给定时器所属的线程发消息
+        void postMessage(const Timer::ptr& timer, int op, uint64_t ms = 0, bool from_now = false);
+        // 在所属线程上重设线程私有定时器的时间
+        bool applyReset(ThreadTimers* local, const Timer::ptr& timer, uint64_t ms, bool from_now, uint64_t now_ms);
     private:
         RWMutex m_mutex;
-        std::set<Timer::ptr, Timer::Comparator> m_timers; // 有序存放Timer，但是set的默认排序按照指针地址排序，需要设定排序规则
-        bool m_tickled = false;
+        TimerQueue m_timers;
+        std::atomic<bool> m_tickled = { false };
         uint64_t m_previous = 0;
+
+        bool m_useWheel = false;
+        bool m_perThread = false;
+        std::vector<std::unique_ptr<ThreadTimers> > m_threadTimers; // 受m_mutex保护，只增不减，manager析构时释放
+        std::atomic<size_t> m_threadTimerCount = { 0 }; // 各线程私有队列里有效定时器的总数
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,198 @@
+#include "macro.h"
+#include "timer.h"
+#include "timing_wheel.h"
+
+namespace Framework {
+    TimingWheel::TimingWheel(uint64_t now_ms)
+        : m_current(now_ms) {
+        for (int i = 0; i < LEVELS; ++i) {
+            m_slots[i].resize(Mask(i) + 1, nullptr);
+        }
+    }
+
+    TimingWheel::~TimingWheel() {
+        ASSERT(m_count == 0);
+    }
+
+    void TimingWheel::link(Timer** head, Timer* timer) {
+        timer->m_wheelSlot = head;
+        timer->m_wheelPrev = nullptr;
+        timer->m_wheelNext = *head;
+        if (*head) {
+            (*head)->m_wheelPrev = timer;
+        }
+        else if (head != &m_overdue) {
+            for (int level = 0; level < LEVELS; ++level) {
+                uint64_t index = head - &m_slots[level][0];
+                if (index <= Mask(level)) {
+                    m_bitmap[level][index >> 6] |= 1ull << (index & 63);
+                    break;
+                }
+            }
+        }
+        *head = timer;
+    }
+
+    void TimingWheel::markEmpty(Timer** head) {
+        if (head == &m_overdue) {
+            return;
+        }
+        for (int level = 0; level < LEVELS; ++level) {
+            uint64_t index = head - &m_slots[level][0];
+            if (index <= Mask(level)) {
+                m_bitmap[level][index >> 6] &= ~(1ull << (index & 63));
+                return;
+            }
+        }
+    }
+
+    int64_t TimingWheel::firstSet(int level, uint64_t start) const {
+        uint64_t size = Mask(level) + 1;
+        for (uint64_t dist = 0; dist < size;) {
+            uint64_t pos = (start + dist) & Mask(level);
+            uint64_t word = m_bitmap[level][pos >> 6] >> (pos & 63);
+            if (word) {
+                return dist + __builtin_ctzll(word);
+            }
+            dist += 64 - (pos & 63);
+        }
+        return -1;
+    }
+
+    void TimingWheel::insert(Timer* timer) {
+        ASSERT(!timer->m_wheelSlot);
+        ++m_count;
+        uint64_t expires = timer->m_next;
+        if (expires < m_current) {
+            // 这个刻度已经处理过了，放到溢出链表里，下次advance最先取出
+            link(&m_overdue, timer);
+            return;
+        }
+        uint64_t delta = expires - m_current;
+        if (delta >= MAX_SPAN) {
+            // 超出跨度的先按最远位置放，下沉到低层时会按真实的到期时间重新放置
+            delta = MAX_SPAN - 1;
+            expires = m_current + delta;
+        }
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ull << Shift(level + 1))) {
+            ++level;
+        }
+        link(slot(level, (expires >> Shift(level)) & Mask(level)), timer);
+    }
+
+    void TimingWheel::remove(Timer* timer) {
+        ASSERT(timer->m_wheelSlot);
+        if (timer->m_wheelPrev) {
+            timer->m_wheelPrev->m_wheelNext = timer->m_wheelNext;
+        }
+        else {
+            *timer->m_wheelSlot = timer->m_wheelNext;
+            if (!timer->m_wheelNext) {
+                markEmpty(timer->m_wheelSlot);
+            }
+        }
+        if (timer->m_wheelNext) {
+            timer->m_wheelNext->m_wheelPrev = timer->m_wheelPrev;
+        }
+        timer->m_wheelSlot = nullptr;
+        timer->m_wheelPrev = nullptr;
+        timer->m_wheelNext = nullptr;
+        --m_count;
+    }
+
+    uint64_t TimingWheel::cascade(int level, uint64_t index) {
+        Timer* it = *slot(level, index);
+        *slot(level, index) = nullptr;
+        markEmpty(slot(level, index));
+        while (it) {
+            Timer* next = it->m_wheelNext;
+            it->m_wheelSlot = nullptr;
+            --m_count;
+            insert(it);
+            it = next;
+        }
+        return index;
+    }
+
+    uint64_t TimingWheel::nextExpire() const {
+        if (m_count == 0) {
+            return ~0ull;
+        }
+        if (m_overdue) {
+            return 0;
+        }
+        uint64_t next = ~0ull;
+        // 第0层的槽里都是精确到期时间
+        int64_t dist = firstSet(0, m_current & Mask(0));
+        if (dist >= 0) {
+            next = m_current + dist;
+        }
+        // 高层的槽只知道下沉时刻，这个时刻不晚于槽里任何定时器的到期时间
+        // 下沉发生在刻度恰好是2^Shift(level)整数倍、且该层下标等于槽号的时候
+        for (int level = 1; level < LEVELS; ++level) {
+            uint64_t base = (m_current + (1ull << Shift(level)) - 1) >> Shift(level);
+            dist = firstSet(level, base & Mask(level));
+            if (dist >= 0) {
+                uint64_t tick = (base + dist) << Shift(level);
+                if (tick < next) {
+                    next = tick;
+                }
+            }
+        }
+        return next;
+    }
+
+    void TimingWheel::advance(uint64_t now_ms, std::vector<Timer*>& expired) {
+        while (m_overdue) {
+            Timer* timer = m_overdue;
+            remove(timer);
+            expired.push_back(timer);
+        }
+        while (m_count && m_current <= now_ms) {
+            uint64_t index = m_current & Mask(0);
+            // 第0层转完一圈，依次把上层对应的槽下沉一层，上层下标不为0说明更高层还没转到
+            if (index == 0) {
+                for (int level = 1; level < LEVELS; ++level) {
+                    if (cascade(level, (m_current >> Shift(level)) & Mask(level)) != 0) {
+                        break;
+                    }
+                }
+            }
+            Timer** head = slot(0, index);
+            while (*head) {
+                Timer* timer = *head;
+                remove(timer);
+                expired.push_back(timer);
+            }
+            ++m_current;
+            // 中间没有非空的槽、也没有要下沉的槽，直接跳过去
+            uint64_t next = nextExpire();
+            if (next > m_current) {
+                m_current = next <= now_ms ? next : now_ms + 1;
+            }
+        }
+        // 空的时间轮直接跳到当前时间，避免下次插入时从很久以前的刻度开始转
+        if (!m_count && m_current < now_ms) {
+            m_current = now_ms;
+        }
+    }
+
+    void TimingWheel::clear(uint64_t now_ms, std::vector<Timer*>& expired) {
+        while (m_overdue) {
+            Timer* timer = m_overdue;
+            remove(timer);
+            expired.push_back(timer);
+        }
+        for (int level = 0; level < LEVELS; ++level) {
+            for (auto& head : m_slots[level]) {
+                while (head) {
+                    Timer* timer = head;
+                    remove(timer);
+                    expired.push_back(timer);
+                }
+            }
+        }
+        m_current = now_ms;
+    }
+}
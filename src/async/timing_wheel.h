@@ -0,0 +1,63 @@
+#pragma once
+// 分层时间轮，TimerManager的可选后端
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace Framework {
+    class Timer;
+
+    /*
+    刻度1ms，第0层256个槽，往上4层各64个槽，总跨度2^32ms（约49天），更远的定时器先放在最高层最后一格，下沉时重新计算位置
+    定时器通过Timer里的侵入式指针挂在槽上，插入、删除都是O(1)，不额外申请内存
+    每层用位图记录哪些槽非空，找下一个到期时间、跳过空转的刻度都只需要扫几个字
+    时间轮自己不加锁，由TimerManager的锁保护
+    */
+    class TimingWheel : private Noncopyable {
+    public:
+        TimingWheel(uint64_t now_ms);
+        ~TimingWheel();
+
+        void insert(Timer* timer);
+        void remove(Timer* timer);
+        bool empty() const { return m_count == 0; }
+        size_t size() const { return m_count; }
+
+        // 最早可能到期的时间点：第0层是精确值，更高层返回该槽下沉的时刻（不晚于其中任何定时器的到期时间）
+        // 没有定时器时返回~0ull
+        uint64_t nextExpire() const;
+        // 把到期时间<=now_ms的定时器摘下来放到expired里
+        void advance(uint64_t now_ms, std::vector<Timer*>& expired);
+        // 摘下全部定时器（时钟回拨时使用），并把时间轮的当前时间设为now_ms
+        void clear(uint64_t now_ms, std::vector<Timer*>& expired);
+    private:
+        static const int ROOT_BITS = 8;
+        static const int LEVEL_BITS = 6;
+        static const int LEVELS = 5; // 含第0层
+        static const uint64_t ROOT_SIZE = 1ull << ROOT_BITS;
+        static const uint64_t LEVEL_SIZE = 1ull << LEVEL_BITS;
+        static const uint64_t MAX_SPAN = 1ull << (ROOT_BITS + LEVEL_BITS * (LEVELS - 1));
+
+        static int Shift(int level) { return level == 0 ? 0 : ROOT_BITS + LEVEL_BITS * (level - 1); }
+        static uint64_t Mask(int level) { return level == 0 ? ROOT_SIZE - 1 : LEVEL_SIZE - 1; }
+
+        Timer** slot(int level, uint64_t index) { return &m_slots[level][index]; }
+        void link(Timer** head, Timer* timer);
+        // 槽变空时清掉位图里对应的位
+        void markEmpty(Timer** head);
+        // 从start开始（环形）找第一个非空的槽，返回距离，没有返回-1
+        int64_t firstSet(int level, uint64_t start) const;
+        // 把level层index槽里的定时器重新分配到更低的层，返回index
+        uint64_t cascade(int level, uint64_t index);
+    private:
+        uint64_t m_current; // 下一个要处理的刻度（绝对毫秒）
+        size_t m_count = 0;
+        std::vector<Timer*> m_slots[LEVELS];
+        uint64_t m_bitmap[LEVELS][ROOT_SIZE / 64] = {};
+        Timer* m_overdue = nullptr; // 插入时已经过期的定时器
+    };
+}
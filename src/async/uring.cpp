@@ -0,0 +1,213 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "log.h"
+#include "macro.h"
+#include "uring.h"
+
+namespace Framework {
+    static Logger::ptr g_logger = LOG_NAME("system");
+
+    UringOp UringOp::Buffer(uint8_t opcode, const void* buf, size_t len, int flags) {
+        UringOp op;
+        op.opcode = opcode;
+        op.addr = (uint64_t)buf;
+        op.len = (uint32_t)len;
+        op.msgFlags = flags;
+        return op;
+    }
+
+    UringOp UringOp::Vector(uint8_t opcode, const iovec* iov, int iovcnt) {
+        UringOp op;
+        op.opcode = opcode;
+        op.addr = (uint64_t)iov;
+        op.len = (uint32_t)iovcnt;
+        return op;
+    }
+
+    UringOp UringOp::Message(uint8_t opcode, const msghdr* msg, int flags) {
+        UringOp op;
+        op.opcode = opcode;
+        op.addr = (uint64_t)msg;
+        op.len = 1;
+        op.msgFlags = flags;
+        return op;
+    }
+
+    UringOp UringOp::Named(uint8_t opcode, const void* buf, size_t len, int flags,
+        const sockaddr* addr, socklen_t namelen, socklen_t* addrlen) {
+        UringOp op;
+        op.opcode = opcode;
+        op.len = 1;
+        op.msgFlags = flags;
+        op.useMsg = true;
+        op.iov.iov_base = (void*)buf;
+        op.iov.iov_len = len;
+        memset(&op.msg, 0, sizeof(op.msg));
+        op.msg.msg_name = (void*)addr;
+        op.msg.msg_namelen = addr ? (addrlen ? *addrlen : namelen) : 0;
+        op.addrlen = addr ? addrlen : nullptr;
+        return op;
+    }
+
+    UringOp UringOp::Accept(sockaddr* addr, socklen_t* addrlen, int flags) {
+        UringOp op;
+        op.opcode = IORING_OP_ACCEPT;
+        op.addr = (uint64_t)addr;
+        op.addr2 = (uint64_t)addrlen;
+        op.msgFlags = flags;
+        return op;
+    }
+
+    void UringOp::prepare(io_uring_sqe* sqe, int fd) {
+        if (useMsg) {
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            addr = (uint64_t)&msg;
+        }
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = addr;
+        sqe->len = len;
+        sqe->msg_flags = msgFlags; // 与rw_flags、accept_flags共用一个union
+        sqe->addr2 = addr2;
+        // read/write对socket没有偏移的概念，-1表示使用文件当前位置
+        if (opcode == IORING_OP_READ || opcode == IORING_OP_WRITE
+            || opcode == IORING_OP_READV || opcode == IORING_OP_WRITEV) {
+            sqe->off = (uint64_t)-1;
+        }
+    }
+
+    void UringOp::complete() {
+        if (addrlen) {
+            *addrlen = msg.msg_namelen;
+        }
+    }
+}
+
+namespace Framework {
+    static int uring_setup(uint32_t entries, io_uring_params* p) {
+        return (int)syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    bool IoUring::Supported() {
+        static int s_supported = -1;
+        if (s_supported >= 0) {
+            return s_supported;
+        }
+        s_supported = 0;
+        IoUring ring(4);
+        // 超时等待要用EXT_ARG（5.11），取消某个fd上的全部操作要用ASYNC_CANCEL_FD（5.19）
+        if (!ring.isValid() || !(ring.m_features & IORING_FEAT_EXT_ARG) || !(ring.m_features & IORING_FEAT_NODROP)) {
+            return s_supported;
+        }
+        int fds[2];
+        if (pipe(fds)) {
+            return s_supported;
+        }
+        ring.push(1, [&fds](io_uring_sqe** sqes) {
+            sqes[0]->opcode = IORING_OP_ASYNC_CANCEL;
+            sqes[0]->fd = fds[0];
+            sqes[0]->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        });
+        ring.submit(true, 1000);
+        ring.reap([](io_uring_cqe& cqe) {
+            // 没有可取消的操作应当返回-ENOENT，不认识这个标志会返回-EINVAL
+            s_supported = cqe.res == -ENOENT || cqe.res >= 0;
+        });
+        close(fds[0]);
+        close(fds[1]);
+        return s_supported;
+    }
+
+    IoUring::IoUring(uint32_t entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // 每个挂起的IO都占一个CQE，完成队列给大一些，两次收割之间突发的完成不至于溢出
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 8;
+        m_fd = uring_setup(entries, &p);
+        if (m_fd < 0) {
+            LOG_ERROR(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno << " errstr=" << strerror(errno);
+            m_fd = -1;
+            return;
+        }
+        m_features = p.features;
+
+        m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        // 5.4之后两个环可以用同一次mmap映射
+        if (m_features & IORING_FEAT_SINGLE_MMAP) {
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        }
+        m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        ASSERT(m_sqRing != MAP_FAILED);
+        if (m_features & IORING_FEAT_SINGLE_MMAP) {
+            m_cqRing = m_sqRing;
+        }
+        else {
+            m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            ASSERT(m_cqRing != MAP_FAILED);
+        }
+        m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        ASSERT(m_sqes != MAP_FAILED);
+
+        char* sq = (char*)m_sqRing;
+        m_sqHead = (uint32_t*)(sq + p.sq_off.head);
+        m_sqTail = (uint32_t*)(sq + p.sq_off.tail);
+        m_sqMask = *(uint32_t*)(sq + p.sq_off.ring_mask);
+        m_sqEntries = p.sq_entries;
+        m_sqTailLocal = *m_sqTail;
+        // SQE按下标一一对应地放进提交数组，之后只需要推进tail
+        uint32_t* array = (uint32_t*)(sq + p.sq_off.array);
+        for (uint32_t i = 0; i < m_sqEntries; ++i) {
+            array[i] = i;
+        }
+
+        char* cq = (char*)m_cqRing;
+        m_cqHead = (uint32_t*)(cq + p.cq_off.head);
+        m_cqTail = (uint32_t*)(cq + p.cq_off.tail);
+        m_cqMask = *(uint32_t*)(cq + p.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    }
+
+    IoUring::~IoUring() {
+        if (m_fd < 0) {
+            return;
+        }
+        munmap(m_sqes, m_sqesSize);
+        if (m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        munmap(m_sqRing, m_sqRingSize);
+        close(m_fd);
+    }
+
+    int IoUring::enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, void* arg, size_t argsz) {
+        int rt = (int)syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, arg, argsz);
+        return rt < 0 ? -errno : rt;
+    }
+
+    int IoUring::submit(bool wait, int timeout_ms) {
+        uint32_t to_submit = pending();
+        if (!wait) {
+            return to_submit ? enter(to_submit, 0, 0) : 0;
+        }
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        __kernel_timespec ts;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+            arg.ts = (uint64_t)&ts;
+        }
+        return enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+}
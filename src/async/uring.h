@@ -0,0 +1,134 @@
+#pragma once
+// io_uring的薄封装：直接使用系统调用，不依赖liburing
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <memory>
+
+#include "macro.h"
+#include "multithread.h"
+#include "noncopyable.h"
+
+namespace Framework {
+    // 一次交给io_uring的IO操作，由hook的函数按原函数的参数填写
+    struct UringOp {
+        uint8_t opcode = IORING_OP_NOP;
+        uint64_t addr = 0;      // 缓冲区、iovec数组或msghdr
+        uint32_t len = 0;       // 缓冲区长度或iovec个数
+        uint32_t msgFlags = 0;  // recv/send/accept4的flags
+        uint64_t addr2 = 0;     // accept的地址长度指针
+        // recvfrom/sendto没有对应的操作码，借用recvmsg/sendmsg
+        bool useMsg = false;
+        iovec iov;
+        msghdr msg;
+        socklen_t* addrlen = nullptr; // recvfrom完成后把对端地址长度写回这里
+
+        // read/write/recv/send
+        static UringOp Buffer(uint8_t opcode, const void* buf, size_t len, int flags = 0);
+        // readv/writev
+        static UringOp Vector(uint8_t opcode, const iovec* iov, int iovcnt);
+        // recvmsg/sendmsg
+        static UringOp Message(uint8_t opcode, const msghdr* msg, int flags);
+        // recvfrom(addrlen为输入输出)/sendto(addrlen为nullptr，长度取namelen)
+        static UringOp Named(uint8_t opcode, const void* buf, size_t len, int flags,
+            const sockaddr* addr, socklen_t namelen, socklen_t* addrlen);
+        static UringOp Accept(sockaddr* addr, socklen_t* addrlen, int flags = 0);
+
+        // 填写SQE，此时对象的地址已经固定，内部的msghdr可以指向自己
+        void prepare(io_uring_sqe* sqe, int fd);
+        // 操作成功完成后写回输出参数
+        void complete();
+    };
+
+    /*
+    一个io_uring实例：提交队列可以由多个线程填写（加锁），完成队列只能由一个线程收割
+    SQE填好后先不提交，等调用方下次submit时一起进入内核，一次系统调用提交一批
+    */
+    class IoUring : private Noncopyable {
+    public:
+        typedef std::shared_ptr<IoUring> ptr;
+        static const uint32_t MAX_LINKED = 4; // 一次push最多连续填写的SQE数
+
+        // 内核是否支持本框架用到的io_uring特性，只探测一次
+        static bool Supported();
+
+        IoUring(uint32_t entries);
+        ~IoUring();
+
+        bool isValid() const { return m_fd >= 0; }
+
+        // 在提交队列里连续取count个SQE交给fill填写，多个线程可以同时调用
+        // 队列放不下时先把已有的提交给内核腾出空间
+        template<class F>
+        void push(uint32_t count, F fill) {
+            ASSERT(count <= MAX_LINKED);
+            Spinlock::Lock lock(m_sqMutex);
+            while (m_sqEntries - pending() < count) {
+                enter(pending(), 0, 0);
+            }
+            io_uring_sqe* sqes[MAX_LINKED];
+            uint32_t tail = m_sqTailLocal;
+            for (uint32_t i = 0; i < count; ++i) {
+                sqes[i] = &m_sqes[(tail + i) & m_sqMask];
+                *sqes[i] = io_uring_sqe{};
+            }
+            fill(sqes);
+            m_sqTailLocal = tail + count;
+            __atomic_store_n(m_sqTail, m_sqTailLocal, __ATOMIC_RELEASE);
+        }
+
+        // 已填写、内核还没取走的SQE数
+        uint32_t pending() const {
+            return __atomic_load_n(m_sqTail, __ATOMIC_ACQUIRE) - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        }
+
+        // 提交全部SQE；wait为true时等到至少一个完成或超时（timeout_ms<0表示不限时）
+        // 返回io_uring_enter的结果，出错返回-errno
+        int submit(bool wait = false, int timeout_ms = -1);
+
+        // 是否有已完成、还没收割的CQE，只读一下CQ环的头尾，只能由收割的线程调用
+        bool hasCompletions() const {
+            return *m_cqHead != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        }
+
+        // 收割所有已完成的CQE，只能由一个线程调用
+        template<class F>
+        size_t reap(F f) {
+            uint32_t head = *m_cqHead;
+            uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            size_t n = 0;
+            for (; head != tail; ++head, ++n) {
+                f(m_cqes[head & m_cqMask]);
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+            return n;
+        }
+    private:
+        int enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, void* arg = nullptr, size_t argsz = 0);
+    private:
+        int m_fd = -1;
+        uint32_t m_features = 0;
+
+        void* m_sqRing = nullptr;
+        size_t m_sqRingSize = 0;
+        void* m_cqRing = nullptr;
+        size_t m_cqRingSize = 0;
+        io_uring_sqe* m_sqes = nullptr;
+        size_t m_sqesSize = 0;
+
+        Spinlock m_sqMutex;
+        uint32_t* m_sqHead = nullptr;
+        uint32_t* m_sqTail = nullptr;
+        uint32_t m_sqTailLocal = 0;
+        uint32_t m_sqMask = 0;
+        uint32_t m_sqEntries = 0;
+
+        uint32_t* m_cqHead = nullptr;
+        uint32_t* m_cqTail = nullptr;
+        uint32_t m_cqMask = 0;
+        io_uring_cqe* m_cqes = nullptr;
+    };
+}
@@ -1,9 +1,26 @@
 #include <fnmatch.h>
 
+#include "cancel_context.h"
+#include "scheduler.h"
 #include "servlet.h"
 
 namespace Framework {
     namespace HTTP {
+        // 切换当前协程的优先级；降低时让出一次，排到新优先级的队尾，让已经在排队的更高优先级任务先执行
+        static void ApplyPriority(Fiber::Priority priority) {
+            if (priority == Fiber::INHERIT) {
+                return;
+            }
+            Fiber::Priority cur = Fiber::GetCurrentPriority();
+            if (priority == cur) {
+                return;
+            }
+            Fiber::GetThis()->setPriority(priority);
+            if (priority > cur && Scheduler::GetThis()) {
+                Fiber::YieldToReady();
+            }
+        }
+
         FunctionServlet::FunctionServlet(callback cb)
             :Servlet("FunctionServlet")
             , m_cb(cb) {
@@ -25,7 +42,15 @@ namespace Framework {
             , Framework::HTTP::HttpSession::ptr session) {
             auto slt = getServlet(request->getPath());
             if (slt) {
-                slt->handle(request, response, session);
+                ApplyPriority(slt->getPriority());
+                if (slt->getTimeout()) {
+                    // 路由的时限挂在连接协程已有的上下文（HttpServer的整体时限）下面，两者取先到的
+                    CancelScope scope(CancelContext::Create(slt->getTimeout(), CancelContext::GetCurrent()));
+                    slt->handle(request, response, session);
+                }
+                else {
+                    slt->handle(request, response, session);
+                }
             }
             return 0;
         }
@@ -35,9 +60,12 @@ namespace Framework {
             m_datas[uri] = slt;
         }
 
-        void ServletDispatch::addMatchedServlet(const std::string& uri, FunctionServlet::callback cb) {
+        void ServletDispatch::addMatchedServlet(const std::string& uri, FunctionServlet::callback cb, Fiber::Priority priority, uint64_t timeout_ms) {
+            FunctionServlet::ptr slt(new FunctionServlet(cb));
+            slt->setPriority(priority);
+            slt->setTimeout(timeout_ms);
             RWMutex::WriteLock lock(m_mutex);
-            m_datas[uri].reset(new FunctionServlet(cb));
+            m_datas[uri] = slt;
         }
 
         void ServletDispatch::addFuzzyServlet(const std::string& uri
@@ -53,8 +81,11 @@ namespace Framework {
         }
 
         void ServletDispatch::addFuzzyServlet(const std::string& uri
-            , FunctionServlet::callback cb) {
-            return addFuzzyServlet(uri, FunctionServlet::ptr(new FunctionServlet(cb)));
+            , FunctionServlet::callback cb, Fiber::Priority priority, uint64_t timeout_ms) {
+            FunctionServlet::ptr slt(new FunctionServlet(cb));
+            slt->setPriority(priority);
+            slt->setTimeout(timeout_ms);
+            return addFuzzyServlet(uri, slt);
         }
 
         void ServletDispatch::delMatchedServlet(const std::string& uri) {
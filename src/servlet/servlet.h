@@ -4,6 +4,7 @@
 #include <memory>
 #include <string>
 
+#include "fiber.h"
 #include "http.h"
 #include "http_session.h"
 #include "multithread.h"
@@ -57,8 +58,16 @@ namespace Framework {
                 , Framework::HTTP::HttpSession::ptr session) = 0;
 
             const std::string& getName() const { return m_name; }
+            // 路由的调度优先级，ServletDispatch分发前把处理请求的协程切到这个优先级；INHERIT表示沿用连接协程的优先级
+            Fiber::Priority getPriority() const { return m_priority; }
+            void setPriority(Fiber::Priority v) { m_priority = v; }
+            // 路由的处理时限（毫秒），ServletDispatch分发前给处理请求的协程装上带这个截止时间的取消上下文；0表示不限
+            uint64_t getTimeout() const { return m_timeout; }
+            void setTimeout(uint64_t v) { m_timeout = v; }
         protected:
             std::string m_name;
+            Fiber::Priority m_priority = Fiber::INHERIT;
+            uint64_t m_timeout = 0;
         };
 
         class FunctionServlet : public Servlet {
@@ -87,9 +96,9 @@ namespace Framework {
                 , Framework::HTTP::HttpSession::ptr session) override;
 
             void addMatchedServlet(const std::string& uri, Servlet::ptr slt);
-            void addMatchedServlet(const std::string& uri, FunctionServlet::callback cb);
+            void addMatchedServlet(const std::string& uri, FunctionServlet::callback cb, Fiber::Priority priority = Fiber::INHERIT, uint64_t timeout_ms = 0);
             void addFuzzyServlet(const std::string& uri, Servlet::ptr slt);
-            void addFuzzyServlet(const std::string& uri, FunctionServlet::callback cb);
+            void addFuzzyServlet(const std::string& uri, FunctionServlet::callback cb, Fiber::Priority priority = Fiber::INHERIT, uint64_t timeout_ms = 0);
 
             void delMatchedServlet(const std::string& uri);
             void delFuzzyServlet(const std::string& uri);
@@ -26,8 +26,7 @@ namespace Framework {
             m_sock = sock;
             m_isConnected = true;
             initSock();
-            getLocalAddress();
-            getRemoteAddress();
+            // 本端/对端地址等到getLocalAddress/getRemoteAddress时再取，短连接大多用不到，省两次系统调用和两次分配
             return true;
         }
         return false;
@@ -194,6 +193,11 @@ namespace Framework {
             << " family=" << m_family
             << " type=" << m_type
             << " protocol=" << m_protocol;
+        // 地址是按需获取的，打印时才取
+        if (m_isConnected) {
+            const_cast<Socket*>(this)->getLocalAddress();
+            const_cast<Socket*>(this)->getRemoteAddress();
+        }
         if (m_localAddress) {
             os << " local_address=" << m_localAddress->toString();
         }
@@ -225,6 +229,29 @@ namespace Framework {
     bool Socket::cancelAll() {
         return IOManager::GetThis()->cancelAll(m_sock);
     }
+
+    bool Socket::setReusePort() {
+        if (!isValid()) {
+            newSock();
+        }
+        int val = 1;
+        return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+    }
+
+    Socket::ptr Socket::dup() {
+        int fd = ::dup(m_sock);
+        if (fd == -1) {
+            LOG_ERROR(g_logger) << "dup(" << m_sock << ") errno=" << errno << " errstr=" << strerror(errno);
+            return nullptr;
+        }
+        FdMgr::GetInstance()->get(fd, true); // dup没有hook，手动登记，之后的IO才会走协程调度
+        Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+        sock->m_sock = fd;
+        sock->m_isConnected = m_isConnected;
+        sock->m_localAddress = m_localAddress;
+        sock->m_remoteAddress = m_remoteAddress;
+        return sock;
+    }
 }
 
 // socket API
@@ -277,6 +304,28 @@ namespace Framework {
         }
         return nullptr;
     }
+
+    size_t Socket::acceptBatch(std::vector<Socket::ptr>& clients, size_t max) {
+        size_t count = 0;
+        // 第一个走hook的accept4，没有连接时挂起协程等待
+        int newsock = ::accept4(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        while (newsock != -1) {
+            Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+            if (sock->init(newsock)) {
+                clients.push_back(sock);
+                ++count;
+            }
+            if (count >= max) {
+                break;
+            }
+            // 之后直接调用原函数，EAGAIN说明backlog已经取空，不再挂起
+            newsock = accept4_f(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (newsock != -1) {
+                FdMgr::GetInstance()->get(newsock, true); // 没经过hook，手动登记
+            }
+        }
+        return count;
+    }
     
     int Socket::send(const void* buffer, size_t length, int flags) {
         if (isConnected()) {
@@ -38,10 +38,19 @@ namespace Framework {
             return setOption(level, option, &value, sizeof(T));
         }
 
+        // 允许多个socket绑定同一地址（SO_REUSEPORT），由内核在它们之间分发连接，需在bind之前调用
+        bool setReusePort();
+        // 复制出一个共享同一个内核socket的新fd，例如让多个线程各自等待同一个监听socket
+        Socket::ptr dup();
+
         // API
         bool bind(const Address::ptr addr);
         bool listen(int backlog = SOMAXCONN);
         Socket::ptr accept();       
+        // 等到至少一个连接后，把backlog里已经完成握手的连接一次取空（最多max个），追加到clients，返回取到的个数
+        // 新连接直接以SOCK_NONBLOCK|SOCK_CLOEXEC创建，地址等到第一次用到时再取
+        // 一个也没取到时返回0，原因留在errno里，由调用者决定是否记录
+        size_t acceptBatch(std::vector<Socket::ptr>& clients, size_t max);
 
         int send(const void* buffer, size_t length, int flags = 0);
         int send(const iovec* buffers, size_t length, int flags = 0); // length = buffers数组里的个数
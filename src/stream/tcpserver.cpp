@@ -1,3 +1,9 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
 #include "config.h"
 #include "log.h"
 #include "tcpserver.h"
@@ -7,12 +13,26 @@ namespace Framework {
         Framework::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+    static Framework::ConfigVar<std::string>::ptr g_tcp_server_accept_mode =
+        Framework::Config::Lookup("tcp_server.accept_mode", std::string("single"),
+            "tcp server accept mode: single, reuseport (one listener per accept thread) or exclusive (EPOLLEXCLUSIVE)");
+
+    static Framework::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+        Framework::Config::Lookup("tcp_server.accept_batch", (uint32_t)1,
+            "tcp server max connections taken from the backlog per wakeup, handed to workers in one schedule");
+
+    static Framework::ConfigVar<bool>::ptr g_tcp_server_overload_pause_accept =
+        Framework::Config::Lookup("tcp_server.overload_pause_accept", true,
+            "tcp server stops accepting while the client worker is overloaded (scheduler.codel_target_ms), "
+            "turn off for short-lived connections so new requests get a fast rejection instead of aging in the backlog");
+
     static Framework::Logger::ptr g_logger = LOG_NAME("system");
 
     TcpServer::TcpServer(Framework::IOManager* handleClientWorker, Framework::IOManager* acceptWorker)
         : m_acceptWorker(acceptWorker),
         m_handleClientWorker(handleClientWorker),
         m_readTimeout(g_tcp_server_read_timeout->getValue()),
+        m_overloadPauseAccept(g_tcp_server_overload_pause_accept->getValue()),
         m_name("MyServer/1.0.0"),
         m_isStop(true) {
     }
@@ -32,46 +52,141 @@ namespace Framework {
     }
 
     bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& failedAddrs) {
+        std::string mode = g_tcp_server_accept_mode->getValue();
+        std::vector<int> threads;
+        if (mode == "reuseport" || mode == "exclusive") {
+            threads = m_acceptWorker->getWorkerThreadIds();
+        }
+        else if (mode != "single") {
+            LOG_WARN(g_logger) << "unknown tcp_server.accept_mode=" << mode << ", use single";
+        }
         // bind + listen
         for (auto& addr : addrs) {
-            Socket::ptr sock = Socket::CreateTCP(addr);
-            if (!sock->bind(addr)) {
-                LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno) << " addr=[" << addr->toString() << "]";
-                failedAddrs.push_back(addr);
-                continue;
-            }
-            if (!sock->listen()) {
-                LOG_ERROR(g_logger) << "listen fail errno=" << errno << " errstr=" << strerror(errno) << " addr=[" << addr->toString() << "]";
+            if (!bindListeners(addr, mode, threads)) {
                 failedAddrs.push_back(addr);
-                continue;
             }
-            m_socks.push_back(sock);
         }
         if (!failedAddrs.empty()) {
             m_socks.clear();
+            m_acceptThreads.clear();
             return false;
         }
+        m_localHandoff = !threads.empty() && m_acceptWorker == m_handleClientWorker;
         for (auto& i : m_socks) {
             LOG_INFO(g_logger) << "server bind success: " << i->toString();
         }
         return true;
     }
 
+    Socket::ptr TcpServer::listenOn(Address::ptr addr, bool reuse_port) {
+        Socket::ptr sock = Socket::CreateTCP(addr);
+        if (reuse_port && !sock->setReusePort()) {
+            return nullptr;
+        }
+        if (!sock->bind(addr)) {
+            LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno) << " addr=[" << addr->toString() << "]";
+            return nullptr;
+        }
+        if (!sock->listen()) {
+            LOG_ERROR(g_logger) << "listen fail errno=" << errno << " errstr=" << strerror(errno) << " addr=[" << addr->toString() << "]";
+            return nullptr;
+        }
+        return sock;
+    }
+
+    bool TcpServer::bindListeners(Address::ptr addr, const std::string& mode, const std::vector<int>& threads) {
+        bool reuse_port = mode == "reuseport" && !threads.empty();
+        bool exclusive = mode == "exclusive" && !threads.empty();
+        Socket::ptr sock = listenOn(addr, reuse_port);
+        if (!sock && reuse_port) {
+            LOG_WARN(g_logger) << "SO_REUSEPORT listen fail errno=" << errno << " errstr=" << strerror(errno)
+                << " addr=[" << addr->toString() << "], fall back to EPOLLEXCLUSIVE";
+            reuse_port = false;
+            exclusive = true;
+            sock = listenOn(addr, false);
+        }
+        if (!sock) {
+            return false;
+        }
+        if (!reuse_port && !exclusive) {
+            m_socks.push_back(sock);
+            m_acceptThreads.push_back(-1);
+            return true;
+        }
+
+        // 第一个socket归第一个线程，其余线程各建一个；端口为0时后面的要绑到第一个实际分到的端口上
+        Address::ptr local = sock->getLocalAddress();
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (i > 0) {
+                sock = reuse_port ? listenOn(local, true) : sock->dup();
+                if (!sock) {
+                    return false;
+                }
+            }
+            if (exclusive) {
+                m_acceptWorker->setExclusiveWakeup(sock->getSocket());
+            }
+            m_socks.push_back(sock);
+            m_acceptThreads.push_back(threads[i]);
+        }
+        return true;
+    }
+
     void TcpServer::handleClient(Socket::ptr client) {
         LOG_INFO(g_logger) << "handleClient: " << client->toString();
     }
 
     void TcpServer::startAccept(Socket::ptr sock) {
         // LOG_INFO(g_logger) << "startAccept!!";
+        size_t batch = std::max(g_tcp_server_accept_batch->getValue(), (uint32_t)1);
+        std::vector<Socket::ptr> clients;
+        // 按目标线程分组，每组一次schedule
+        std::vector<std::pair<int, std::vector<std::function<void()> > > > groups;
+        uint64_t paused_since = 0;
         while (!m_isStop) {
-            Socket::ptr client = sock->accept();
-            if (client) {
+            // 处理连接的调度器过载时（scheduler.codel_target_ms）先不接新连接，让它们留在内核的backlog里，
+            // 已有的请求先处理完；每隔一个target检查一次，过载解除后再接
+            if (m_overloadPauseAccept && m_handleClientWorker->isOverloaded()) {
+                if (!paused_since) {
+                    paused_since = GetCurrentUS();
+                }
+                usleep(m_handleClientWorker->getCodelTargetUs());
+                continue;
+            }
+            if (paused_since) {
+                // 暂停期间到达的连接都在backlog里等着，接下来这一轮会一口气取完，它们的排队时间从暂停时算起，
+                // 早已超时的连接在HttpServer里会被直接拒绝
+                Scheduler::AddCurrentTaskDelay(GetCurrentUS() - paused_since);
+                paused_since = 0;
+            }
+            clients.clear();
+            if (!sock->acceptBatch(clients, batch)) {
+                // stop()会取消并关闭监听socket，这时的失败是预期的，安静退出
+                if (m_isStop || errno == EBADF) {
+                    break;
+                }
+                if (errno != EAGAIN) {
+                    LOG_ERROR(g_logger) << "accept errno=" << errno << " errstr=" << strerror(errno);
+                }
+                continue;
+            }
+            for (auto& client : clients) {
                 client->setRecvTimeout(m_readTimeout);
+                // 每线程监听时连接留在接受它的线程上，fd第一次等待时自然绑定到本线程的reactor
+                // 否则多reactor模式下连接固定交给负载最低的线程，之后它的事件和协程都留在那个线程上
+                int thread = m_localHandoff ? GetThreadId() : m_handleClientWorker->assignFd(client->getSocket());
+                auto it = std::find_if(groups.begin(), groups.end(), [thread](const auto& g) { return g.first == thread; });
+                if (it == groups.end()) {
+                    it = groups.insert(groups.end(), std::make_pair(thread, std::vector<std::function<void()> >()));
+                }
                 // 绑定到自己的智能指针上确保智能指针存活不被释放
-                m_handleClientWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+                it->second.push_back(std::bind(&TcpServer::handleClient, shared_from_this(), client));
             }
-            else {
-                LOG_ERROR(g_logger) << "accept errno=" << errno << " errstr=" << strerror(errno);
+            for (auto& g : groups) {
+                if (!g.second.empty()) {
+                    m_handleClientWorker->schedule(g.second.begin(), g.second.end(), g.first);
+                    g.second.clear();
+                }
             }
         }
     }
@@ -82,9 +197,9 @@ namespace Framework {
         }
         m_isStop = false;
         // LOG_INFO(g_logger) << m_isStop << "!!";
-        for (auto& sock : m_socks) {
+        for (size_t i = 0; i < m_socks.size(); ++i) {
             // LOG_INFO(g_logger) << "for!!";
-            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]), m_acceptThreads[i]);
         }
         return true;
     }
@@ -98,6 +213,7 @@ namespace Framework {
                 sock->close();
             }
             m_socks.clear();
+            m_acceptThreads.clear();
         });
     }
 }
\ No newline at end of file
@@ -27,14 +27,32 @@ namespace Framework {
         void setName(const std::string& v) { m_name = v; }
 
         bool isStop() const { return m_isStop; }
+        IOManager* getHandleClientWorker() const { return m_handleClientWorker; }
     protected:
         virtual void handleClient(Socket::ptr client);
         virtual void startAccept(Socket::ptr sock);
+    private:
+        // 创建监听socket并bind+listen，失败返回nullptr
+        Socket::ptr listenOn(Address::ptr addr, bool reuse_port);
+        // 为一个地址建立监听：默认一个socket，reuseport/exclusive模式下每个accept线程一个
+        bool bindListeners(Address::ptr addr, const std::string& mode, const std::vector<int>& threads);
     private:
         std::vector<Socket::ptr> m_socks; // 可同时listen多个地址
+        /*
+        tcp_server.accept_mode:
+            single（默认）：每个地址一个监听socket，一个accept协程，连接分给负载最低的线程
+            reuseport：每个地址为m_acceptWorker的每个工作线程开一个SO_REUSEPORT监听socket，内核按连接分发，
+                accept协程固定在各自的线程上，接到的连接就地处理（m_acceptWorker与m_handleClientWorker相同时）
+            exclusive：每个地址一个监听socket，为每个工作线程dup一个fd并以EPOLLEXCLUSIVE等待，一个连接只唤醒一个线程；
+                内核不支持SO_REUSEPORT时reuseport也退回这种方式
+        */
+        std::vector<int> m_acceptThreads; // 与m_socks一一对应，accept协程固定的线程，-1表示不固定
+        bool m_localHandoff = false; // 连接交给接受它的线程处理
+
         IOManager* m_acceptWorker; // 只用于建立accept连接的线程池
         IOManager* m_handleClientWorker; // 每accept建立一个连接就把新的连接放到线程池里进行处理
         uint64_t m_readTimeout;
+        bool m_overloadPauseAccept; // 构造时读取tcp_server.overload_pause_accept
         std::string m_name;
         bool m_isStop;
     };
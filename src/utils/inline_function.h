@@ -0,0 +1,133 @@
+#pragma once
+// 只能移动的void()可调用对象，小对象直接存放在内部缓冲区，不申请堆内存
+
+#include <cstddef>
+
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Framework {
+    /*
+    替代std::function<void()>保存调度任务：
+    1. 只要求可移动，不要求可拷贝，可以捕获unique_ptr之类的对象
+    2. 可调用对象不超过INLINE_SIZE字节（且移动不抛异常）时放在内部缓冲区，常见的捕获几个指针/智能指针的lambda、
+       以及std::function本身都放得下，构造和移动都不申请内存；更大的才放到堆上
+    3. 空的std::function、空函数指针转换过来仍然是空的
+    */
+    class InlineFunction {
+    public:
+        static constexpr size_t INLINE_SIZE = 48;
+
+        InlineFunction() = default;
+        InlineFunction(std::nullptr_t) {}
+
+        template<class F, class D = std::decay_t<F>,
+            class = std::enable_if_t<!std::is_same_v<D, InlineFunction> && std::is_invocable_r_v<void, D&> > >
+        InlineFunction(F&& f) {
+            if constexpr (std::is_pointer_v<D> || IsStdFunction<D>::value) {
+                if (!f) {
+                    return;
+                }
+            }
+            if constexpr (IsInline<D>()) {
+                new (m_storage) D(std::forward<F>(f));
+                m_ops = &InlineOps<D>::ops;
+            }
+            else {
+                *reinterpret_cast<D**>(m_storage) = new D(std::forward<F>(f));
+                m_ops = &HeapOps<D>::ops;
+            }
+        }
+
+        InlineFunction(InlineFunction&& other) noexcept {
+            moveFrom(other);
+        }
+
+        InlineFunction& operator=(InlineFunction&& other) noexcept {
+            if (this != &other) {
+                clear();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        InlineFunction& operator=(std::nullptr_t) {
+            clear();
+            return *this;
+        }
+
+        InlineFunction(const InlineFunction&) = delete;
+        InlineFunction& operator=(const InlineFunction&) = delete;
+
+        ~InlineFunction() {
+            clear();
+        }
+
+        explicit operator bool() const { return m_ops != nullptr; }
+
+        void operator()() {
+            m_ops->invoke(m_storage);
+        }
+
+        // 是否放在内部缓冲区（空的也算）
+        bool isInline() const { return !m_ops || m_ops->isInline; }
+    private:
+        struct Ops {
+            void (*invoke)(void* storage);
+            void (*move)(void* dst, void* src); // 移动到dst后销毁src
+            void (*destroy)(void* storage);
+            bool isInline;
+        };
+
+        template<class T>
+        struct IsStdFunction : std::false_type {};
+        template<class R, class... Args>
+        struct IsStdFunction<std::function<R(Args...)> > : std::true_type {};
+
+        template<class D>
+        static constexpr bool IsInline() {
+            return sizeof(D) <= INLINE_SIZE && alignof(D) <= alignof(std::max_align_t)
+                && std::is_nothrow_move_constructible_v<D>;
+        }
+
+        template<class D>
+        struct InlineOps {
+            static void invoke(void* s) { (*static_cast<D*>(s))(); }
+            static void move(void* dst, void* src) {
+                new (dst) D(std::move(*static_cast<D*>(src)));
+                static_cast<D*>(src)->~D();
+            }
+            static void destroy(void* s) { static_cast<D*>(s)->~D(); }
+            static constexpr Ops ops = { &invoke, &move, &destroy, true };
+        };
+
+        template<class D>
+        struct HeapOps {
+            static void invoke(void* s) { (**static_cast<D**>(s))(); }
+            static void move(void* dst, void* src) { *static_cast<D**>(dst) = *static_cast<D**>(src); }
+            static void destroy(void* s) { delete *static_cast<D**>(s); }
+            static constexpr Ops ops = { &invoke, &move, &destroy, false };
+        };
+
+        void moveFrom(InlineFunction& other) {
+            if (other.m_ops) {
+                other.m_ops->move(m_storage, other.m_storage);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+
+        void clear() {
+            if (m_ops) {
+                const Ops* ops = m_ops;
+                m_ops = nullptr;
+                ops->destroy(m_storage);
+            }
+        }
+    private:
+        alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+        const Ops* m_ops = nullptr;
+    };
+}
@@ -0,0 +1,86 @@
+#pragma once
+// 分段数组：按下标惰性分配，分配后地址永不移动，读取不加锁
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "noncopyable.h"
+
+namespace Framework {
+    /*
+    第k段有BASE<<k个元素，覆盖下标[BASE*(2^k-1), BASE*(2^(k+1)-1))，段的总数固定为SEGMENTS
+    段在第一次用到时分配，多个线程同时分配同一段时用CAS决出胜者，输的一方释放自己那份
+    段一旦分配就不再移动、不再释放（直到整个数组析构），拿到的元素指针一直有效，扩容不会阻塞任何读者
+    元素本身的并发访问由T自己负责（通常是std::atomic<...>）
+    */
+    template<class T, size_t BASE = 64, size_t SEGMENTS = 24>
+    class SegmentedArray : private Noncopyable {
+    public:
+        SegmentedArray() {
+            for (auto& i : m_segments) {
+                i.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~SegmentedArray() {
+            for (auto& i : m_segments) {
+                delete[] i.load(std::memory_order_relaxed);
+            }
+        }
+
+        // 下标对应的元素，所在的段还没分配时返回nullptr
+        T* get(size_t index) const {
+            size_t seg, off;
+            Locate(index, seg, off);
+            if (seg >= SEGMENTS) {
+                return nullptr;
+            }
+            T* segment = m_segments[seg].load(std::memory_order_acquire);
+            return segment ? segment + off : nullptr;
+        }
+
+        // 下标对应的元素，所在的段还没分配就分配；超出容量返回nullptr
+        T* getOrCreate(size_t index) {
+            size_t seg, off;
+            Locate(index, seg, off);
+            if (seg >= SEGMENTS) {
+                return nullptr;
+            }
+            T* segment = m_segments[seg].load(std::memory_order_acquire);
+            if (!segment) {
+                T* fresh = new T[BASE << seg]();
+                if (m_segments[seg].compare_exchange_strong(segment, fresh, std::memory_order_acq_rel)) {
+                    segment = fresh;
+                }
+                else {
+                    delete[] fresh; // 别的线程先分配好了，segment已被更新为它的那份
+                }
+            }
+            return segment + off;
+        }
+
+        // 遍历所有已分配的元素（调用方保证没有并发修改，例如析构时）
+        template<class F>
+        void foreach(F f) {
+            for (size_t seg = 0; seg < SEGMENTS; ++seg) {
+                T* segment = m_segments[seg].load(std::memory_order_acquire);
+                if (!segment) {
+                    continue;
+                }
+                for (size_t i = 0; i < (BASE << seg); ++i) {
+                    f(segment[i]);
+                }
+            }
+        }
+    private:
+        static void Locate(size_t index, size_t& seg, size_t& off) {
+            size_t n = index / BASE + 1;
+            seg = 63 - __builtin_clzll(n);
+            off = index - BASE * ((1ull << seg) - 1);
+        }
+    private:
+        std::atomic<T*> m_segments[SEGMENTS];
+    };
+}
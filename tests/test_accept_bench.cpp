@@ -0,0 +1,110 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "multithread.h"
+#include "tcpserver.h"
+
+// 短连接风暴下的accept速率：每次唤醒accept一个 vs 一次把backlog取空、整批调度，以及单监听 vs 每线程SO_REUSEPORT监听
+// 客户端是普通线程上的阻塞socket：connect -> 等服务端关闭 -> RST关闭（不留TIME_WAIT），循环
+// 用法：test_accept_bench [客户端线程数] [每个线程的连接数] [IO线程数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+class CloseServer : public Framework::TcpServer {
+public:
+    typedef std::shared_ptr<CloseServer> ptr;
+    CloseServer(Framework::IOManager* iom, std::atomic<uint64_t>& accepted)
+        : TcpServer(iom, iom), m_accepted(accepted) {
+    }
+protected:
+    void handleClient(Framework::Socket::ptr client) override {
+        ++m_accepted;
+        client->close();
+    }
+private:
+    std::atomic<uint64_t>& m_accepted;
+};
+
+static void client(int port, int conns, std::atomic<uint64_t>& failed) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    linger lg = { 1, 0 };
+    for (int i = 0; i < conns; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+            ++failed;
+            close(fd);
+            continue;
+        }
+        char c;
+        while (recv(fd, &c, 1, 0) > 0) {
+        }
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        close(fd);
+    }
+}
+
+void bench(const std::string& mode, uint32_t batch, int clients, int conns, int threads, int port) {
+    Framework::Config::Lookup<std::string>("tcp_server.accept_mode", std::string("single"))->setValue(mode);
+    Framework::Config::Lookup<uint32_t>("tcp_server.accept_batch", (uint32_t)1)->setValue(batch);
+    std::atomic<uint64_t> accepted{ 0 };
+    std::atomic<uint64_t> failed{ 0 };
+    Framework::IOManager iom(threads, false, "accept");
+    CloseServer::ptr server(new CloseServer(&iom, accepted));
+    // 监听socket要在IO线程上创建，hook才会接管它
+    std::atomic<bool> started{ false };
+    iom.schedule([server, port, &started]() {
+        auto addr = Framework::Address::LookupAny("127.0.0.1:" + std::to_string(port));
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started = true;
+    });
+    while (!started) {
+        usleep(1000);
+    }
+
+    uint64_t begin = Framework::GetCurrentUS();
+    std::vector<Framework::Multithread::ptr> thrs;
+    for (int i = 0; i < clients; ++i) {
+        thrs.push_back(Framework::Multithread::ptr(new Framework::Multithread([port, conns, &failed]() {
+            client(port, conns, failed);
+        }, "client_" + std::to_string(i))));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+
+    LOG_INFO(g_logger) << "mode=" << mode << " batch=" << batch
+        << " accepted=" << accepted << " failed=" << failed
+        << " accepts/s=" << accepted * 1000000 / (used + 1)
+        << " schedule_tickles=" << iom.getTickleNeeded();
+    server->stop();
+}
+
+int main(int argc, char** argv) {
+    int clients = argc > 1 ? atoi(argv[1]) : 32;
+    int conns = argc > 2 ? atoi(argv[2]) : 500;
+    int threads = argc > 3 ? atoi(argv[3]) : 2;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+    int port = 18040;
+    for (auto& mode : { "single", "reuseport" }) {
+        for (uint32_t batch : { 1u, 64u }) {
+            bench(mode, batch, clients, conns, threads, port++);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <sstream>
+
+#include "config.h"
+#include "cpu_affinity.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 调度线程绑核/NUMA分组：打印拓扑，按配置启动IOManager，每个工作线程报告线程名、所在CPU、允许的CPU和内存策略
+// 用法：test_affinity [IO线程数] [scheduler.cpu_affinity] [numa_aware(0/1)]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static std::string ToString(const std::vector<int>& v) {
+    std::stringstream ss;
+    for (size_t i = 0; i < v.size(); ++i) {
+        ss << (i ? "," : "") << v[i];
+    }
+    return ss.str();
+}
+
+static void report() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    std::vector<int> allowed;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set)) {
+            allowed.push_back(i);
+        }
+    }
+    int mode = -1;
+    unsigned long mask = 0;
+    syscall(SYS_get_mempolicy, &mode, &mask, sizeof(mask) * 8 + 1, nullptr, 0);
+    char comm[16] = { 0 };
+    pthread_getname_np(pthread_self(), comm, sizeof(comm));
+    LOG_INFO(g_logger) << "thread=" << comm << " cpu=" << sched_getcpu() << " allowed=" << ToString(allowed)
+        << " mempolicy=" << (mode == MPOL_PREFERRED ? "preferred" : mode == MPOL_DEFAULT ? "default" : "other")
+        << " nodemask=" << mask;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 2;
+    std::string cpus = argc > 2 ? argv[2] : "0";
+    bool numa = argc > 3 && atoi(argv[3]);
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+
+    LOG_INFO(g_logger) << "parse 0-3,8,10-11 -> " << ToString(Framework::ParseCpuList("0-3,8,10-11"))
+        << " | parse 3-1 -> [" << ToString(Framework::ParseCpuList("3-1")) << "]"
+        << " | parse x -> [" << ToString(Framework::ParseCpuList("x")) << "]";
+    LOG_INFO(g_logger) << "online cpus=" << ToString(Framework::GetOnlineCpus());
+    for (auto& node : Framework::GetNumaTopology()) {
+        LOG_INFO(g_logger) << "numa node " << node.id << " cpus=" << ToString(node.cpus);
+    }
+
+    Framework::Config::Lookup<std::string>("scheduler.cpu_affinity", std::string())->setValue(cpus);
+    Framework::Config::Lookup<bool>("scheduler.numa_aware", false)->setValue(numa);
+    Framework::IOManager iom(threads, false, "aff");
+    std::atomic<int> left{ threads };
+    for (int id : iom.getWorkerThreadIds()) {
+        iom.schedule([&left]() {
+            report();
+            --left;
+        }, id);
+    }
+    while (left) {
+        usleep(1000);
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+
+#include "iomanager.h"
+#include "log.h"
+
+// 调度/执行一个任务的堆分配次数：替换全局operator new计数（动态库里的分配也会走到这里）
+// 预热之后统计稳定状态：每个任务执行时再调度下一个任务，形成schedule -> run的循环
+// 1. 捕获几个指针的lambda  2. 捕获shared_ptr的lambda（std::function放不进小对象缓冲区）  3. std::function
+// 4. 协程YieldToReady后被重新调度  5. 外部线程批量投递、工作线程执行（节点在不同线程分配和释放）
+// 用法：test_alloc_bench [IO线程数] [并发的任务链数] [每条链的循环次数]
+static std::atomic<uint64_t> s_allocs{ 0 };
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+struct Chain {
+    Framework::IOManager* iom;
+    std::atomic<int>* left;
+    int remain;
+};
+
+static void report(const std::string& name, uint64_t allocs, uint64_t cycles, uint64_t used_us) {
+    LOG_INFO(g_logger) << name << ": cycles=" << cycles << " allocs=" << allocs
+        << " allocs/cycle=" << (double)allocs / cycles
+        << " cycles/s=" << cycles * 1000000 / (used_us + 1);
+}
+
+static void step_ptr(Chain* c) {
+    if (--c->remain > 0) {
+        c->iom->schedule([c]() {
+            step_ptr(c);
+        });
+    }
+    else {
+        --*c->left;
+    }
+}
+
+static void step_shared(std::shared_ptr<Chain> c, uint64_t pad) {
+    if (--c->remain > 0) {
+        c->iom->schedule([c, pad]() {
+            step_shared(c, pad);
+        });
+    }
+    else {
+        --*c->left;
+    }
+}
+
+static void step_function(Chain* c) {
+    if (--c->remain > 0) {
+        std::function<void()> cb = [c]() {
+            step_function(c);
+        };
+        c->iom->schedule(&cb);
+    }
+    else {
+        --*c->left;
+    }
+}
+
+template<class Start>
+void bench(Framework::IOManager& iom, const std::string& name, int chains, int iters, Start start) {
+    for (int round = 0; round < 2; ++round) { // 第一轮预热，节点池、回调协程都准备好
+        std::atomic<int> left{ chains };
+        std::vector<Chain> cs(chains);
+        for (auto& c : cs) {
+            c = Chain{ &iom, &left, iters };
+        }
+        uint64_t before = s_allocs;
+        uint64_t begin = Framework::GetCurrentUS();
+        for (auto& c : cs) {
+            start(&c);
+        }
+        while (left) {
+            usleep(1000);
+        }
+        if (round) {
+            // 启动每条链的那一次schedule来自主线程，也计入了
+            report(name, s_allocs - before, (uint64_t)chains * iters, Framework::GetCurrentUS() - begin);
+        }
+    }
+}
+
+void bench_fiber_yield(Framework::IOManager& iom, int fibers, int iters) {
+    for (int round = 0; round < 2; ++round) {
+        std::atomic<int> left{ fibers };
+        std::vector<Framework::Fiber::ptr> fs;
+        for (int i = 0; i < fibers; ++i) {
+            fs.emplace_back(new Framework::Fiber([&left, iters]() {
+                for (int j = 0; j < iters; ++j) {
+                    Framework::Fiber::YieldToReady();
+                }
+                --left;
+            }));
+        }
+        uint64_t before = s_allocs;
+        uint64_t begin = Framework::GetCurrentUS();
+        iom.schedule(fs.begin(), fs.end());
+        while (left) {
+            usleep(1000);
+        }
+        if (round) {
+            report("fiber YieldToReady", s_allocs - before, (uint64_t)fibers * iters, Framework::GetCurrentUS() - begin);
+        }
+    }
+}
+
+void bench_external(Framework::IOManager& iom, int batches, int batch) {
+    std::atomic<int> left{ 0 };
+    for (int round = 0; round < 2; ++round) {
+        uint64_t before = s_allocs;
+        uint64_t begin = Framework::GetCurrentUS();
+        std::vector<std::function<void()> > cbs;
+        cbs.reserve(batch);
+        for (int i = 0; i < batches; ++i) {
+            left += batch;
+            for (int j = 0; j < batch; ++j) {
+                cbs.push_back([&left]() {
+                    --left;
+                });
+            }
+            iom.schedule(cbs.begin(), cbs.end());
+            cbs.clear();
+            while (left > batch) {
+                usleep(10);
+            }
+        }
+        while (left) {
+            usleep(1000);
+        }
+        if (round) {
+            report("external batch schedule", s_allocs - before, (uint64_t)batches * batch, Framework::GetCurrentUS() - begin);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int chains = argc > 2 ? atoi(argv[2]) : 64;
+    int iters = argc > 3 ? atoi(argv[3]) : 10000;
+
+    Framework::IOManager iom(threads, false, "alloc");
+    bench(iom, "lambda(ptr)", chains, iters, [](Chain* c) {
+        c->iom->schedule([c]() {
+            step_ptr(c);
+        });
+    });
+    bench(iom, "lambda(shared_ptr + 8 bytes)", chains, iters, [](Chain* c) {
+        std::shared_ptr<Chain> sc(c, [](Chain*) {});
+        c->iom->schedule([sc]() {
+            step_shared(sc, 0);
+        });
+    });
+    bench(iom, "std::function", chains, iters, [](Chain* c) {
+        c->iom->schedule([c]() {
+            step_function(c);
+        });
+    });
+    bench_fiber_yield(iom, chains, iters);
+    bench_external(iom, chains * iters / 256, 256);
+    return 0;
+}
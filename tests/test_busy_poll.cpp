@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "config.h"
+#include "fdmanager.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 空闲自旋：外部线程通过socketpair做ping-pong，测往返延迟（IOManager线程等在epoll里，每次请求都要唤醒）
+// 低负载：每次请求间隔1ms；中负载：间隔20us。对比iomanager.busy_poll_us=0与开启
+// 用法：test_busy_poll [IO线程数] [请求数] [busy_poll_us]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void spin(uint64_t us) {
+    uint64_t end = Framework::GetCurrentUS() + us;
+    while (Framework::GetCurrentUS() < end);
+}
+
+void bench(int threads, int requests, uint32_t busy_poll_us, uint64_t gap_us, const char* load) {
+    Framework::Config::Lookup<uint32_t>("iomanager.busy_poll_us", (uint32_t)0)->setValue(busy_poll_us);
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    std::vector<uint64_t> rtt;
+    rtt.reserve(requests);
+    uint64_t spins = 0;
+    uint64_t hits = 0;
+    {
+        Framework::IOManager iom(threads, false, "poll");
+        int server = fds[1];
+        iom.schedule([server]() {
+            Framework::FdMgr::GetInstance()->get(server, true); // 登记到FdManager，hook的read/write才会挂起协程
+            char c;
+            while (read(server, &c, 1) == 1) {
+                write(server, &c, 1);
+            }
+        });
+
+        char c = 'x';
+        for (int i = 0; i < requests; ++i) {
+            spin(gap_us); // 用忙等而不是usleep，避免客户端自己的睡眠唤醒混进测量
+            uint64_t begin = Framework::GetCurrentUS();
+            write(fds[0], &c, 1);
+            read(fds[0], &c, 1);
+            rtt.push_back(Framework::GetCurrentUS() - begin);
+        }
+        spins = iom.getBusyPollSpins();
+        hits = iom.getBusyPollHits();
+        shutdown(fds[0], SHUT_RDWR);
+    }
+    // 主线程没有开hook，close不会清掉FdManager里的记录，fd号复用时会拿到旧的上下文
+    Framework::FdMgr::GetInstance()->del(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+
+    std::sort(rtt.begin(), rtt.end());
+    LOG_INFO(g_logger) << load << " busy_poll_us=" << busy_poll_us
+        << " rtt p50=" << rtt[rtt.size() / 2] << "us p99=" << rtt[rtt.size() * 99 / 100]
+        << "us avg=" << [&rtt]() { uint64_t t = 0; for (auto i : rtt) t += i; return t / rtt.size(); }()
+        << "us spins=" << spins << " hits=" << hits;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 1;
+    int requests = argc > 2 ? atoi(argv[2]) : 5000;
+    uint32_t busy_poll_us = argc > 3 ? atoi(argv[3]) : 50;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+
+    bench(threads, requests / 5, 0, 1000, "low load (1ms gap)");
+    bench(threads, requests / 5, busy_poll_us, 1000, "low load (1ms gap)");
+    bench(threads, requests, 0, 20, "medium load (20us gap)");
+    bench(threads, requests, busy_poll_us, 20, "medium load (20us gap)");
+    return 0;
+}
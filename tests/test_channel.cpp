@@ -0,0 +1,203 @@
+#include <alloca.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "channel.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 协程间传递数据：每个元素schedule一个回调 vs 通道逐个收发 vs 通道批量收发，以及select和关闭，最后在共享栈模式下再收发一遍
+// 用法：test_channel [IO线程数] [生产者/消费者协程数] [每个生产者发送的个数] [通道容量]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void wait_done(std::atomic<int>& done, int n) {
+    while (done < n) {
+        usleep(1000);
+    }
+}
+
+// 基线：每个元素都调度一个新回调来处理
+void bench_schedule(Framework::IOManager& iom, int producers, int items) {
+    std::atomic<uint64_t> sum{ 0 };
+    std::atomic<uint64_t> handled{ 0 };
+    std::atomic<int> done{ 0 };
+    uint64_t total = (uint64_t)producers * items;
+    uint64_t begin = Framework::GetCurrentUS();
+    for (int i = 0; i < producers; ++i) {
+        iom.schedule([&iom, &sum, &handled, &done, items]() {
+            for (int j = 0; j < items; ++j) {
+                iom.schedule([&sum, &handled, j]() {
+                    sum += j;
+                    ++handled;
+                });
+            }
+            ++done;
+        });
+    }
+    wait_done(done, producers);
+    while (handled < total) {
+        usleep(1000);
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << "schedule per item: " << total * 1000000 / (used + 1) << " items/s sum=" << sum;
+}
+
+void bench_channel(Framework::IOManager& iom, int producers, int items, size_t capacity, size_t batch) {
+    Framework::Channel<int> chan(capacity);
+    std::atomic<uint64_t> sum{ 0 };
+    std::atomic<int> done{ 0 };
+    std::atomic<int> senders{ producers };
+    uint64_t begin = Framework::GetCurrentUS();
+    for (int i = 0; i < producers; ++i) {
+        iom.schedule([&chan, &senders, &done, items, batch]() {
+            std::vector<int> buf(batch);
+            for (int j = 0; j < items; j += batch) {
+                size_t n = std::min(batch, (size_t)(items - j));
+                for (size_t k = 0; k < n; ++k) {
+                    buf[k] = j + k;
+                }
+                chan.send(buf.data(), n);
+            }
+            if (--senders == 0) {
+                chan.close();
+            }
+            ++done;
+        });
+        iom.schedule([&chan, &sum, &done, batch]() {
+            std::vector<int> buf(batch);
+            uint64_t local = 0;
+            size_t n;
+            while ((n = chan.recv(buf.data(), batch))) {
+                for (size_t k = 0; k < n; ++k) {
+                    local += buf[k];
+                }
+            }
+            sum += local;
+            ++done;
+        });
+    }
+    wait_done(done, producers * 2);
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << "channel capacity=" << capacity << " batch=" << batch << ": "
+        << (uint64_t)producers * items * 1000000 / (used + 1) << " items/s sum=" << sum;
+}
+
+// select：从多个通道收，每个通道各自关闭，全部关闭后返回-2；再验证超时
+void test_select(Framework::IOManager& iom, int items) {
+    const int N = 3;
+    std::vector<std::unique_ptr<Framework::Channel<int> > > chans;
+    std::vector<Framework::Channel<int>*> ptrs;
+    for (int i = 0; i < N; ++i) {
+        chans.emplace_back(new Framework::Channel<int>(4));
+        ptrs.push_back(chans.back().get());
+    }
+    std::atomic<int> done{ 0 };
+    std::vector<uint64_t> counts(N);
+    int timeout_rt = 0;
+    for (int i = 0; i < N; ++i) {
+        iom.schedule([&chans, &done, i, items]() {
+            for (int j = 0; j < items * (i + 1); ++j) {
+                chans[i]->send(i);
+            }
+            chans[i]->close();
+            ++done;
+        });
+    }
+    iom.schedule([&ptrs, &counts, &done, &timeout_rt]() {
+        int v;
+        int idx;
+        while ((idx = Framework::Channel<int>::Select(ptrs, v)) >= 0) {
+            ASSERT(v == idx);
+            ++counts[idx];
+        }
+        ASSERT(idx == -2);
+        Framework::Channel<int> idle(1);
+        std::vector<Framework::Channel<int>*> one = { &idle };
+        timeout_rt = Framework::Channel<int>::Select(one, v, 10);
+        ++done;
+    });
+    wait_done(done, N + 1);
+    LOG_INFO(g_logger) << "select: counts=" << counts[0] << "," << counts[1] << "," << counts[2]
+        << " expect=" << items << "," << items * 2 << "," << items * 3
+        << " timeout_rt=" << timeout_rt;
+}
+
+// 先在栈上垫bytes字节再执行f，让各协程挂起时的栈深度不同
+template<class F>
+static void with_stack_offset(size_t bytes, F f) {
+    char* pad = (char*)alloca(bytes + 1);
+    memset(pad, 0x5a, bytes + 1);
+    f();
+    ASSERT(pad[bytes] == 0x5a);
+}
+
+// 共享栈：协程数远多于共享栈数，挂起的协程栈内容被搬走、栈被别的协程以不同的栈深度占用，挂在通道上的等待节点不能受影响
+// 容量为1让收发双方频繁挂起，逐个和批量各跑一遍，核对总和
+void test_shared_stack(int threads, int producers, int items) {
+    Framework::Config::Lookup<uint32_t>("fiber.shared_stack_count", (uint32_t)0)->setValue(2);
+    {
+        Framework::IOManager iom(threads, false, "shared");
+        for (size_t batch : { (size_t)1, (size_t)8 }) {
+            Framework::Channel<int> chan(1);
+            std::atomic<uint64_t> sum{ 0 };
+            std::atomic<int> done{ 0 };
+            std::atomic<int> senders{ producers };
+            for (int i = 0; i < producers; ++i) {
+                iom.schedule([&chan, &senders, &done, items, batch, i]() {
+                    with_stack_offset(96 * (i % 5), [&]() {
+                        std::vector<int> buf(batch);
+                        for (int j = 0; j < items; j += batch) {
+                            size_t n = std::min(batch, (size_t)(items - j));
+                            for (size_t k = 0; k < n; ++k) {
+                                buf[k] = j + k;
+                            }
+                            chan.send(buf.data(), n);
+                        }
+                    });
+                    if (--senders == 0) {
+                        chan.close();
+                    }
+                    ++done;
+                });
+                iom.schedule([&chan, &sum, &done, batch, i]() {
+                    with_stack_offset(64 * (i % 7) + 24, [&]() {
+                        std::vector<int> buf(batch);
+                        size_t n;
+                        while ((n = chan.recv(buf.data(), batch))) {
+                            for (size_t k = 0; k < n; ++k) {
+                                sum += buf[k];
+                            }
+                        }
+                    });
+                    ++done;
+                });
+            }
+            wait_done(done, producers * 2);
+            uint64_t expect = (uint64_t)producers * items * (items - 1) / 2;
+            ASSERT(sum == expect);
+            LOG_INFO(g_logger) << "shared stack batch=" << batch << ": sum=" << sum << " expect=" << expect;
+        }
+    }
+    Framework::Config::Lookup<uint32_t>("fiber.shared_stack_count", (uint32_t)0)->setValue(0);
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int producers = argc > 2 ? atoi(argv[2]) : 8;
+    int items = argc > 3 ? atoi(argv[3]) : 100000;
+    size_t capacity = argc > 4 ? atoi(argv[4]) : 256;
+
+    Framework::IOManager iom(threads, false, "channel");
+    LOG_INFO(g_logger) << "expect sum=" << (uint64_t)producers * items * (items - 1) / 2;
+    bench_schedule(iom, producers, items);
+    bench_channel(iom, producers, items, capacity, 1);
+    bench_channel(iom, producers, items, capacity, 32);
+    bench_channel(iom, producers, items, 1, 1);
+    test_select(iom, 1000);
+    test_shared_stack(threads, producers, items / 10);
+    return 0;
+}
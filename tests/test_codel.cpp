@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "hook.h"
+#include "http_connection.h"
+#include "http_server.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 过载保护：服务端每个请求占住线程1ms（不走hook的usleep，模拟同步的慢操作，也不和客户端抢CPU），客户端并发数远超处理能力、超时100ms
+// 对比scheduler.codel_target_ms=0与开启：不开启时请求在队列里等到客户端超时，处理了也没人读；
+// 开启后排队太久的请求被快速503拒绝，按时完成的请求数（goodput）不再塌掉；
+// 客户端每个请求都是新连接，再对比过载时暂停accept（tcp_server.overload_pause_accept）与否
+// 再看没过载时的误判：空闲的服务端上一个请求占住线程300ms，期间到达的几个请求处理时不能因为等过它就被503拒绝
+// 用法：test_codel [并发数] [秒数] [codel_target_ms]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+void bench(int concurrency, int seconds, uint32_t target_ms, bool pause_accept, int port) {
+    Framework::Config::Lookup<uint32_t>("scheduler.codel_target_ms", (uint32_t)0)->setValue(target_ms);
+    Framework::Config::Lookup<bool>("tcp_server.overload_pause_accept", true)->setValue(pause_accept);
+    std::atomic<int> ok{ 0 };
+    std::atomic<int> rejected{ 0 };
+    std::atomic<int> failed{ 0 };
+    uint64_t overloads = 0;
+    {
+        Framework::IOManager server_iom(1, false, "srv");
+        Framework::HTTP::HttpServer::ptr server(new Framework::HTTP::HttpServer(true, &server_iom, &server_iom));
+        server->getServletDispatch()->addMatchedServlet("/work", [](Framework::HTTP::HttpRequest::ptr req
+                , Framework::HTTP::HttpResponse::ptr rsp, Framework::HTTP::HttpSession::ptr session) {
+            usleep_f(1000);
+            rsp->setBody("ok");
+            return 0;
+        });
+        // 监听socket要在调度线程里创建（开启了hook），accept才会挂起协程而不是阻塞线程
+        std::atomic<bool> started{ false };
+        server_iom.schedule([server, port, &started]() {
+            auto addr = Framework::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+            while (!server->bind(addr)) {
+                sleep(1);
+            }
+            server->start();
+            started = true;
+        });
+        while (!started) {
+            usleep(1000);
+        }
+
+        // 客户端的调度器在构造之后才开，不受过载判断影响
+        Framework::Config::Lookup<uint32_t>("scheduler.codel_target_ms", (uint32_t)0)->setValue(0);
+        uint64_t end = Framework::GetCurrentMS() + seconds * 1000;
+        std::string url = "http://127.0.0.1:" + std::to_string(port) + "/work";
+        {
+            Framework::IOManager client_iom(1, false, "cli");
+            for (int i = 0; i < concurrency; ++i) {
+                client_iom.schedule([&, url]() {
+                    while (Framework::GetCurrentMS() < end) {
+                        auto r = Framework::HTTP::HttpConnection::GET(url, 100);
+                        if (r->response && r->response->getStatus() == Framework::HTTP::HttpStatus::OK) {
+                            ++ok;
+                        }
+                        else if (r->response && r->response->getStatus() == Framework::HTTP::HttpStatus::SERVICE_UNAVAILABLE) {
+                            ++rejected;
+                            usleep(10 * 1000); // 被拒绝后稍等再重试
+                        }
+                        else {
+                            ++failed;
+                        }
+                    }
+                });
+            }
+        }
+        overloads = server_iom.getOverloadCount();
+        server->stop();
+    }
+    LOG_INFO(g_logger) << "codel_target_ms=" << target_ms << " pause_accept=" << pause_accept << " goodput=" << ok / seconds << "/s ok=" << ok
+        << " rejected=" << rejected << " timeout/failed=" << failed << " overloads=" << overloads;
+}
+
+// 一个慢请求占住唯一的线程，同时到达的请求只是等了它一次，服务端并没有过载
+void slow_task(uint32_t target_ms, int port) {
+    Framework::Config::Lookup<uint32_t>("scheduler.codel_target_ms", (uint32_t)0)->setValue(target_ms);
+    std::atomic<int> ok{ 0 };
+    std::atomic<int> rejected{ 0 };
+    std::atomic<int> failed{ 0 };
+    uint64_t overloads = 0;
+    {
+        Framework::IOManager server_iom(1, false, "srv");
+        Framework::HTTP::HttpServer::ptr server(new Framework::HTTP::HttpServer(true, &server_iom, &server_iom));
+        auto dispatch = server->getServletDispatch();
+        dispatch->addMatchedServlet("/slow", [](Framework::HTTP::HttpRequest::ptr req
+                , Framework::HTTP::HttpResponse::ptr rsp, Framework::HTTP::HttpSession::ptr session) {
+            usleep_f(300 * 1000);
+            rsp->setBody("slow");
+            return 0;
+        });
+        dispatch->addMatchedServlet("/fast", [](Framework::HTTP::HttpRequest::ptr req
+                , Framework::HTTP::HttpResponse::ptr rsp, Framework::HTTP::HttpSession::ptr session) {
+            rsp->setBody("fast");
+            return 0;
+        });
+        std::atomic<bool> started{ false };
+        server_iom.schedule([server, port, &started]() {
+            auto addr = Framework::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+            while (!server->bind(addr)) {
+                sleep(1);
+            }
+            server->start();
+            started = true;
+        });
+        while (!started) {
+            usleep(1000);
+        }
+
+        Framework::Config::Lookup<uint32_t>("scheduler.codel_target_ms", (uint32_t)0)->setValue(0);
+        std::string base = "http://127.0.0.1:" + std::to_string(port);
+        {
+            Framework::IOManager client_iom(1, false, "cli");
+            auto get = [&](const std::string& path) {
+                auto r = Framework::HTTP::HttpConnection::GET(base + path, 1000);
+                if (r->response && r->response->getStatus() == Framework::HTTP::HttpStatus::OK) {
+                    ++ok;
+                }
+                else if (r->response && r->response->getStatus() == Framework::HTTP::HttpStatus::SERVICE_UNAVAILABLE) {
+                    ++rejected;
+                }
+                else {
+                    ++failed;
+                }
+            };
+            for (int round = 0; round < 3; ++round) {
+                client_iom.schedule([get]() {
+                    get("/slow");
+                });
+                usleep(50 * 1000); // 等慢请求开始处理，之后的请求都要等它
+                for (int i = 0; i < 5; ++i) {
+                    client_iom.schedule([get]() {
+                        get("/fast");
+                    });
+                }
+                usleep(500 * 1000);
+            }
+        }
+        overloads = server_iom.getOverloadCount();
+        server->stop();
+    }
+    LOG_INFO(g_logger) << "slow task, codel_target_ms=" << target_ms << " ok=" << ok << " rejected=" << rejected
+        << " timeout/failed=" << failed << " overloads=" << overloads;
+    ASSERT(rejected == 0);
+    ASSERT(ok == 18);
+}
+
+int main(int argc, char** argv) {
+    int concurrency = argc > 1 ? atoi(argv[1]) : 300;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    uint32_t target_ms = argc > 3 ? atoi(argv[3]) : 5;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+
+    bench(concurrency, seconds, 0, false, 18031);
+    bench(concurrency, seconds, target_ms, true, 18032);
+    bench(concurrency, seconds, target_ms, false, 18033);
+    slow_task(target_ms, 18034);
+    return 0;
+}
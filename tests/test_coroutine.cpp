@@ -0,0 +1,212 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "coroutine.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 无栈协程（co_await）测试
+// 1. 1万个并发的co_await CoSleep：对比同样数量的Fiber各自usleep，看分配了多少个协程栈
+// 2. 全部用co_await写的echo：CoAccept/CoConnect/CoRead/CoWrite
+// 3. 在Fiber里BlockOn一个Task，以及Task里抛出的异常在co_await处重新抛出
+// 用法：test_coroutine [IO线程数] [并发数] [echo连接数] [每个连接的往返次数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void wait_done(std::atomic<int>& done, int n) {
+    while (done < n) {
+        usleep(1000);
+    }
+}
+
+Framework::Task<void> sleeper(std::atomic<int>* done) {
+    for (int i = 0; i < 3; ++i) {
+        co_await Framework::CoSleep(20);
+    }
+    ++*done;
+}
+
+void test_fan_out(Framework::IOManager& iom, int n) {
+    std::atomic<int> done{ 0 };
+    uint64_t base = Framework::Fiber::TotalFibers();
+    uint64_t peak = base;
+    uint64_t begin = Framework::GetCurrentUS();
+    for (int i = 0; i < n; ++i) {
+        Framework::CoSpawn(sleeper(&done), &iom);
+    }
+    while (done < n) {
+        peak = std::max(peak, Framework::Fiber::TotalFibers());
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "co_await sleep x" << n << ": used=" << (Framework::GetCurrentUS() - begin) / 1000
+        << "ms fibers_alive_peak=" << peak - base;
+
+    done = 0;
+    peak = base = Framework::Fiber::TotalFibers();
+    begin = Framework::GetCurrentUS();
+    for (int i = 0; i < n; ++i) {
+        iom.schedule([&done]() {
+            for (int i = 0; i < 3; ++i) {
+                usleep(20 * 1000);
+            }
+            ++done;
+        });
+    }
+    while (done < n) {
+        peak = std::max(peak, Framework::Fiber::TotalFibers());
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "fiber usleep x" << n << ": used=" << (Framework::GetCurrentUS() - begin) / 1000
+        << "ms fibers_alive_peak=" << peak - base;
+}
+
+Framework::Task<void> echo_session(int fd) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = co_await Framework::CoRead(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        if (co_await Framework::CoWriteAll(fd, buf, n) < 0) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+Framework::Task<void> echo_server(int listen_fd, int conns) {
+    for (int i = 0; i < conns; ++i) {
+        int fd = co_await Framework::CoAccept(listen_fd);
+        if (fd < 0) {
+            LOG_ERROR(g_logger) << "CoAccept errno=" << -fd;
+            break;
+        }
+        Framework::CoSpawn(echo_session(fd));
+    }
+    close(listen_fd);
+}
+
+Framework::Task<void> echo_client(int port, int rounds, std::atomic<int>* ok, std::atomic<int>* done) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int rt = co_await Framework::CoConnect(fd, (sockaddr*)&addr, sizeof(addr), 3000);
+    if (rt) {
+        LOG_ERROR(g_logger) << "CoConnect errno=" << -rt;
+    }
+    else {
+        char out[64];
+        char in[64];
+        int i = 0;
+        for (; i < rounds; ++i) {
+            int len = snprintf(out, sizeof(out), "hello %d", i);
+            if (co_await Framework::CoWriteAll(fd, out, len) != len) {
+                break;
+            }
+            int got = 0;
+            while (got < len) {
+                ssize_t n = co_await Framework::CoRead(fd, in + got, len - got, 3000);
+                if (n <= 0) {
+                    break;
+                }
+                got += n;
+            }
+            if (got != len || memcmp(in, out, len)) {
+                break;
+            }
+        }
+        if (i == rounds) {
+            ++*ok;
+        }
+    }
+    close(fd);
+    ++*done;
+}
+
+void test_echo(Framework::IOManager& iom, int conns, int rounds) {
+    const int port = 18060;
+    std::atomic<bool> listening{ false };
+    iom.schedule([&listening, conns]() {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) || listen(fd, 1024)) {
+            LOG_ERROR(g_logger) << "bind/listen errno=" << errno;
+            return;
+        }
+        Framework::CoSpawn(echo_server(fd, conns));
+        listening = true;
+    });
+    while (!listening) {
+        usleep(1000);
+    }
+    std::atomic<int> ok{ 0 };
+    std::atomic<int> done{ 0 };
+    uint64_t begin = Framework::GetCurrentUS();
+    for (int i = 0; i < conns; ++i) {
+        Framework::CoSpawn(echo_client(port, rounds, &ok, &done), &iom);
+    }
+    wait_done(done, conns);
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << "co_await echo: conns=" << conns << " ok=" << ok
+        << " round_trips/s=" << (uint64_t)conns * rounds * 1000000 / (used + 1);
+}
+
+Framework::Task<int> add_later(int a, int b) {
+    co_await Framework::CoSleep(5);
+    co_return a + b;
+}
+
+Framework::Task<int> throw_later() {
+    co_await Framework::CoSleep(5);
+    throw std::runtime_error("boom");
+    co_return 0;
+}
+
+Framework::Task<int> sum_and_catch() {
+    int sum = co_await add_later(1, 2) + co_await add_later(3, 4);
+    try {
+        co_await throw_later();
+    }
+    catch (std::exception& ex) {
+        sum += 100;
+    }
+    co_return sum;
+}
+
+void test_mixed(Framework::IOManager& iom) {
+    std::atomic<int> done{ 0 };
+    int result = 0;
+    iom.schedule([&done, &result]() {
+        result = Framework::BlockOn(sum_and_catch());
+        ++done;
+    });
+    wait_done(done, 1);
+    LOG_INFO(g_logger) << "BlockOn from fiber: result=" << result << " expect=110";
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int fan_out = argc > 2 ? atoi(argv[2]) : 10000;
+    int conns = argc > 3 ? atoi(argv[3]) : 100;
+    int rounds = argc > 4 ? atoi(argv[4]) : 1000;
+
+    Framework::IOManager iom(threads, false, "coroutine");
+    test_fan_out(iom, fan_out);
+    test_echo(iom, conns, rounds);
+    test_mixed(iom);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "cancel_context.h"
+#include "channel.h"
+#include "config.h"
+#include "fdmanager.h"
+#include "fiber_sync.h"
+#include "hook.h"
+#include "http_connection.h"
+#include "http_server.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 截止时间/取消上下文：阻塞在hook的read、sleep、限时的信号量、通道上的协程，到截止时间返回超时，被取消时立刻醒来；父上下文取消时子上下文一起取消
+// 再起一个HTTP服务：路由/chain时限150ms，串行调用3次上游/slow（每次80ms），第2次就因为预算用完失败，整个请求在150ms左右结束
+// 用法：test_deadline [io_uring 0/1]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+// 在一个协程里阻塞于op，after_ms后由另一个协程取消（after_ms为0表示不取消，只靠timeout_ms的截止时间）
+template<class F>
+static void check(Framework::IOManager& iom, const char* name, uint64_t timeout_ms, uint64_t after_ms, F op) {
+    Framework::FiberSemaphore done;
+    Framework::CancelContext::ptr ctx = Framework::CancelContext::Create(timeout_ms);
+    iom.schedule([&]() {
+        Framework::CancelScope scope(ctx);
+        uint64_t begin = Framework::GetCurrentMS();
+        std::string rt = op();
+        LOG_INFO(g_logger) << name << ": " << rt << " after " << (Framework::GetCurrentMS() - begin) << "ms";
+        done.notify();
+    });
+    if (after_ms) {
+        iom.schedule([&]() {
+            usleep(after_ms * 1000);
+            ctx->cancel();
+        });
+    }
+    Framework::Semaphore wait;
+    iom.schedule([&]() {
+        done.wait();
+        wait.notify();
+    });
+    wait.wait();
+}
+
+static std::string result(int rt) {
+    return "rt=" + std::to_string(rt) + (rt < 0 ? std::string(" errno=") + strerror(errno) : "");
+}
+
+int main(int argc, char** argv) {
+    bool uring = argc > 1 && atoi(argv[1]);
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+    Framework::Config::Lookup<bool>("iomanager.io_uring", false)->setValue(uring);
+
+    Framework::IOManager iom(2, false, "deadline");
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    iom.schedule([&]() {
+        Framework::FdMgr::GetInstance()->get(fds[0], true); // 登记到FdManager，hook的read才会挂起协程
+    });
+    usleep(10 * 1000);
+
+    char c;
+    check(iom, "read deadline 50ms", 50, 0, [&]() { return result(read(fds[0], &c, 1)); });
+    check(iom, "read cancel at 20ms", ~0ull, 20, [&]() { return result(read(fds[0], &c, 1)); });
+    check(iom, "sleep(1) deadline 30ms", 30, 0, [&]() { return "left=" + std::to_string(sleep(1)) + "s"; });
+    check(iom, "usleep 1s cancel at 20ms", ~0ull, 20, [&]() { return result(usleep(1000 * 1000)); });
+    check(iom, "usleep 10ms deadline 1s", 1000, 0, [&]() { return result(usleep(10 * 1000)); });
+    Framework::FiberSemaphore sem;
+    check(iom, "semaphore waitFor(1000) cancel at 20ms", ~0ull, 20, [&]() {
+        return std::string(sem.waitFor(1000) ? "acquired" : "failed");
+    });
+    Framework::Channel<int> chan(1);
+    check(iom, "channel recv deadline 40ms", 40, 0, [&]() {
+        int v;
+        return std::string(chan.recv(v) ? "received" : "failed");
+    });
+    check(iom, "child read, parent cancelled at 20ms", ~0ull, 20, [&]() {
+        Framework::CancelScope scope(Framework::CancelContext::Create(1000, Framework::CancelContext::GetCurrent()));
+        return result(read(fds[0], &c, 1));
+    });
+    check(iom, "read after cancel", ~0ull, 0, [&]() {
+        Framework::CancelContext::GetCurrent()->cancel();
+        return result(read(fds[0], &c, 1));
+    });
+
+    // 请求级的预算：/chain的时限覆盖它里面的所有上游调用
+    Framework::HTTP::HttpServer::ptr server(new Framework::HTTP::HttpServer(true, &iom, &iom));
+    auto dispatch = server->getServletDispatch();
+    dispatch->addMatchedServlet("/slow", [](Framework::HTTP::HttpRequest::ptr req
+            , Framework::HTTP::HttpResponse::ptr rsp, Framework::HTTP::HttpSession::ptr session) {
+        usleep(80 * 1000);
+        rsp->setBody("slow");
+        return 0;
+    });
+    dispatch->addMatchedServlet("/chain", [](Framework::HTTP::HttpRequest::ptr req
+            , Framework::HTTP::HttpResponse::ptr rsp, Framework::HTTP::HttpSession::ptr session) {
+        std::string body;
+        for (int i = 0; i < 3; ++i) {
+            auto r = Framework::HTTP::HttpConnection::GET("http://127.0.0.1:18041/slow", 1000);
+            if (r->result != (int)Framework::HTTP::HttpResult::Error::OK) {
+                rsp->setStatus(Framework::HTTP::HttpStatus::GATEWAY_TIMEOUT);
+                body += "call " + std::to_string(i) + " failed: " + r->error;
+                break;
+            }
+            body += "call " + std::to_string(i) + " ok; ";
+        }
+        rsp->setBody(body);
+        return 0;
+    }, Framework::Fiber::INHERIT, 150);
+    std::atomic<bool> started{ false };
+    iom.schedule([server, &started]() {
+        auto addr = Framework::Address::LookupAnyIPAddress("127.0.0.1:18041");
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started = true;
+    });
+    while (!started) {
+        usleep(1000);
+    }
+    Framework::Semaphore wait;
+    iom.schedule([&]() {
+        uint64_t begin = Framework::GetCurrentMS();
+        auto r = Framework::HTTP::HttpConnection::GET("http://127.0.0.1:18041/chain", 1000);
+        LOG_INFO(g_logger) << "/chain (budget 150ms, 3 x 80ms upstream): status="
+            << (r->response ? (int)r->response->getStatus() : -1)
+            << " body=\"" << (r->response ? r->response->getBody() : r->error)
+            << "\" after " << (Framework::GetCurrentMS() - begin) << "ms";
+        wait.notify();
+    });
+    wait.wait();
+
+    server->stop();
+    shutdown(fds[1], SHUT_RDWR);
+    return 0;
+}
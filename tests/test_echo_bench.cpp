@@ -0,0 +1,131 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "multithread.h"
+#include "tcpserver.h"
+
+// echo服务器的epoll系统调用统计：每次阻塞都改epoll（默认） vs 连接登记一次的持久边缘触发
+// 客户端是普通线程上的阻塞socket，一问一答，统计只包含服务端的IOManager
+// 用法：test_echo_bench [连接数] [每个连接的往返次数] [IO线程数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+class EchoServer : public Framework::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+    using TcpServer::TcpServer;
+protected:
+    void handleClient(Framework::Socket::ptr client) override {
+        char buf[4096];
+        while (true) {
+            int rt = client->recv(buf, sizeof(buf));
+            if (rt <= 0) {
+                break;
+            }
+            if (client->send(buf, rt) != rt) {
+                break;
+            }
+        }
+        client->close();
+    }
+};
+
+static void client(int port, int rounds, std::atomic<uint64_t>& done) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        LOG_ERROR(g_logger) << "connect errno=" << errno << " errstr=" << strerror(errno);
+        close(fd);
+        return;
+    }
+    char buf[64] = "ping";
+    for (int i = 0; i < rounds; ++i) {
+        if (send(fd, buf, sizeof(buf), 0) != sizeof(buf)) {
+            break;
+        }
+        size_t got = 0;
+        while (got < sizeof(buf)) {
+            int rt = recv(fd, buf + got, sizeof(buf) - got, 0);
+            if (rt <= 0) {
+                break;
+            }
+            got += rt;
+        }
+        if (got != sizeof(buf)) {
+            break;
+        }
+        ++done;
+    }
+    close(fd);
+}
+
+void bench(bool persistent, int conns, int rounds, int threads) {
+    Framework::Config::Lookup<bool>("iomanager.persistent_epoll", false)->setValue(persistent);
+    Framework::IOManager iom(threads, false, persistent ? "persistent" : "per_wait");
+    int port = 18030 + persistent;
+    EchoServer::ptr server(new EchoServer(&iom, &iom));
+    // 监听socket要在IO线程上创建，hook才会接管它
+    std::atomic<bool> started{ false };
+    iom.schedule([server, port, &started]() {
+        auto addr = Framework::Address::LookupAny("127.0.0.1:" + std::to_string(port));
+        while (!server->bind(addr)) {
+            sleep(1);
+        }
+        server->start();
+        started = true;
+    });
+    while (!started) {
+        usleep(1000);
+    }
+
+    std::atomic<uint64_t> done{ 0 };
+    uint64_t ctl = iom.getEpollCtlCount();
+    uint64_t wait = iom.getEpollWaitCount();
+    uint64_t begin = Framework::GetCurrentUS();
+    std::vector<Framework::Multithread::ptr> thrs;
+    for (int i = 0; i < conns; ++i) {
+        thrs.push_back(Framework::Multithread::ptr(new Framework::Multithread([port, rounds, &done]() {
+            client(port, rounds, done);
+        }, "client_" + std::to_string(i))));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    ctl = iom.getEpollCtlCount() - ctl;
+    wait = iom.getEpollWaitCount() - wait;
+
+    LOG_INFO(g_logger) << (persistent ? "persistent" : "per_wait")
+        << " round_trips=" << done
+        << " rtt=" << used * 1000 / (done + 1) << "ns"
+        << " epoll_ctl=" << ctl
+        << " epoll_wait=" << wait
+        << " ctl/rt=" << (double)ctl / (done + 1)
+        << " wait/rt=" << (double)wait / (done + 1);
+    server->stop();
+}
+
+int main(int argc, char** argv) {
+    int conns = argc > 1 ? atoi(argv[1]) : 16;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5000;
+    int threads = argc > 3 ? atoi(argv[3]) : 2;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+    bench(false, conns, rounds, threads);
+    bench(true, conns, rounds, threads);
+    return 0;
+}
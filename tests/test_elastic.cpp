@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <set>
+
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 弹性线程数：空闲时线程被停放到下限，任务积压时被唤醒，绑定到停放线程的任务也能执行，停放状态下也能正常stop
+// 最后反复启动调度器，刚启动就投给每个线程的任务都要及时执行
+// 用法：test_elastic [构造线程数] [elastic_min_threads] [elastic_max_threads]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void spin(uint64_t us) {
+    uint64_t end = Framework::GetCurrentUS() + us;
+    while (Framework::GetCurrentUS() < end);
+}
+
+static void report(Framework::IOManager& iom, const char* phase) {
+    LOG_INFO(g_logger) << phase << ": running=" << iom.getRunningThreadCount()
+        << " parked=" << iom.getParkedThreadCount();
+}
+
+void scale(int threads) {
+    Framework::IOManager iom(threads, false, "elastic");
+    usleep(50 * 1000);
+    report(iom, "start");
+    usleep(6000 * 1000); // 线程在epoll里最多等5秒才回到调度循环
+    report(iom, "idle");
+
+    // 突发：外部线程投一批忙任务，没有空闲线程时停放的线程被逐个唤醒
+    std::atomic<int> left{ 2000 };
+    Framework::Mutex mutex;
+    std::set<int> workers;
+    size_t peak = 0;
+    uint64_t begin = Framework::GetCurrentMS();
+    for (int i = 0; i < 2000; ++i) {
+        iom.schedule([&]() {
+            spin(200);
+            Framework::Mutex::Lock lock(mutex);
+            workers.insert(Framework::GetThreadId());
+            --left;
+        });
+        peak = std::max(peak, iom.getRunningThreadCount());
+    }
+    while (left) {
+        peak = std::max(peak, iom.getRunningThreadCount());
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "burst: " << (Framework::GetCurrentMS() - begin) << "ms peak_running=" << peak
+        << " threads_used=" << workers.size();
+    usleep(6000 * 1000);
+    report(iom, "idle again");
+
+    // 绑定到每个工作线程的任务，停放的线程要被叫醒来执行
+    std::vector<int> ids = iom.getWorkerThreadIds();
+    std::atomic<int> pinned{ (int)ids.size() };
+    std::atomic<int> misplaced{ 0 };
+    for (int id : ids) {
+        iom.schedule([&pinned, &misplaced, id]() {
+            if ((int)Framework::GetThreadId() != id) {
+                ++misplaced;
+            }
+            --pinned;
+        }, id);
+    }
+    begin = Framework::GetCurrentMS();
+    while (pinned && Framework::GetCurrentMS() - begin < 3000) {
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "pinned: " << ids.size() - pinned << "/" << ids.size()
+        << " done in " << (Framework::GetCurrentMS() - begin) << "ms, misplaced=" << misplaced;
+    usleep(6000 * 1000);
+    report(iom, "before stop");
+}
+
+void restart(int threads) {
+    // 反复启动：刚启动就有任务绑定到每个工作线程（包括启动即停放的），都要执行，不能等到epoll超时
+    uint64_t slowest = 0;
+    for (int round = 0; round < 5; ++round) {
+        Framework::IOManager iom(threads, false, "restart");
+        std::vector<int> ids = iom.getWorkerThreadIds();
+        std::atomic<int> pinned{ (int)ids.size() };
+        uint64_t begin = Framework::GetCurrentMS();
+        for (int id : ids) {
+            iom.schedule([&pinned]() {
+                --pinned;
+            }, id);
+        }
+        while (pinned) {
+            usleep(1000);
+        }
+        slowest = std::max(slowest, Framework::GetCurrentMS() - begin);
+    }
+    LOG_INFO(g_logger) << "restart: pinned tasks right after start, slowest round " << slowest << "ms";
+    ASSERT(slowest < 1000);
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 2;
+    uint32_t min_threads = argc > 2 ? atoi(argv[2]) : 1;
+    uint32_t max_threads = argc > 3 ? atoi(argv[3]) : 4;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+    Framework::Config::Lookup<uint32_t>("scheduler.elastic_min_threads", (uint32_t)0)->setValue(min_threads);
+    Framework::Config::Lookup<uint32_t>("scheduler.elastic_max_threads", (uint32_t)0)->setValue(max_threads);
+    Framework::Config::Lookup<uint32_t>("scheduler.elastic_park_idle_ms", (uint32_t)1000)->setValue(100);
+    Framework::Config::Lookup<uint32_t>("scheduler.elastic_unpark_queue", (uint32_t)16)->setValue(4);
+
+    scale(threads);
+    restart(threads);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+
+// 协程回收池：fiber.pool_size=0（每次new Fiber）vs 开启回收
+// 1. 回调里做一次hook的usleep：回调协程被挂起交出去，调度器下一个回调要用新协程
+// 2. 用户代码用Fiber::Create创建短命协程并调度
+// 用法：test_fiber_pool [IO线程数] [任务数] [池上限]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void wait_done(std::atomic<int>& done, int n) {
+    while (done < n) {
+        usleep(1000);
+    }
+}
+
+void bench(Framework::IOManager& iom, uint32_t pool_size, int tasks) {
+    Framework::Config::Lookup<uint32_t>("fiber.pool_size", (uint32_t)0)->setValue(pool_size);
+    Framework::Fiber::PoolStats before = Framework::Fiber::GetPoolStats();
+
+    std::atomic<int> done{ 0 };
+    uint64_t begin = Framework::GetCurrentUS();
+    for (int i = 0; i < tasks; ++i) {
+        iom.schedule([&done]() {
+            usleep(1);
+            ++done;
+        });
+        if (i % 1000 == 999) {
+            wait_done(done, i - 500);
+        }
+    }
+    wait_done(done, tasks);
+    uint64_t blocking_used = Framework::GetCurrentUS() - begin;
+
+    done = 0;
+    begin = Framework::GetCurrentUS();
+    iom.schedule([&iom, &done, tasks]() {
+        for (int i = 0; i < tasks; ++i) {
+            iom.schedule(Framework::Fiber::Create([&done]() {
+                ++done;
+            }));
+            if (i % 1000 == 999) {
+                Framework::Fiber::YieldToReady(); // 让出去执行一批，避免协程全堆积在队列里
+            }
+        }
+    });
+    wait_done(done, tasks);
+    uint64_t create_used = Framework::GetCurrentUS() - begin;
+
+    Framework::Fiber::PoolStats after = Framework::Fiber::GetPoolStats();
+    LOG_INFO(g_logger) << "pool_size=" << pool_size
+        << " blocking_cb/s=" << (uint64_t)tasks * 1000000 / (blocking_used + 1)
+        << " create_fiber/s=" << (uint64_t)tasks * 1000000 / (create_used + 1)
+        << " reused=" << after.reused - before.reused
+        << " recycled=" << after.recycled - before.recycled
+        << " discarded=" << after.discarded - before.discarded
+        << " total_fibers=" << Framework::Fiber::TotalFibers();
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int tasks = argc > 2 ? atoi(argv[2]) : 100000;
+    uint32_t pool_size = argc > 3 ? atoi(argv[3]) : 1024;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+
+    Framework::IOManager iom(threads, false, "pool");
+    bench(iom, 0, tasks);
+    bench(iom, pool_size, tasks);
+    bench(iom, 0, tasks);
+    bench(iom, pool_size, tasks);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <ucontext.h>
+
+#include "fiber.h"
+#include "fiber_context.h"
+#include "log.h"
+#include "utils.h"
+
+// 协程切换耗时测试：ucontext vs 手写汇编，单位ns/次切换（一来一回算两次）
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static const uint64_t N = 1000000;
+static const size_t STACK_SIZE = 128 * 1024;
+
+static ucontext_t s_main_uc, s_fiber_uc;
+static void uc_loop() {
+    while (true) {
+        swapcontext(&s_fiber_uc, &s_main_uc);
+    }
+}
+
+void bench_ucontext() {
+    std::vector<char> stack(STACK_SIZE);
+    getcontext(&s_fiber_uc);
+    s_fiber_uc.uc_link = nullptr;
+    s_fiber_uc.uc_stack.ss_sp = &stack[0];
+    s_fiber_uc.uc_stack.ss_size = stack.size();
+    makecontext(&s_fiber_uc, &uc_loop, 0);
+
+    uint64_t begin = Framework::GetCurrentUS();
+    for (uint64_t i = 0; i < N; ++i) {
+        swapcontext(&s_main_uc, &s_fiber_uc);
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << "ucontext: " << used * 1000.0 / (N * 2) << " ns/switch";
+}
+
+#ifdef FIBER_HAS_ASM_CONTEXT
+static void* s_main_sp = nullptr;
+static void* s_fiber_sp = nullptr;
+static void asm_loop() {
+    while (true) {
+        fiber_swap_context(&s_fiber_sp, s_main_sp);
+    }
+}
+
+void bench_asm() {
+    std::vector<char> stack(STACK_SIZE);
+    s_fiber_sp = Framework::MakeFiberContext(&stack[0], stack.size(), &asm_loop);
+
+    uint64_t begin = Framework::GetCurrentUS();
+    for (uint64_t i = 0; i < N; ++i) {
+        fiber_swap_context(&s_main_sp, s_fiber_sp);
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << "asm: " << used * 1000.0 / (N * 2) << " ns/switch";
+}
+#endif
+
+// 走Fiber::call/uncall，测的是当前编译选项下Fiber实际使用的切换方式
+void bench_fiber() {
+    Framework::Fiber::GetThis();
+    Framework::Fiber* raw = nullptr;
+    Framework::Fiber::ptr fiber(new Framework::Fiber([&raw]() {
+        for (uint64_t i = 0; i < N; ++i) {
+            raw->uncall();
+        }
+    }, STACK_SIZE, false));
+    raw = fiber.get();
+
+    uint64_t begin = Framework::GetCurrentUS();
+    for (uint64_t i = 0; i <= N; ++i) {
+        fiber->call();
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+#ifdef FIBER_ASM_CONTEXT
+    LOG_INFO(g_logger) << "Fiber(asm): " << used * 1000.0 / (N * 2) << " ns/switch";
+#else
+    LOG_INFO(g_logger) << "Fiber(ucontext): " << used * 1000.0 / (N * 2) << " ns/switch";
+#endif
+}
+
+int main(int argc, char** argv) {
+    bench_ucontext();
+#ifdef FIBER_HAS_ASM_CONTEXT
+    bench_asm();
+#endif
+    bench_fiber();
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "log.h"
+#include "multithread.h"
+
+// 协程同步原语 vs pthread版本的竞争测试
+// 1. 短临界区的互斥锁/读写锁吞吐
+// 2. 信号量乒乓：两个协程互相唤醒（pthread版本的协程对数不超过线程数的一半，否则会把线程全堵死）
+// 3. 持锁期间做hook的IO（usleep），看不相关的协程还能不能推进；pthread锁会把整个线程卡住，这里只跑协程版本
+// 用法：test_fiber_sync_bench [IO线程数] [协程数] [每个协程的循环次数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+template<class F>
+static void run_fibers(Framework::IOManager& iom, int fibers, F f) {
+    std::atomic<int> done{ 0 };
+    for (int i = 0; i < fibers; ++i) {
+        iom.schedule([&done, &f, i]() {
+            f(i);
+            ++done;
+        });
+    }
+    while (done < fibers) {
+        usleep(1000);
+    }
+}
+
+template<class M>
+void bench_mutex(Framework::IOManager& iom, const std::string& name, int fibers, int iters) {
+    M mutex;
+    uint64_t counter = 0;
+    uint64_t begin = Framework::GetCurrentUS();
+    run_fibers(iom, fibers, [&](int) {
+        for (int j = 0; j < iters; ++j) {
+            typename M::Lock lock(mutex);
+            ++counter;
+        }
+    });
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": " << (uint64_t)fibers * iters * 1000000 / (used + 1) << " lock/s"
+        << " counter=" << counter << " expect=" << (uint64_t)fibers * iters;
+}
+
+template<class M>
+void bench_rwmutex(Framework::IOManager& iom, const std::string& name, int fibers, int iters) {
+    M mutex;
+    uint64_t value = 0;
+    std::atomic<uint64_t> reads{ 0 };
+    uint64_t begin = Framework::GetCurrentUS();
+    run_fibers(iom, fibers, [&](int i) {
+        for (int j = 0; j < iters; ++j) {
+            if ((i + j) % 10 == 0) { // 1/10的写
+                typename M::WriteLock lock(mutex);
+                ++value;
+            }
+            else {
+                typename M::ReadLock lock(mutex);
+                reads += value != ~0ull;
+            }
+        }
+    });
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": " << (uint64_t)fibers * iters * 1000000 / (used + 1) << " lock/s"
+        << " writes=" << value << " reads=" << reads;
+}
+
+template<class S>
+void bench_pingpong(Framework::IOManager& iom, const std::string& name, int pairs, int iters) {
+    std::vector<std::unique_ptr<S> > sems;
+    for (int i = 0; i < pairs * 2; ++i) {
+        sems.emplace_back(new S(0));
+    }
+    uint64_t begin = Framework::GetCurrentUS();
+    run_fibers(iom, pairs * 2, [&](int i) {
+        S& mine = *sems[i];
+        S& peer = *sems[i ^ 1];
+        for (int j = 0; j < iters; ++j) {
+            if (i & 1) {
+                mine.wait();
+                peer.notify();
+            }
+            else {
+                peer.notify();
+                mine.wait();
+            }
+        }
+    });
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": pairs=" << pairs << " " << (uint64_t)pairs * iters * 1000000 / (used + 1) << " round_trips/s";
+}
+
+void bench_hold_across_io(Framework::IOManager& iom, int fibers) {
+    Framework::FiberMutex mutex;
+    Framework::FiberCondVar cond;
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> ticks{ 0 };
+    std::atomic<int> timeouts{ 0 };
+    // 不相关的协程：不断短暂休眠，统计推进次数
+    for (int i = 0; i < 4; ++i) {
+        iom.schedule([&stop, &ticks]() {
+            while (!stop) {
+                usleep(100);
+                ++ticks;
+            }
+        });
+    }
+    uint64_t begin = Framework::GetCurrentUS();
+    run_fibers(iom, fibers, [&](int) {
+        for (int j = 0; j < 5; ++j) {
+            // 限时加锁，锁被长期占用时放弃这一轮
+            if (!mutex.lockFor(2)) {
+                ++timeouts;
+                continue;
+            }
+            usleep(1000); // 持锁做IO，只挂起本协程
+            mutex.unlock();
+        }
+    });
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    stop = true;
+    // 条件变量限时等待：没人通知，应当按时超时返回并重新持锁
+    bool notified = true;
+    run_fibers(iom, 1, [&](int) {
+        Framework::FiberMutex::Lock lock(mutex);
+        notified = cond.waitFor(mutex, 10);
+    });
+    LOG_INFO(g_logger) << "fiber_mutex hold across io: fibers=" << fibers << " used=" << used / 1000 << "ms"
+        << " lock_timeouts=" << timeouts << " other_fiber_ticks=" << ticks
+        << " condvar_timed_out=" << !notified;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int fibers = argc > 2 ? atoi(argv[2]) : 64;
+    int iters = argc > 3 ? atoi(argv[3]) : 20000;
+
+    Framework::IOManager iom(threads, false, "sync");
+    bench_mutex<Framework::Mutex>(iom, "pthread_mutex", fibers, iters);
+    bench_mutex<Framework::FiberMutex>(iom, "fiber_mutex", fibers, iters);
+    bench_rwmutex<Framework::RWMutex>(iom, "pthread_rwlock", fibers, iters);
+    bench_rwmutex<Framework::FiberRWMutex>(iom, "fiber_rwmutex", fibers, iters);
+    bench_pingpong<Framework::Semaphore>(iom, "pthread_semaphore", std::max(threads / 2, 1), iters);
+    bench_pingpong<Framework::FiberSemaphore>(iom, "fiber_semaphore", std::max(threads / 2, 1), iters);
+    bench_pingpong<Framework::FiberSemaphore>(iom, "fiber_semaphore", fibers / 2, iters / 10);
+    bench_hold_across_io(iom, fibers);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// 调度优先级：队列里堆满后台任务时，延迟敏感任务从schedule到开始执行的等待时间
+// 1. 全部NORMAL（等同于原来的单个FIFO）  2. 后台任务BACKGROUND、探测任务CRITICAL
+// 3. CRITICAL任务链占满所有线程时，后台任务靠scheduler.priority_aging防饿死（0为严格优先级）
+// 4. 优先级协程里调度的回调继承优先级
+// 用法：test_priority [IO线程数] [后台任务数] [探测次数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void spin(uint64_t us) {
+    uint64_t end = Framework::GetCurrentUS() + us;
+    while (Framework::GetCurrentUS() < end);
+}
+
+void bench_latency(Framework::IOManager& iom, const char* name, Framework::Fiber::Priority bulk
+    , Framework::Fiber::Priority probe, int tasks, int probes) {
+    std::atomic<int> bulk_left{ tasks };
+    for (int i = 0; i < tasks; ++i) {
+        iom.schedule([&bulk_left]() {
+            spin(5);
+            --bulk_left;
+        }, -1, bulk);
+    }
+
+    std::vector<uint64_t> lat(probes);
+    std::atomic<int> probe_left{ probes };
+    for (int i = 0; i < probes; ++i) {
+        uint64_t begin = Framework::GetCurrentUS();
+        iom.schedule([&lat, &probe_left, begin, i]() {
+            lat[i] = Framework::GetCurrentUS() - begin;
+            --probe_left;
+        }, -1, probe);
+        usleep(1000);
+    }
+    while (probe_left || bulk_left) {
+        usleep(1000);
+    }
+    std::sort(lat.begin(), lat.end());
+    LOG_INFO(g_logger) << name << ": probe wait p50=" << lat[probes / 2] << "us p99=" << lat[probes * 99 / 100]
+        << "us max=" << lat.back() << "us";
+}
+
+static void critical_chain(Framework::IOManager* iom, std::atomic<bool>* stop) {
+    spin(20);
+    if (!*stop) {
+        iom->schedule([iom, stop]() {
+            critical_chain(iom, stop);
+        });
+    }
+}
+
+int bench_starvation(uint32_t aging, int threads) {
+    Framework::Config::Lookup<uint32_t>("scheduler.priority_aging", (uint32_t)8)->setValue(aging);
+    std::atomic<bool> stop{ false };
+    std::atomic<int> bulk_done{ 0 };
+    int done = 0;
+    {
+        Framework::IOManager iom(threads, false, "starve");
+        // 每个线程一条以上的CRITICAL任务链，队列里始终有CRITICAL任务
+        for (int i = 0; i < threads * 2; ++i) {
+            iom.schedule([&iom, &stop]() {
+                critical_chain(&iom, &stop);
+            }, -1, Framework::Fiber::CRITICAL);
+        }
+        for (int i = 0; i < 100000; ++i) {
+            iom.schedule([&bulk_done]() {
+                ++bulk_done;
+            }, -1, Framework::Fiber::BACKGROUND);
+        }
+        usleep(200 * 1000);
+        done = bulk_done;
+        LOG_INFO(g_logger) << "priority_aging=" << aging << ": background tasks done in 200ms under critical load="
+            << done;
+        stop = true;
+    }
+    return done; // 析构时剩下的后台任务都会执行完，只算200ms内的
+}
+
+void check_inherit(Framework::IOManager& iom) {
+    std::atomic<int> child{ -2 };
+    std::atomic<int> fiber_child{ -2 };
+    iom.schedule([&iom, &child, &fiber_child]() {
+        iom.schedule([&child]() {
+            child = Framework::Fiber::GetCurrentPriority();
+        });
+        iom.schedule(Framework::Fiber::ptr(new Framework::Fiber([&fiber_child]() {
+            fiber_child = Framework::Fiber::GetCurrentPriority();
+        })));
+    }, -1, Framework::Fiber::CRITICAL);
+    while (child == -2 || fiber_child == -2) {
+        usleep(1000);
+    }
+    LOG_INFO(g_logger) << "inherit: callback priority=" << child << " fiber priority=" << fiber_child
+        << " (CRITICAL=" << Framework::Fiber::CRITICAL << ")";
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 2;
+    int tasks = argc > 2 ? atoi(argv[2]) : 100000;
+    int probes = argc > 3 ? atoi(argv[3]) : 200;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+
+    {
+        Framework::IOManager iom(threads, false, "prio");
+        bench_latency(iom, "all NORMAL", Framework::Fiber::NORMAL, Framework::Fiber::NORMAL, tasks, probes);
+        bench_latency(iom, "bulk BACKGROUND, probe CRITICAL", Framework::Fiber::BACKGROUND, Framework::Fiber::CRITICAL, tasks, probes);
+        check_inherit(iom);
+    }
+    // 严格优先级下后台任务基本拿不到线程，开启防饿死后按比例拿到
+    int strict = bench_starvation(0, threads);
+    int aged = bench_starvation(8, threads);
+    ASSERT(strict < 100);
+    ASSERT(aged > strict * 10);
+    return 0;
+}
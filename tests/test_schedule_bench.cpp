@@ -0,0 +1,106 @@
+#include <unistd.h>
+
+#include <atomic>
+
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "multithread.h"
+
+// schedule()吞吐量测试：生产者线程数从1增加到N，观察跨线程投递任务的吞吐变化
+// 同时输出唤醒次数：需要唤醒的次数 vs 合并后实际写eventfd的次数
+// 最后是延迟：多个外部线程按远低于处理能力的速率投递，任务从schedule到执行的等待不能被入队到一半的生产者拖到epoll超时
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{ 0 };
+
+static void task() {
+    ++s_done;
+}
+
+void bench(Framework::IOManager& iom, int producers, uint64_t per_producer) {
+    s_done = 0;
+    uint64_t needed = iom.getTickleNeeded();
+    uint64_t sent = iom.getTickleSent();
+    uint64_t total = producers * per_producer;
+    uint64_t begin = Framework::GetCurrentUS();
+
+    std::vector<Framework::Multithread::ptr> thrs;
+    for (int i = 0; i < producers; ++i) {
+        thrs.push_back(Framework::Multithread::ptr(new Framework::Multithread([&iom, per_producer]() {
+            for (uint64_t j = 0; j < per_producer; ++j) {
+                iom.schedule(&task);
+            }
+        }, "producer_" + std::to_string(i))));
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+    uint64_t pushed = Framework::GetCurrentUS();
+    while (s_done < total) {
+        usleep(100);
+    }
+    uint64_t end = Framework::GetCurrentUS();
+
+    LOG_INFO(g_logger) << "producers=" << producers
+        << " tasks=" << total
+        << " schedule=" << total * 1000000 / (pushed - begin + 1) << "/s"
+        << " end_to_end=" << total * 1000000 / (end - begin + 1) << "/s"
+        << " tickle_needed=" << iom.getTickleNeeded() - needed
+        << " tickle_sent=" << iom.getTickleSent() - sent; // 两者之差就是被合并掉的eventfd写入
+}
+
+void bench_latency(int producers, int seconds, int per_ms) {
+    std::atomic<uint64_t> max_wait{ 0 };
+    std::atomic<uint64_t> over_1s{ 0 };
+    std::atomic<uint64_t> done{ 0 };
+    uint64_t total = 0;
+    {
+        Framework::IOManager iom(2, false, "latency");
+        std::vector<Framework::Multithread::ptr> thrs;
+        std::atomic<uint64_t> pushed{ 0 };
+        for (int i = 0; i < producers; ++i) {
+            thrs.push_back(Framework::Multithread::ptr(new Framework::Multithread([&, seconds, per_ms]() {
+                uint64_t end = Framework::GetCurrentMS() + seconds * 1000;
+                while (Framework::GetCurrentMS() < end) {
+                    for (int j = 0; j < per_ms; ++j) {
+                        uint64_t begin = Framework::GetCurrentUS();
+                        iom.schedule([&, begin]() {
+                            uint64_t wait = Framework::GetCurrentUS() - begin;
+                            uint64_t cur = max_wait;
+                            while (wait > cur && !max_wait.compare_exchange_weak(cur, wait));
+                            if (wait >= 1000 * 1000) {
+                                ++over_1s;
+                            }
+                            ++done;
+                        });
+                    }
+                    pushed += per_ms;
+                    usleep(1000);
+                }
+            }, "producer_" + std::to_string(i))));
+        }
+        for (auto& i : thrs) {
+            i->join();
+        }
+        total = pushed;
+        while (done < total) {
+            usleep(1000);
+        }
+    }
+    LOG_INFO(g_logger) << "latency: producers=" << producers << " tasks=" << total
+        << " rate=" << total / seconds << "/s max_wait=" << max_wait << "us over_1s=" << over_1s;
+    ASSERT(over_1s == 0);
+}
+
+int main(int argc, char** argv) {
+    int max_producers = argc > 1 ? atoi(argv[1]) : 8;
+    uint64_t per_producer = argc > 2 ? atoll(argv[2]) : 200000;
+
+    Framework::IOManager iom(4, false, "bench");
+    for (int p = 1; p <= max_producers; p *= 2) {
+        bench(iom, p, per_producer);
+    }
+    bench_latency(max_producers, 3, 9);
+    return 0;
+}
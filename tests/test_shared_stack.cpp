@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include <atomic>
+#include <fstream>
+
+#include "config.h"
+#include "fiber.h"
+#include "log.h"
+#include "scheduler.h"
+
+// 空闲协程内存占用测试：N个协程各用掉一点栈后挂起（模拟等待数据的空闲连接），对比独立栈与共享栈的内存
+// 用法：test_shared_stack [协程数] [每个协程用到的栈字节数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<uint64_t> s_parked{ 0 };
+static std::atomic<uint64_t> s_broken{ 0 };
+static Framework::Mutex s_mutex;
+static std::vector<Framework::Fiber::ptr> s_fibers;
+
+// 读/proc/self/status里的某一项，单位KB
+static uint64_t read_status_kb(const std::string& key) {
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, key.size(), key) == 0 && line[key.size()] == ':') {
+            return strtoull(line.c_str() + key.size() + 1, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+static void idle_conn(size_t touch) {
+    char* buf = (char*)alloca(touch);
+    memset(buf, 0x5a, touch);
+    {
+        Framework::Mutex::Lock lock(s_mutex);
+        s_fibers.push_back(Framework::Fiber::GetThis());
+    }
+    ++s_parked;
+    Framework::Fiber::YieldToHold();
+    // 共享栈模式下，挂起期间栈被别的协程占用过，醒来时内容必须原样恢复
+    for (size_t i = 0; i < touch; ++i) {
+        if (buf[i] != 0x5a) {
+            ++s_broken;
+            break;
+        }
+    }
+}
+
+void bench(const std::string& name, uint64_t n, size_t touch) {
+    s_parked = 0;
+    s_broken = 0;
+    s_fibers.clear();
+    s_fibers.reserve(n);
+
+    Framework::Scheduler sc(1, false, name);
+    sc.start();
+    uint64_t rss0 = read_status_kb("VmRSS");
+    uint64_t vm0 = read_status_kb("VmSize");
+    for (uint64_t i = 0; i < n; ++i) {
+        sc.schedule(std::bind(&idle_conn, touch));
+    }
+    while (s_parked < n) {
+        usleep(1000);
+    }
+    uint64_t rss = read_status_kb("VmRSS") - rss0;
+    uint64_t vm = read_status_kb("VmSize") - vm0;
+
+    // 唤醒所有协程，让它们跑完
+    {
+        Framework::Mutex::Lock lock(s_mutex);
+        for (auto& i : s_fibers) {
+            sc.schedule(i);
+        }
+    }
+    sc.stop();
+    s_fibers.clear();
+
+    LOG_INFO(g_logger) << name << ": fibers=" << n
+        << " touch=" << touch
+        << " rss=" << rss << "KB (" << rss * 1024 / n << "B/fiber)"
+        << " vm=" << vm << "KB (" << vm * 1024 / n << "B/fiber)"
+        << " broken=" << s_broken;
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? atoll(argv[1]) : 10000;
+    size_t touch = argc > 2 ? atoll(argv[2]) : 2048;
+
+    auto shared_count = Framework::Config::Lookup<uint32_t>("fiber.shared_stack_count", 0);
+    shared_count->setValue(0);
+    bench("private", n, touch);
+    shared_count->setValue(4);
+    bench("shared", n, touch);
+    return 0;
+}
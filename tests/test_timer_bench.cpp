@@ -0,0 +1,158 @@
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "timer.h"
+#include "utils.h"
+
+// 定时器后端测试：std::set vs 分层时间轮，模拟1M个连接各自带读超时
+// 以及多个IO线程同时加/取消超时时，共享队列（一把锁）与线程私有队列的对比
+// 用法：test_timer_bench [定时器个数] [IO线程数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+class BenchTimerManager : public Framework::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+static void on_timeout() {
+}
+
+void bench(const std::string& name, uint64_t n) {
+    Framework::Config::Lookup<bool>("timer.wheel", false)->setValue(name == "wheel");
+    BenchTimerManager mgr;
+    std::shared_ptr<int> cond(new int(0));
+    std::vector<Framework::Timer::ptr> timers(n);
+
+    // 1. 1M个连接挂着读超时（1~30s）
+    uint64_t begin = Framework::GetCurrentUS();
+    for (uint64_t i = 0; i < n; ++i) {
+        timers[i] = mgr.addConditionTimer(1000 + rand() % 29000, &on_timeout, cond);
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": add " << n << " timers " << used * 1000.0 / n << " ns/op";
+
+    // 2. 在1M个定时器存在的情况下，模拟hook的IO：加超时 -> 数据到达 -> 取消超时
+    begin = Framework::GetCurrentUS();
+    for (uint64_t i = 0; i < n; ++i) {
+        Framework::Timer::ptr timer = mgr.addConditionTimer(1000 + rand() % 29000, &on_timeout, cond);
+        timer->cancel();
+    }
+    used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": add+cancel with " << n << " pending " << used * 1000.0 / n << " ns/op";
+
+    // 3. 按随机顺序取消全部定时器（连接陆续收到数据）
+    std::random_shuffle(timers.begin(), timers.end());
+    begin = Framework::GetCurrentUS();
+    for (auto& timer : timers) {
+        timer->cancel();
+    }
+    used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": cancel " << n << " timers " << used * 1000.0 / n << " ns/op";
+    timers.clear();
+
+    // 4. 到期：1M个定时器在0~500ms内陆续到期，按getNextTimer的结果休眠，检查有没有提前或漏掉的
+    uint64_t fired = 0, early = 0, max_late = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t ms = rand() % 500;
+        uint64_t deadline = Framework::GetCurrentMS() + ms;
+        mgr.addTimer(ms, [deadline, &fired, &early, &max_late]() {
+            uint64_t now = Framework::GetCurrentMS();
+            ++fired;
+            if (now < deadline) {
+                ++early;
+            }
+            else {
+                max_late = std::max(max_late, now - deadline);
+            }
+        });
+    }
+    uint64_t expire_us = 0;
+    std::vector<std::function<void()> > cbs;
+    while (fired < n) {
+        uint64_t next = mgr.getNextTimer();
+        if (next == ~0ull) {
+            break;
+        }
+        if (next) {
+            usleep(next * 1000);
+        }
+        begin = Framework::GetCurrentUS();
+        mgr.listExpiredCb(cbs);
+        expire_us += Framework::GetCurrentUS() - begin;
+        for (auto& cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+    }
+    LOG_INFO(g_logger) << name << ": expire " << n << " timers " << expire_us * 1000.0 / n << " ns/op"
+        << " fired=" << fired << " early=" << early << " max_late=" << max_late << "ms";
+}
+
+void bench_threads(bool per_thread, uint64_t n, int threads) {
+    Framework::Config::Lookup<bool>("timer.wheel", false)->setValue(true);
+    Framework::Config::Lookup<bool>("timer.per_thread", false)->setValue(per_thread);
+    std::string name = per_thread ? "per_thread" : "shared";
+    std::atomic<uint64_t> done{ 0 };
+    std::atomic<uint64_t> fired{ 0 };
+    std::shared_ptr<int> cond(new int(0));
+
+    Framework::IOManager iom(threads, false, name);
+    // 每个IO线程上反复 加超时 -> 取消超时
+    uint64_t per_task = n / threads;
+    uint64_t begin = Framework::GetCurrentUS();
+    for (int i = 0; i < threads; ++i) {
+        iom.schedule([&iom, &done, cond, per_task]() {
+            for (uint64_t j = 0; j < per_task; ++j) {
+                Framework::Timer::ptr timer = iom.addConditionTimer(1000 + rand() % 29000, &on_timeout, cond);
+                timer->cancel();
+            }
+            ++done;
+        });
+    }
+    while (done < (uint64_t)threads) {
+        usleep(1000);
+    }
+    uint64_t used = Framework::GetCurrentUS() - begin;
+    LOG_INFO(g_logger) << name << ": " << threads << " io threads add+cancel "
+        << per_task * threads * 1000000 / (used + 1) << "/s";
+
+    // 在IO线程上建定时器，从外部线程取消一半，确认被取消的不会触发、没取消的都会触发
+    const uint64_t count = 10000;
+    Framework::Mutex mutex;
+    std::vector<Framework::Timer::ptr> timers;
+    done = 0;
+    for (int i = 0; i < threads; ++i) {
+        iom.schedule([&]() {
+            for (uint64_t j = 0; j < count / threads; ++j) {
+                Framework::Timer::ptr timer = iom.addTimer(100, [&fired]() { ++fired; });
+                Framework::Mutex::Lock lock(mutex);
+                timers.push_back(timer);
+            }
+            ++done;
+        });
+    }
+    while (done < (uint64_t)threads) {
+        usleep(1000);
+    }
+    uint64_t cancelled = 0;
+    for (size_t i = 0; i < timers.size(); i += 2) {
+        cancelled += timers[i]->cancel();
+    }
+    usleep(500 * 1000);
+    LOG_INFO(g_logger) << name << ": created=" << timers.size() << " cancelled=" << cancelled
+        << " fired=" << fired << " expect=" << timers.size() - cancelled;
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? atoll(argv[1]) : 1000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    bench("set", n);
+    bench("wheel", n);
+    bench_threads(false, n, threads);
+    bench_threads(true, n, threads);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config.h"
+#include "fdmanager.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+
+// io_uring：协程在某个线程的io_uring上读，之后这个线程一直有任务做、进不了idle，
+// 数据到达后读也要很快完成，不能等到这个线程闲下来（其他线程闲着也帮不上忙，完成只在所属线程上收割）
+// 用法：test_uring [忙碌毫秒数]
+static Framework::Logger::ptr g_logger = LOG_ROOT();
+
+static void spin(uint64_t us) {
+    uint64_t end = Framework::GetCurrentUS() + us;
+    while (Framework::GetCurrentUS() < end);
+}
+
+// 绑定在thread上的任务链，每个任务占100us，直到stop
+static void busy_chain(Framework::IOManager* iom, int thread, std::atomic<bool>* stop) {
+    spin(100);
+    if (!*stop) {
+        iom->schedule([iom, thread, stop]() {
+            busy_chain(iom, thread, stop);
+        }, thread);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t busy_ms = argc > 1 ? atoi(argv[1]) : 1000;
+    Framework::Config::LoadFromYaml(YAML::Load("logs:\n  - name: system\n    level: ERROR"));
+    Framework::Config::Lookup<bool>("iomanager.io_uring", false)->setValue(true);
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> read_done{ 0 };
+    {
+        Framework::IOManager iom(2, false, "uring");
+        int thread = iom.getWorkerThreadIds()[0];
+        iom.schedule([&]() {
+            Framework::FdMgr::GetInstance()->get(fds[0], true); // 登记到FdManager，hook的read才会交给io_uring
+            char c;
+            int rt = read(fds[0], &c, 1);
+            read_done = Framework::GetCurrentUS();
+            LOG_INFO(g_logger) << "read rt=" << rt;
+        }, thread);
+        usleep(10 * 1000);
+        iom.schedule([&iom, thread, &stop]() {
+            busy_chain(&iom, thread, &stop);
+        }, thread);
+        usleep(50 * 1000);
+
+        uint64_t written = Framework::GetCurrentUS();
+        write(fds[1], "x", 1);
+        uint64_t end = Framework::GetCurrentMS() + busy_ms;
+        while (!read_done && Framework::GetCurrentMS() < end) {
+            usleep(1000);
+        }
+        stop = true;
+        while (!read_done) {
+            usleep(1000);
+        }
+        uint64_t wait_us = read_done - written;
+        LOG_INFO(g_logger) << "read completed " << wait_us << "us after the write, owner thread busy for "
+            << busy_ms << "ms";
+        ASSERT(wait_us < busy_ms * 1000 / 2);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}